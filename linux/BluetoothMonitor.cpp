@@ -1,15 +1,55 @@
 #include "BluetoothMonitor.h"
 #include "logger.h"
+#include "startuptimeline.h"
 
 #include <QDebug>
 #include <QDBusObjectPath>
 #include <QDBusMetaType>
 
+namespace
+{
+    const QString BluezService = QStringLiteral("org.bluez");
+    const QString DeviceInterface = QStringLiteral("org.bluez.Device1");
+    const QString PropertiesInterface = QStringLiteral("org.freedesktop.DBus.Properties");
+    const QString ObjectManagerInterface = QStringLiteral("org.freedesktop.DBus.ObjectManager");
+    const QString AirPodsUuid = QStringLiteral("74ec2172-0bad-4d01-8f77-997b2be0722a");
+
+    bool isActive(const BluetoothMonitor::Device &device)
+    {
+        return device.connected && device.airPods;
+    }
+
+    void applyProperties(BluetoothMonitor::Device &device, const QVariantMap &props)
+    {
+        if (props.contains("Address"))
+        {
+            device.address = props["Address"].toString();
+        }
+        if (props.contains("Name"))
+        {
+            device.name = props["Name"].toString();
+        }
+        else if (device.name.isEmpty() && props.contains("Alias"))
+        {
+            device.name = props["Alias"].toString();
+        }
+        if (props.contains("Connected"))
+        {
+            device.connected = props["Connected"].toBool();
+        }
+        if (props.contains("UUIDs"))
+        {
+            device.airPods = props["UUIDs"].toStringList().contains(AirPodsUuid);
+        }
+    }
+}
+
 BluetoothMonitor::BluetoothMonitor(QObject *parent)
     : QObject(parent), m_dbus(QDBusConnection::systemBus())
 {
     // Register meta-types for D-Bus interaction
     qDBusRegisterMetaType<QDBusObjectPath>();
+    qDBusRegisterMetaType<InterfaceList>();
     qDBusRegisterMetaType<ManagedObjectList>();
 
     if (!m_dbus.isConnected())
@@ -19,7 +59,6 @@ BluetoothMonitor::BluetoothMonitor(QObject *parent)
     }
 
     registerDBusService();
-    checkAlreadyConnectedDevices(); // Check for already connected devices on startup
 }
 
 BluetoothMonitor::~BluetoothMonitor()
@@ -29,133 +68,170 @@ BluetoothMonitor::~BluetoothMonitor()
 
 void BluetoothMonitor::registerDBusService()
 {
-    // Match signals for PropertiesChanged on any BlueZ Device interface
-    if (!m_dbus.connect("", "", "org.freedesktop.DBus.Properties", "PropertiesChanged",
-                        this, SLOT(onPropertiesChanged(QString, QVariantMap, QStringList))))
+    // Devices come and go through the object manager, each one gets its own PropertiesChanged match in addDevice
+    if (!m_dbus.connect(BluezService, "/", ObjectManagerInterface, "InterfacesAdded",
+                        this, SLOT(onInterfacesAdded(QDBusMessage))) ||
+        !m_dbus.connect(BluezService, "/", ObjectManagerInterface, "InterfacesRemoved",
+                        this, SLOT(onInterfacesRemoved(QDBusObjectPath, QStringList))))
     {
-        LOG_WARN("Failed to connect to D-Bus PropertiesChanged signal");
+        LOG_WARN("Failed to connect to BlueZ object manager signals");
     }
+
+    // A restarted bluetoothd has new objects and has forgotten our connections
+    m_serviceWatcher = new QDBusServiceWatcher(BluezService, m_dbus,
+                                               QDBusServiceWatcher::WatchForRegistration | QDBusServiceWatcher::WatchForUnregistration, this);
+    connect(m_serviceWatcher, &QDBusServiceWatcher::serviceUnregistered, this, [this]() {
+        LOG_WARN("BlueZ left the system bus");
+        clearDevices();
+    });
+    connect(m_serviceWatcher, &QDBusServiceWatcher::serviceRegistered, this, [this]() {
+        LOG_INFO("BlueZ appeared on the system bus");
+        requestManagedObjects();
+    });
 }
 
-bool BluetoothMonitor::isAirPodsDevice(const QString &devicePath)
+void BluetoothMonitor::start()
 {
-    QDBusInterface deviceInterface("org.bluez", devicePath, "org.freedesktop.DBus.Properties", m_dbus);
-
-    // Get UUIDs to check if it's an AirPods device
-    QDBusReply<QVariant> uuidsReply = deviceInterface.call("Get", "org.bluez.Device1", "UUIDs");
-    if (!uuidsReply.isValid())
+    if (m_dbus.isConnected())
     {
-        return false;
+        requestManagedObjects();
     }
-
-    QStringList uuids = uuidsReply.value().toStringList();
-    return uuids.contains("74ec2172-0bad-4d01-8f77-997b2be0722a");
 }
 
-QString BluetoothMonitor::getDeviceName(const QString &devicePath)
+QList<BluetoothMonitor::Device> BluetoothMonitor::connectedAirPods() const
 {
-    QDBusInterface deviceInterface("org.bluez", devicePath, "org.freedesktop.DBus.Properties", m_dbus);
-    QDBusReply<QVariant> nameReply = deviceInterface.call("Get", "org.bluez.Device1", "Name");
-    if (nameReply.isValid())
+    QList<Device> devices;
+    for (const Device &device : m_devices)
     {
-        return nameReply.value().toString();
+        if (isActive(device))
+        {
+            devices.append(device);
+        }
     }
-    return "Unknown";
+    return devices;
 }
 
-bool BluetoothMonitor::checkAlreadyConnectedDevices()
+void BluetoothMonitor::requestManagedObjects()
 {
-    QDBusInterface objectManager("org.bluez", "/", "org.freedesktop.DBus.ObjectManager", m_dbus);
-    QDBusMessage reply = objectManager.call("GetManagedObjects");
-
-    if (reply.type() == QDBusMessage::ErrorMessage)
-    {
-        LOG_WARN("Failed to get managed objects: " << reply.errorMessage());
-        return false;
-    }
-
-    QVariant firstArg = reply.arguments().constFirst();
-    QDBusArgument arg = firstArg.value<QDBusArgument>();
-    ManagedObjectList managedObjects;
-    arg >> managedObjects;
-
-    bool deviceFound = false;
-
-    for (auto it = managedObjects.constBegin(); it != managedObjects.constEnd(); ++it)
-    {
-        const QDBusObjectPath &objPath = it.key();
-        const QMap<QString, QVariantMap> &interfaces = it.value();
-
-        if (interfaces.contains("org.bluez.Device1"))
+    QDBusMessage call = QDBusMessage::createMethodCall(BluezService, "/", ObjectManagerInterface, "GetManagedObjects");
+    auto *watcher = new QDBusPendingCallWatcher(m_dbus.asyncCall(call), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this](QDBusPendingCallWatcher *pending) {
+        QDBusPendingReply<ManagedObjectList> reply = *pending;
+        pending->deleteLater();
+        if (reply.isError())
         {
-            const QVariantMap &deviceProps = interfaces.value("org.bluez.Device1");
+            LOG_WARN("Failed to get managed objects: " << reply.error().message());
+            return;
+        }
 
-            // Check if the device has the necessary properties
-            if (!deviceProps.contains("UUIDs") || !deviceProps.contains("Connected") ||
-                !deviceProps.contains("Address") || !deviceProps.contains("Name"))
+        const ManagedObjectList managedObjects = reply.value();
+        for (auto it = managedObjects.constBegin(); it != managedObjects.constEnd(); ++it)
+        {
+            auto device = it.value().constFind(DeviceInterface);
+            if (device != it.value().constEnd())
             {
-                continue;
+                addDevice(it.key().path(), *device);
             }
+        }
+        LOG_DEBUG("Cached " << m_devices.size() << " BlueZ devices");
+        StartupTimeline::mark("BlueZ devices enumerated");
+    });
+}
 
-            QStringList uuids = deviceProps["UUIDs"].toStringList();
-            bool isAirPods = uuids.contains("74ec2172-0bad-4d01-8f77-997b2be0722a");
-
-            if (isAirPods)
-            {
-                bool connected = deviceProps["Connected"].toBool();
-                if (connected)
-                {
-                    QString macAddress = deviceProps["Address"].toString();
-                    QString deviceName = deviceProps["Name"].toString();
-                    emit deviceConnected(macAddress, deviceName);
-                    LOG_DEBUG("Found already connected AirPods: " << macAddress << " Name: " << deviceName);
-                    deviceFound = true;
-                }
-            }
+void BluetoothMonitor::addDevice(const QString &path, const QVariantMap &props)
+{
+    auto it = m_devices.find(path);
+    if (it == m_devices.end())
+    {
+        it = m_devices.insert(path, Device());
+        if (!m_dbus.connect(BluezService, path, PropertiesInterface, "PropertiesChanged", this,
+                            SLOT(onPropertiesChanged(QString, QVariantMap, QStringList, QDBusMessage))))
+        {
+            LOG_WARN("Failed to watch properties of " << path);
         }
     }
-    return deviceFound;
+
+    bool wasActive = isActive(*it);
+    applyProperties(*it, props);
+    if (isActive(*it) != wasActive)
+    {
+        reportConnection(*it);
+    }
 }
 
-void BluetoothMonitor::onPropertiesChanged(const QString &interface, const QVariantMap &changedProps, const QStringList &invalidatedProps)
+void BluetoothMonitor::removeDevice(const QString &path)
 {
-    Q_UNUSED(invalidatedProps);
-
-    if (interface != "org.bluez.Device1")
+    auto it = m_devices.find(path);
+    if (it == m_devices.end())
     {
         return;
     }
+    m_dbus.disconnect(BluezService, path, PropertiesInterface, "PropertiesChanged", this,
+                      SLOT(onPropertiesChanged(QString, QVariantMap, QStringList, QDBusMessage)));
+    Device device = *it;
+    m_devices.erase(it);
+    if (isActive(device))
+    {
+        device.connected = false;
+        reportConnection(device);
+    }
+}
 
-    if (changedProps.contains("Connected"))
+void BluetoothMonitor::clearDevices()
+{
+    const QStringList paths = m_devices.keys();
+    for (const QString &path : paths)
     {
-        bool connected = changedProps["Connected"].toBool();
-        QString path = QDBusContext::message().path();
+        removeDevice(path);
+    }
+}
 
-        if (!isAirPodsDevice(path))
-        {
-            return;
-        }
+void BluetoothMonitor::reportConnection(const Device &device)
+{
+    if (isActive(device))
+    {
+        LOG_DEBUG("AirPods device connected:" << device.address << " Name:" << device.name);
+        emit deviceConnected(device.address, device.name);
+    }
+    else
+    {
+        LOG_DEBUG("AirPods device disconnected:" << device.address << " Name:" << device.name);
+        emit deviceDisconnected(device.address, device.name);
+    }
+}
 
-        QDBusInterface deviceInterface("org.bluez", path, "org.freedesktop.DBus.Properties", m_dbus);
+void BluetoothMonitor::onInterfacesAdded(const QDBusMessage &message)
+{
+    const QList<QVariant> args = message.arguments();
+    if (args.size() < 2)
+    {
+        return;
+    }
+    const QString path = args.at(0).value<QDBusObjectPath>().path();
+    const InterfaceList interfaces = qdbus_cast<InterfaceList>(args.at(1));
+    auto device = interfaces.constFind(DeviceInterface);
+    if (device != interfaces.constEnd())
+    {
+        addDevice(path, *device);
+    }
+}
 
-        // Get the device address
-        QDBusReply<QVariant> addrReply = deviceInterface.call("Get", "org.bluez.Device1", "Address");
-        if (!addrReply.isValid())
-        {
-            return;
-        }
-        QString macAddress = addrReply.value().toString();
-        QString deviceName = getDeviceName(path);
+void BluetoothMonitor::onInterfacesRemoved(const QDBusObjectPath &path, const QStringList &interfaces)
+{
+    if (interfaces.contains(DeviceInterface))
+    {
+        removeDevice(path.path());
+    }
+}
 
-        if (connected)
-        {
-            emit deviceConnected(macAddress, deviceName);
-            LOG_DEBUG("AirPods device connected:" << macAddress << " Name:" << deviceName);
-        }
-        else
-        {
-            emit deviceDisconnected(macAddress, deviceName);
-            LOG_DEBUG("AirPods device disconnected:" << macAddress << " Name:" << deviceName);
-        }
+void BluetoothMonitor::onPropertiesChanged(const QString &interface, const QVariantMap &changedProps,
+                                           const QStringList &invalidatedProps, const QDBusMessage &message)
+{
+    Q_UNUSED(invalidatedProps);
+
+    if (interface != DeviceInterface || !m_devices.contains(message.path()))
+    {
+        return;
     }
-}
\ No newline at end of file
+    addDevice(message.path(), changedProps);
+}
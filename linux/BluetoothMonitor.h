@@ -1,34 +1,61 @@
 #ifndef BLUETOOTHMONITOR_H
 #define BLUETOOTHMONITOR_H
 
+#include <QHash>
 #include <QObject>
 #include <QtDBus/QtDBus>
 
 // Forward declarations for D-Bus types
-typedef QMap<QDBusObjectPath, QMap<QString, QVariantMap>> ManagedObjectList;
+typedef QMap<QString, QVariantMap> InterfaceList;
+typedef QMap<QDBusObjectPath, InterfaceList> ManagedObjectList;
+Q_DECLARE_METATYPE(InterfaceList)
 Q_DECLARE_METATYPE(ManagedObjectList)
 
-class BluetoothMonitor : public QObject, protected QDBusContext
+// Mirrors the BlueZ devices in memory. The cache is seeded from one
+// GetManagedObjects call and kept current from ObjectManager signals and
+// per-device PropertiesChanged match rules, so connection changes are
+// detected without calling back into BlueZ.
+class BluetoothMonitor : public QObject
 {
     Q_OBJECT
 public:
+    struct Device
+    {
+        QString address;
+        QString name;
+        bool connected = false;
+        bool airPods = false;
+    };
+
     explicit BluetoothMonitor(QObject *parent = nullptr);
     ~BluetoothMonitor();
 
-    bool checkAlreadyConnectedDevices();
+    // Seeds the cache, emits deviceConnected for AirPods that are already connected
+    void start();
+
+    QList<Device> connectedAirPods() const;
 
 signals:
     void deviceConnected(const QString &macAddress, const QString &deviceName);
     void deviceDisconnected(const QString &macAddress, const QString &deviceName);
 
 private slots:
-    void onPropertiesChanged(const QString &interface, const QVariantMap &changedProps, const QStringList &invalidatedProps);
+    void onInterfacesAdded(const QDBusMessage &message);
+    void onInterfacesRemoved(const QDBusObjectPath &path, const QStringList &interfaces);
+    void onPropertiesChanged(const QString &interface, const QVariantMap &changedProps,
+                             const QStringList &invalidatedProps, const QDBusMessage &message);
 
 private:
     QDBusConnection m_dbus;
+    QDBusServiceWatcher *m_serviceWatcher = nullptr;
+    QHash<QString, Device> m_devices; // By object path
+
     void registerDBusService();
-    bool isAirPodsDevice(const QString &devicePath);
-    QString getDeviceName(const QString &devicePath);
+    void requestManagedObjects();
+    void addDevice(const QString &path, const QVariantMap &props);
+    void removeDevice(const QString &path);
+    void clearDevices();
+    void reportConnection(const Device &device);
 };
 
-#endif // BLUETOOTHMONITOR_H
\ No newline at end of file
+#endif // BLUETOOTHMONITOR_H
@@ -65,6 +65,14 @@ ApplicationWindow {
                 batteryLevel: airPodsTrayApp.battery.caseLevel
                 isCharging: airPodsTrayApp.battery.caseCharging
             }
+
+            PodColumn {
+                isVisible: airPodsTrayApp.battery.singleAvailable
+                inEar: true
+                iconSource: "qrc:/icons/assets/" + airPodsTrayApp.podIcon
+                batteryLevel: airPodsTrayApp.battery.singleLevel
+                isCharging: airPodsTrayApp.battery.singleCharging
+            }
         }
 
         SegmentedControl {
@@ -82,14 +90,8 @@ ApplicationWindow {
             stepSize: 1
             value: airPodsTrayApp.adaptiveNoiseLevel
 
-            Timer {
-                id: debounceTimer
-                interval: 500
-                onTriggered: if (!parent.pressed) airPodsTrayApp.setAdaptiveNoiseLevel(parent.value)
-            }
-
-            onPressedChanged: if (!pressed) airPodsTrayApp.setAdaptiveNoiseLevel(value)
-            onValueChanged: if (pressed) debounceTimer.restart()
+            // Writes are paced and coalesced by the command queue
+            onMoved: airPodsTrayApp.setAdaptiveNoiseLevel(value)
 
             Label {
                 text: "Adaptive Noise Level: " + parent.value
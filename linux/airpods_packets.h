@@ -3,20 +3,154 @@
 #define AIRPODS_PACKETS_H
 
 #include <QByteArray>
+#include <QByteArrayView>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <optional>
 #include "enums.h"
 
 namespace AirPodsPackets
 {
+    // Fixed-size packet that is built at compile time and lives in .rodata
+    template <std::size_t N>
+    struct Packet
+    {
+        char bytes[N];
+
+        static constexpr qsizetype size() { return N; }
+        constexpr const char *data() const { return bytes; }
+        constexpr operator QByteArrayView() const { return QByteArrayView(bytes, N); }
+
+        // For logging only, allocates
+        QByteArray toHex() const { return QByteArray::fromRawData(bytes, N).toHex(); }
+    };
+
+    namespace Detail
+    {
+        constexpr char hexDigit(char c)
+        {
+            return (c >= '0' && c <= '9') ? c - '0'
+                 : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                 : (c >= 'A' && c <= 'F') ? c - 'A' + 10
+                 : throw "invalid hex digit"; // Compile error when evaluated in a constant expression
+        }
+    }
+
+    // Compile-time equivalent of QByteArray::fromHex()
+    template <std::size_t N>
+    constexpr Packet<(N - 1) / 2> fromHex(const char (&hex)[N])
+    {
+        static_assert((N - 1) % 2 == 0, "Hex string must have an even number of digits");
+        Packet<(N - 1) / 2> packet{};
+        for (std::size_t i = 0; i < (N - 1) / 2; ++i)
+        {
+            packet.bytes[i] = static_cast<char>((Detail::hexDigit(hex[2 * i]) << 4) | Detail::hexDigit(hex[2 * i + 1]));
+        }
+        return packet;
+    }
+
+    template <std::size_t N, std::size_t M>
+    constexpr Packet<N + M> concat(const Packet<N> &first, const Packet<M> &second)
+    {
+        Packet<N + M> packet{};
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            packet.bytes[i] = first.bytes[i];
+        }
+        for (std::size_t i = 0; i < M; ++i)
+        {
+            packet.bytes[N + i] = second.bytes[i];
+        }
+        return packet;
+    }
+
+    // Assembles a variable-length packet in a caller-provided buffer without allocating
+    class PacketBuilder
+    {
+    public:
+        PacketBuilder(char *buffer, qsizetype capacity) : m_buffer(buffer), m_capacity(capacity) {}
+
+        PacketBuilder &append(QByteArrayView bytes)
+        {
+            if (m_size + bytes.size() > m_capacity)
+            {
+                m_overflow = true;
+                return *this;
+            }
+            std::memcpy(m_buffer + m_size, bytes.data(), bytes.size());
+            m_size += bytes.size();
+            return *this;
+        }
+
+        PacketBuilder &append(quint8 byte)
+        {
+            char c = static_cast<char>(byte);
+            return append(QByteArrayView(&c, 1));
+        }
+
+        // Empty if the packet didn't fit in the buffer
+        QByteArrayView view() const { return m_overflow ? QByteArrayView() : QByteArrayView(m_buffer, m_size); }
+
+    private:
+        char *m_buffer;
+        qsizetype m_capacity;
+        qsizetype m_size = 0;
+        bool m_overflow = false;
+    };
+
+    // Frame layout shared by every AAP packet
+    namespace Frame
+    {
+        constexpr int PREFIX_SIZE = 4;               // [type] 00 04 00
+        constexpr int HEADER_SIZE = 6;               // 04 00 04 00 [opcode] 00
+        constexpr int OPCODE_OFFSET = 4;
+        constexpr int CONTROL_IDENTIFIER_OFFSET = 6; // 04 00 04 00 09 00 [identifier]
+        constexpr int CONTROL_VALUE_OFFSET = 7;      // 04 00 04 00 09 00 [identifier] [value]
+
+        constexpr quint8 TYPE_HANDSHAKE = 0x00;
+        constexpr quint8 TYPE_HANDSHAKE_ACK = 0x01;
+        constexpr quint8 TYPE_DATA = 0x04;
+    }
+
+    // Opcodes of data packets (byte 4 of the header)
+    namespace Opcode
+    {
+        constexpr quint8 BATTERY_STATUS = 0x04;
+        constexpr quint8 EAR_DETECTION = 0x06;
+        constexpr quint8 CONTROL_COMMAND = 0x09;
+        constexpr quint8 REQUEST_NOTIFICATIONS = 0x0F;
+        constexpr quint8 HEAD_TRACKING = 0x17;
+        constexpr quint8 RENAME = 0x1A;
+        constexpr quint8 METADATA = 0x1D;
+        constexpr quint8 FEATURES_ACK = 0x2B;
+        constexpr quint8 MAGIC_CLOUD_KEYS_REQUEST = 0x30;
+        constexpr quint8 MAGIC_CLOUD_KEYS = 0x31;
+        constexpr quint8 CONVERSATIONAL_AWARENESS_DATA = 0x4B;
+        constexpr quint8 SET_SPECIFIC_FEATURES = 0x4D;
+    }
+
+    // Identifiers of control commands (byte 6 of an opcode 0x09 packet)
+    namespace ControlCommand
+    {
+        constexpr quint8 NOISE_CONTROL_MODE = 0x0D;
+        constexpr quint8 LISTENING_MODE_CONFIGS = 0x1A;
+        constexpr quint8 CONVERSATIONAL_AWARENESS = 0x28;
+        constexpr quint8 ADAPTIVE_NOISE_LEVEL = 0x2E;
+    }
+
     // Noise Control Mode Packets
     namespace NoiseControl
     {
-        static const QByteArray HEADER = QByteArray::fromHex("0400040009000D"); // Added for parsing
-        static const QByteArray OFF = HEADER + QByteArray::fromHex("01000000");
-        static const QByteArray NOISE_CANCELLATION = HEADER + QByteArray::fromHex("02000000");
-        static const QByteArray TRANSPARENCY = HEADER + QByteArray::fromHex("03000000");
-        static const QByteArray ADAPTIVE = HEADER + QByteArray::fromHex("04000000");
+        inline constexpr auto HEADER = fromHex("0400040009000D"); // Added for parsing
+        inline constexpr auto OFF = concat(HEADER, fromHex("01000000"));
+        inline constexpr auto NOISE_CANCELLATION = concat(HEADER, fromHex("02000000"));
+        inline constexpr auto TRANSPARENCY = concat(HEADER, fromHex("03000000"));
+        inline constexpr auto ADAPTIVE = concat(HEADER, fromHex("04000000"));
+        constexpr qsizetype PACKET_SIZE = 11;
+        constexpr qsizetype MODE_OFFSET = 7;
 
-        static const QByteArray getPacketForMode(AirpodsTrayApp::Enums::NoiseControlMode mode)
+        constexpr QByteArrayView getPacketForMode(AirpodsTrayApp::Enums::NoiseControlMode mode)
         {
             using NoiseControlMode = AirpodsTrayApp::Enums::NoiseControlMode;
             switch (mode)
@@ -30,7 +164,7 @@ namespace AirPodsPackets
             case NoiseControlMode::Adaptive:
                 return ADAPTIVE;
             default:
-                return QByteArray();
+                return QByteArrayView();
             }
         }
     }
@@ -38,13 +172,20 @@ namespace AirPodsPackets
     // Conversational Awareness Packets
     namespace ConversationalAwareness
     {
-        static const QByteArray HEADER = QByteArray::fromHex("04000400090028");          // For command/status
-        static const QByteArray ENABLED = HEADER + QByteArray::fromHex("01000000");      // Command to enable
-        static const QByteArray DISABLED = HEADER + QByteArray::fromHex("02000000");     // Command to disable
-        static const QByteArray DATA_HEADER = QByteArray::fromHex("040004004B00020001"); // For received speech level data
+        inline constexpr auto HEADER = fromHex("04000400090028");          // For command/status
+        inline constexpr auto ENABLED = concat(HEADER, fromHex("01000000")); // Command to enable
+        inline constexpr auto DISABLED = concat(HEADER, fromHex("02000000")); // Command to disable
+        inline constexpr auto DATA_HEADER = fromHex("040004004B00020001"); // For received speech level data
+        constexpr qsizetype DATA_PACKET_SIZE = 10;
+        constexpr qsizetype LEVEL_OFFSET = 9;
 
-        static std::optional<bool> parseCAState(const QByteArray &data)
+        inline std::optional<bool> parseCAState(QByteArrayView data)
         {
+            if (data.size() <= HEADER.size())
+            {
+                return std::nullopt;
+            }
+
             // Extract the status byte (index 7)
             quint8 statusByte = static_cast<quint8>(data.at(HEADER.size())); // HEADER.size() is 7
 
@@ -64,62 +205,73 @@ namespace AirPodsPackets
     // Connection Packets
     namespace Connection
     {
-        static const QByteArray HANDSHAKE = QByteArray::fromHex("00000400010002000000000000000000");
-        static const QByteArray SET_SPECIFIC_FEATURES = QByteArray::fromHex("040004004d00ff00000000000000");
-        static const QByteArray REQUEST_NOTIFICATIONS = QByteArray::fromHex("040004000f00ffffffffff");
-        static const QByteArray AIRPODS_DISCONNECTED = QByteArray::fromHex("00010000");
+        inline constexpr auto HANDSHAKE = fromHex("00000400010002000000000000000000");
+        inline constexpr auto SET_SPECIFIC_FEATURES = fromHex("040004004d00ff00000000000000");
+        inline constexpr auto REQUEST_NOTIFICATIONS = fromHex("040004000f00ffffffffff");
+        inline constexpr auto AIRPODS_DISCONNECTED = fromHex("00010000");
     }
 
     // Phone Communication Packets
     namespace Phone
     {
-        static const QByteArray NOTIFICATION = QByteArray::fromHex("00040001");
-        static const QByteArray CONNECTED = QByteArray::fromHex("00010001");
-        static const QByteArray DISCONNECTED = QByteArray::fromHex("00010000");
-        static const QByteArray STATUS_REQUEST = QByteArray::fromHex("00020003");
-        static const QByteArray DISCONNECT_REQUEST = QByteArray::fromHex("00020000");
+        inline constexpr auto NOTIFICATION = fromHex("00040001");
+        inline constexpr auto CONNECTED = fromHex("00010001");
+        inline constexpr auto DISCONNECTED = fromHex("00010000");
+        inline constexpr auto STATUS_REQUEST = fromHex("00020003");
+        inline constexpr auto DISCONNECT_REQUEST = fromHex("00020000");
     }
 
     // Adaptive Noise Packets
     namespace AdaptiveNoise
     {
-        const QByteArray HEADER = QByteArray::fromHex("0400040009002E");
+        inline constexpr auto HEADER = fromHex("0400040009002E");
+        constexpr qsizetype PACKET_SIZE = 11;
 
-        inline QByteArray getPacket(int level)
+        constexpr Packet<PACKET_SIZE> getPacket(quint8 level)
         {
-            return HEADER + static_cast<char>(level) + QByteArray::fromHex("000000");
+            auto packet = concat(HEADER, fromHex("00000000"));
+            packet.bytes[HEADER.size()] = static_cast<char>(level);
+            return packet;
         }
     }
 
     namespace Rename
     {
-        static QByteArray getPacket(const QString &newName)
+        inline constexpr auto HEADER = fromHex("040004001A0001");
+        constexpr qsizetype MAX_NAME_SIZE = 255; // The size field is a single byte
+        constexpr qsizetype MAX_PACKET_SIZE = HEADER.size() + 2 + MAX_NAME_SIZE;
+
+        // newName must be UTF-8. Empty if the name is longer than MAX_NAME_SIZE bytes.
+        inline QByteArrayView buildPacket(QByteArrayView newName, PacketBuilder &builder)
         {
-            QByteArray nameBytes = newName.toUtf8();                   // Convert name to UTF-8
-            quint8 size = static_cast<char>(nameBytes.size());         // Name length (1 byte)
-            QByteArray packet = QByteArray::fromHex("040004001A0001"); // Header
-            packet.append(size);                                       // Append size byte
-            packet.append('\0');                                       // Append null byte
-            packet.append(nameBytes);                                  // Append name bytes
-            return packet;
+            if (newName.size() > MAX_NAME_SIZE)
+            {
+                return QByteArrayView();
+            }
+            builder.append(HEADER)
+                .append(static_cast<quint8>(newName.size())) // Name length (1 byte)
+                .append(quint8(0))                          // Null byte
+                .append(newName);
+            return builder.view();
         }
     }
 
     namespace MagicPairing {
-        static const QByteArray REQUEST_MAGIC_CLOUD_KEYS = QByteArray::fromHex("0400040030000500");
-        static const QByteArray MAGIC_CLOUD_KEYS_HEADER = QByteArray::fromHex("04000400310002");
+        inline constexpr auto REQUEST_MAGIC_CLOUD_KEYS = fromHex("0400040030000500");
+        inline constexpr auto MAGIC_CLOUD_KEYS_HEADER = fromHex("04000400310002");
+        // Header (7 bytes) + (1 (tag) + 2 (length) + 1 (reserved) + 16 (value)) * 2
+        constexpr qsizetype MAGIC_CLOUD_KEYS_PACKET_SIZE = 47;
 
         struct MagicCloudKeys {
             QByteArray magicAccIRK;      // 16 bytes
             QByteArray magicAccEncKey;    // 16 bytes
         };
 
-        inline MagicCloudKeys parseMagicCloudKeysPacket(const QByteArray &data)
+        inline MagicCloudKeys parseMagicCloudKeysPacket(QByteArrayView data)
         {
             MagicCloudKeys keys;
 
-            // Expected size: header (7 bytes) + (1 (tag) + 2 (length) + 1 (reserved) + 16 (value)) * 2 = 47 bytes.
-            if (data.size() < 47)
+            if (data.size() < MAGIC_CLOUD_KEYS_PACKET_SIZE)
             {
                 return keys; // or handle error as needed
             }
@@ -152,7 +304,7 @@ namespace AirPodsPackets
             index += 1;
 
             // Extract MagicAccIRK (16 bytes)
-            keys.magicAccIRK = data.mid(index, 16);
+            keys.magicAccIRK = data.sliced(index, 16).toByteArray();
             index += 16;
 
             // --- TLV Block 2 (MagicAccEncKey) ---
@@ -175,7 +327,7 @@ namespace AirPodsPackets
             index += 1;
 
             // Extract MagicAccEncKey (16 bytes)
-            keys.magicAccEncKey = data.mid(index, 16);
+            keys.magicAccEncKey = data.sliced(index, 16).toByteArray();
             index += 16;
 
             return keys;
@@ -185,12 +337,89 @@ namespace AirPodsPackets
     // Parsing Headers
     namespace Parse
     {
-        static const QByteArray EAR_DETECTION = QByteArray::fromHex("040004000600");
-        static const QByteArray BATTERY_STATUS = QByteArray::fromHex("040004000400");
-        static const QByteArray METADATA = QByteArray::fromHex("040004001d");
-        static const QByteArray HANDSHAKE_ACK = QByteArray::fromHex("01000400");
-        static const QByteArray FEATURES_ACK = QByteArray::fromHex("040004002b00"); // Note: Only tested with airpods pro 2
+        inline constexpr auto EAR_DETECTION = fromHex("040004000600");
+        inline constexpr auto BATTERY_STATUS = fromHex("040004000400");
+        inline constexpr auto METADATA = fromHex("040004001d");
+        inline constexpr auto HANDSHAKE_ACK = fromHex("01000400");
+        inline constexpr auto FEATURES_ACK = fromHex("040004002b00"); // Note: Only tested with airpods pro 2
+        constexpr qsizetype EAR_DETECTION_PACKET_SIZE = 8;
+        constexpr qsizetype BATTERY_COMPONENT_SIZE = 5;
+        constexpr qsizetype MAX_BATTERY_COMPONENTS = 3;
     }
+
+    // Device information sent once after the handshake (opcode 0x1D)
+    namespace Metadata
+    {
+        constexpr qsizetype FIELDS_OFFSET = Parse::METADATA.size() + 6; // Six unknown bytes before the strings
+
+        // Null-terminated strings of the packet, viewed in place
+        struct Fields
+        {
+            QByteArrayView name;
+            QByteArrayView modelNumber;
+            QByteArrayView manufacturer;
+            QByteArrayView hardwareVersion;
+            QByteArrayView firmwareVersion;
+            QByteArrayView firmwareVersion2;
+            QByteArrayView softwareVersion;
+            QByteArrayView appIdentifier;
+            QByteArrayView serialNumber1;
+            QByteArrayView serialNumber2;
+            QByteArrayView unknownNumeric;
+            QByteArrayView unknownHash;
+            QByteArrayView trailingByte;
+        };
+
+        // The views point into data, which has to outlive the result
+        inline std::optional<Fields> parse(QByteArrayView data)
+        {
+            if (!data.startsWith(Parse::METADATA) || data.size() < FIELDS_OFFSET)
+            {
+                return std::nullopt;
+            }
+
+            QByteArrayView rest = data.sliced(FIELDS_OFFSET);
+            auto next = [&rest]()
+            {
+                qsizetype end = rest.indexOf('\0');
+                if (end < 0)
+                {
+                    end = rest.size();
+                }
+                QByteArrayView field = rest.first(end);
+                rest = rest.sliced(qMin(end + 1, rest.size()));
+                return field;
+            };
+
+            Fields fields;
+            for (QByteArrayView *field : {&fields.name, &fields.modelNumber, &fields.manufacturer,
+                                          &fields.hardwareVersion, &fields.firmwareVersion, &fields.firmwareVersion2,
+                                          &fields.softwareVersion, &fields.appIdentifier, &fields.serialNumber1,
+                                          &fields.serialNumber2, &fields.unknownNumeric, &fields.unknownHash,
+                                          &fields.trailingByte})
+            {
+                *field = next();
+            }
+            return fields;
+        }
+    }
+
+    // Keep the catalog in sync with the offsets the parsers and PacketDispatcher rely on
+    static_assert(Parse::EAR_DETECTION.size() == Frame::HEADER_SIZE);
+    static_assert(Parse::BATTERY_STATUS.size() == Frame::HEADER_SIZE);
+    static_assert(Parse::FEATURES_ACK.size() == Frame::HEADER_SIZE);
+    static_assert(Parse::HANDSHAKE_ACK.size() == Frame::PREFIX_SIZE);
+    static_assert(Parse::EAR_DETECTION_PACKET_SIZE == Frame::HEADER_SIZE + 2);
+    static_assert(NoiseControl::HEADER.size() == Frame::CONTROL_IDENTIFIER_OFFSET + 1);
+    static_assert(NoiseControl::HEADER.size() == NoiseControl::MODE_OFFSET);
+    static_assert(NoiseControl::MODE_OFFSET == Frame::CONTROL_VALUE_OFFSET);
+    static_assert(NoiseControl::OFF.size() == NoiseControl::PACKET_SIZE);
+    static_assert(ConversationalAwareness::HEADER.size() == Frame::CONTROL_IDENTIFIER_OFFSET + 1);
+    static_assert(ConversationalAwareness::ENABLED.size() == NoiseControl::PACKET_SIZE);
+    static_assert(ConversationalAwareness::DATA_HEADER.size() == ConversationalAwareness::LEVEL_OFFSET);
+    static_assert(AdaptiveNoise::HEADER.size() == Frame::CONTROL_IDENTIFIER_OFFSET + 1);
+    static_assert(MagicPairing::MAGIC_CLOUD_KEYS_HEADER.size() == 7);
+    static_assert(Connection::HANDSHAKE.size() == 16);
 }
 
 #endif // AIRPODS_PACKETS_H
\ No newline at end of file
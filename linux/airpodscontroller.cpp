@@ -0,0 +1,602 @@
+#include "airpodscontroller.h"
+#include "airpodssession.h"
+#include "audiobackend.h"
+#include "BluetoothMonitor.h"
+#include "bluetoothtransport.h"
+#include "commandqueue.h"
+#include "connectionstatemachine.h"
+#include "dbusservice.h"
+#include "logger.h"
+#include "metrics.h"
+#include "metricsserver.h"
+#include "packetcapture.h"
+#include "phonerelay.h"
+#include "reactionlatency.h"
+#include "seqpackettransport.h"
+#include "snapshotchannel.h"
+#include "startuptimeline.h"
+#include "unixsignalnotifier.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QProcess>
+#include <QSettings>
+#include <QTimer>
+#include <csignal>
+
+using namespace AirpodsTrayApp;
+using namespace AirpodsTrayApp::Enums;
+
+AirPodsController::AirPodsController(const Options &options, QObject *parent)
+    : QObject(parent)
+    , m_emulatorSockets(options.emulatorSockets)
+    , m_metricsSocket(options.metricsSocket)
+    , m_metricsPort(options.metricsPort)
+    , m_registry(new SessionRegistry(&m_deviceCache, this))
+    , m_capture(new PacketCapture(this))
+    , m_nextCaptureHandle(Btsnoop::DEFAULT_HANDLE)
+    , m_relay(nullptr)
+    , m_mediaController(new MediaController(this))
+    , m_settings(new QSettings("AirPodsTrayApp", "AirPodsTrayApp", this))
+{
+    connect(m_registry, &SessionRegistry::sessionCreated, this, &AirPodsController::setupSession);
+    connect(m_registry, &SessionRegistry::activeChanged, this, &AirPodsController::onActiveChanged);
+    connect(m_registry, &SessionRegistry::sessionAdded, this, &AirPodsController::reportDevices);
+    connect(m_registry, &SessionRegistry::sessionAdded, this, [this](const QString &address, AirPodsSession *session) {
+        LOG_INFO("Frames of " << address << " are captured on ACL handle " << m_captureHandles.value(session));
+    });
+    connect(m_registry, &SessionRegistry::sessionRemoved, this, &AirPodsController::reportDevices);
+    m_registry->start();
+
+    // The last frames are always kept in memory, SIGUSR2 writes them out
+    connect(new UnixSignalNotifier(SIGUSR2, this), &UnixSignalNotifier::activated, this, &AirPodsController::dumpCaptureRing);
+    // And the last minute of logging, debug output included, with SIGUSR1
+    connect(new UnixSignalNotifier(SIGUSR1, this), &UnixSignalNotifier::activated, this, &AsyncLogger::dumpFlightRecorder);
+    if (!options.captureFile.isEmpty())
+    {
+        m_capture->startRecording(options.captureFile);
+    }
+
+    m_relay = new PhoneRelay(session(), this);
+    m_relay->setTransportFactory([]() {
+        return new BluetoothTransport(QBluetoothAddress(PHONE_MAC_ADDRESS), BluetoothTransport::PhoneService);
+    });
+    m_relay->setEnabled(m_settings->value("crossdevice/enabled", false).toBool());
+    connect(m_relay, &PhoneRelay::disconnectRequested, this, &AirPodsController::onPhoneDisconnectRequested);
+
+    connect(m_mediaController, &MediaController::mediaStateChanged, this, &AirPodsController::handleMediaStateChange);
+    m_mediaController->setEarDetectionBehavior(static_cast<MediaController::EarDetectionBehavior>(
+        m_settings->value("earDetection/setting", MediaController::PauseWhenOneRemoved).toInt()));
+    onActiveChanged(session());
+}
+
+AirPodsController::~AirPodsController()
+{
+    m_settings->setValue("crossdevice/enabled", m_relay->isEnabled());
+    m_settings->setValue("earDetection/setting", m_mediaController->getEarDetectionBehavior());
+}
+
+void AirPodsController::start()
+{
+    StartupTimeline::mark("event loop running");
+
+    m_mediaController->initializeMprisInterface();
+    // Emulated AirPods must not switch the real audio output around, they get no sound server at all
+    if (m_emulatorSockets.isEmpty())
+    {
+        m_mediaController->initializeAudioBackend();
+        connect(m_mediaController->audioBackend(), &AudioBackend::readyChanged, this, [](bool ready) {
+            if (ready)
+            {
+                StartupTimeline::mark("audio backend ready");
+            }
+        });
+    }
+    m_mediaController->followMediaChanges();
+
+    (new DBusService(this))->registerOnBus();
+
+    if (!m_metricsSocket.isEmpty() || m_metricsPort != 0)
+    {
+        auto *server = new MetricsServer([this]() { return Metrics::render() + renderDeviceMetrics(); }, this);
+        if (!m_metricsSocket.isEmpty())
+        {
+            server->listenUnix(m_metricsSocket);
+        }
+        if (m_metricsPort != 0)
+        {
+            server->listenLoopback(m_metricsPort);
+        }
+    }
+
+    if (!m_emulatorSockets.isEmpty())
+    {
+        // Talk to tools/aapemulator instead of real AirPods
+        for (const QString &socketPath : std::as_const(m_emulatorSockets))
+        {
+            connectToEmulator(socketPath);
+        }
+        return;
+    }
+
+    monitor = new BluetoothMonitor(this);
+    connect(monitor, &BluetoothMonitor::deviceConnected, this, &AirPodsController::bluezDeviceConnected);
+    connect(monitor, &BluetoothMonitor::deviceDisconnected, this, &AirPodsController::bluezDeviceDisconnected);
+    monitor->start(); // Reports AirPods that are already connected
+
+    m_relay->connectToPhone();
+    LOG_INFO("AirPodsController started");
+}
+
+void AirPodsController::setupSession(AirPodsSession *session)
+{
+    connect(session, &AirPodsSession::metadataReceived, this, [this, session]() { onMetadataReceived(session); });
+    connect(session, &AirPodsSession::settingRolledBack, this, &AirPodsController::onSettingRolledBack);
+    connect(session, &AirPodsSession::connected, this, &AirPodsController::reportDevices);
+    connect(session, &AirPodsSession::disconnected, this, &AirPodsController::reportDevices);
+    connect(session, &AirPodsSession::deviceNameChanged, this, &AirPodsController::reportDevices);
+    connect(session, &AirPodsSession::snapshotPublished, this, [this, session](const DeviceSnapshot &snapshot) {
+        if (m_snapshotChannel && session == m_registry->active())
+        {
+            m_snapshotChannel->publish(snapshot);
+        }
+    });
+    // One ACL handle per session object, kept for its lifetime
+    const quint16 handle = m_nextCaptureHandle;
+    m_nextCaptureHandle = m_nextCaptureHandle < Btsnoop::MAX_HANDLE ? m_nextCaptureHandle + 1 : Btsnoop::DEFAULT_HANDLE;
+    m_captureHandles.insert(session, handle);
+    connect(session, &QObject::destroyed, this, [this, session]() { m_captureHandles.remove(session); });
+    connect(session, &AirPodsSession::frameReceived, m_capture, [this, handle](QByteArrayView frame) {
+        m_capture->record(PacketCapture::Direction::Received, frame, handle);
+    });
+    connect(session->commandQueue(), &CommandQueue::packetWritten, m_capture, [this, handle](const QByteArray &packet) {
+        m_capture->record(PacketCapture::Direction::Sent, packet, handle);
+    });
+    connect(session, &AirPodsSession::ready, this, []() {
+        StartupTimeline::mark("device ready");
+        StartupTimeline::finish();
+    });
+}
+
+void AirPodsController::onActiveChanged(AirPodsSession *session)
+{
+    // Only the active pair drives media control and is shared with the phone
+    if (m_mediaSession)
+    {
+        disconnect(m_mediaSession, nullptr, m_mediaController, nullptr);
+    }
+    m_mediaSession = session;
+    connect(session, &AirPodsSession::earDetectionChanged, m_mediaController, &MediaController::handleEarDetection);
+    connect(session, &AirPodsSession::conversationalAwarenessData, m_mediaController, &MediaController::handleConversationalAwareness);
+    m_mediaController->setConnectedDeviceMacAddress(QString(m_registry->activeAddress()).replace(":", "_"));
+    m_relay->setSession(session);
+    if (m_snapshotChannel)
+    {
+        m_snapshotChannel->publish(session->snapshot());
+    }
+
+    emit activeSessionChanged(session);
+    reportDevices();
+    emit airPodsStatusChanged();
+}
+
+void AirPodsController::setSnapshotChannel(SnapshotChannel *channel)
+{
+    m_snapshotChannel = channel;
+    m_snapshotChannel->publish(session()->snapshot());
+}
+
+void AirPodsController::reportDevices()
+{
+    emit devicesChanged(m_registry->devices());
+}
+
+QByteArray AirPodsController::renderDeviceMetrics() const
+{
+    QByteArray out;
+    auto gauge = [&out](const char *name, const char *help) {
+        out += QByteArray("# HELP ") + name + ' ' + help + "\n# TYPE " + name + " gauge\n";
+    };
+    auto sample = [&out](const char *name, const QByteArray &labels, double value) {
+        out += QByteArray(name) + '{' + labels + "} " + QByteArray::number(value) + '\n';
+    };
+
+    gauge("aln_devices", "AirPods with a session");
+    out += "aln_devices " + QByteArray::number(m_registry->count()) + '\n';
+    gauge("aln_relay_connected", "Whether the phone relay is connected");
+    out += "aln_relay_connected " + QByteArray::number(m_relay->isConnected() ? 1 : 0) + '\n';
+
+    const QStringList addresses = m_registry->addresses();
+    const qint64 nowNs = ReactionLatency::nowNs();
+    gauge("aln_device_connected", "Whether the connection to the AirPods is open");
+    for (const QString &address : addresses)
+    {
+        sample("aln_device_connected", "address=\"" + address.toLatin1() + '"', m_registry->session(address)->isConnected());
+    }
+    gauge("aln_device_ready", "Whether the AirPods send notifications");
+    for (const QString &address : addresses)
+    {
+        sample("aln_device_ready", "address=\"" + address.toLatin1() + '"', m_registry->session(address)->isReady());
+    }
+    gauge("aln_device_connection_state", "Which state the connection to the AirPods is in");
+    for (const QString &address : addresses)
+    {
+        const ConnectionStateMachine *connection = m_registry->connection(address);
+        for (int state = 0; state < int(ConnectionStateMachine::State::Count); ++state)
+        {
+            const auto value = static_cast<ConnectionStateMachine::State>(state);
+            sample("aln_device_connection_state",
+                   "address=\"" + address.toLatin1() + "\",state=\"" + ConnectionStateMachine::stateName(value) + '"',
+                   connection->state() == value);
+        }
+    }
+    out += "# HELP aln_device_connection_state_seconds_total Time the connection to the AirPods spent in each state\n"
+           "# TYPE aln_device_connection_state_seconds_total counter\n";
+    for (const QString &address : addresses)
+    {
+        const ConnectionStateMachine *connection = m_registry->connection(address);
+        for (int state = 0; state < int(ConnectionStateMachine::State::Count); ++state)
+        {
+            const auto value = static_cast<ConnectionStateMachine::State>(state);
+            sample("aln_device_connection_state_seconds_total",
+                   "address=\"" + address.toLatin1() + "\",state=\"" + ConnectionStateMachine::stateName(value) + '"',
+                   connection->timeInStateMs(value) / 1e3);
+        }
+    }
+    gauge("aln_device_connection_failures", "Failed connection attempts since the AirPods were last ready");
+    for (const QString &address : addresses)
+    {
+        sample("aln_device_connection_failures", "address=\"" + address.toLatin1() + '"', m_registry->connection(address)->failures());
+    }
+    gauge("aln_device_seconds_since_last_packet", "Time since the AirPods last sent anything");
+    for (const QString &address : addresses)
+    {
+        const qint64 lastReadNs = m_registry->session(address)->lastReadNs();
+        if (lastReadNs != 0)
+        {
+            sample("aln_device_seconds_since_last_packet", "address=\"" + address.toLatin1() + '"', (nowNs - lastReadNs) / 1e9);
+        }
+    }
+    gauge("aln_device_battery_percent", "Battery level of each part the AirPods report");
+    for (const QString &address : addresses)
+    {
+        const BatteryLevels &levels = m_registry->session(address)->batteryLevels();
+        const QByteArray labels = "address=\"" + address.toLatin1() + "\",component=";
+        if (levels.leftAvailable)
+        {
+            sample("aln_device_battery_percent", labels + "\"left\"", levels.left);
+        }
+        if (levels.rightAvailable)
+        {
+            sample("aln_device_battery_percent", labels + "\"right\"", levels.right);
+        }
+        if (levels.caseAvailable)
+        {
+            sample("aln_device_battery_percent", labels + "\"case\"", levels.caseLevel);
+        }
+        if (levels.singleAvailable)
+        {
+            sample("aln_device_battery_percent", labels + "\"single\"", levels.single);
+        }
+    }
+    return out;
+}
+
+bool AirPodsController::selectDevice(const QString &address)
+{
+    return m_registry->setActive(address);
+}
+
+bool AirPodsController::isCrossDeviceEnabled() const
+{
+    return m_relay->isEnabled();
+}
+
+void AirPodsController::setCrossDeviceEnabled(bool enabled)
+{
+    m_relay->setEnabled(enabled);
+    m_settings->setValue("crossdevice/enabled", enabled);
+}
+
+void AirPodsController::connectToDevice(const QString &address)
+{
+    LOG_INFO("Connecting to device with address: " << address);
+    connectToBluetoothDevice(address, QString());
+}
+
+void AirPodsController::connectToEmulator(const QString &socketPath)
+{
+    LOG_INFO("Connecting to emulator at " << socketPath);
+    m_registry->acquire(socketPath);
+    ConnectionStateMachine *connection = m_registry->connection(socketPath);
+    connection->setTransportFactory([socketPath]() { return new SeqPacketTransport(socketPath); });
+    connection->rearm();
+}
+
+void AirPodsController::setNoiseControlMode(NoiseControlMode mode)
+{
+    session()->setNoiseControlMode(mode);
+}
+
+void AirPodsController::setConversationalAwareness(bool enabled)
+{
+    session()->setConversationalAwareness(enabled);
+}
+
+void AirPodsController::setAdaptiveNoiseLevel(int level)
+{
+    session()->setAdaptiveNoiseLevel(level);
+}
+
+void AirPodsController::initiateMagicPairing()
+{
+    session()->requestMagicCloudKeys();
+}
+
+void AirPodsController::renameAirPods(const QString &newName)
+{
+    if (newName.isEmpty())
+    {
+        LOG_WARN("Cannot set empty name");
+        return;
+    }
+    if (newName.size() > 32)
+    {
+        LOG_WARN("Name is too long, must be 32 characters or less");
+        return;
+    }
+    if (newName == session()->deviceName())
+    {
+        LOG_INFO("Name is already set to: " << newName);
+        return;
+    }
+
+    if (session()->rename(newName))
+    {
+        LOG_INFO("Sent rename command for new name: " << newName);
+    }
+    else
+    {
+        LOG_ERROR("Failed to send rename command");
+    }
+}
+
+void AirPodsController::dumpCaptureRing()
+{
+    QString fileName = QDir::temp().filePath(
+        QString("aap-%1.btsnoop").arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss")));
+    m_capture->dumpRing(fileName);
+}
+
+void AirPodsController::onMetadataReceived(AirPodsSession *session)
+{
+    reportDevices();
+    if (session != m_registry->active())
+    {
+        return;
+    }
+    m_mediaController->setConnectedDeviceMacAddress(QString(m_registry->activeAddress()).replace(":", "_"));
+    if (session->isLeftPodInEar() || session->isRightPodInEar()) // AirPods get added as output device only after this
+    {
+        m_mediaController->activateA2dpProfile();
+    }
+    emit airPodsStatusChanged();
+}
+
+void AirPodsController::onSettingRolledBack(PendingSettings::Setting setting)
+{
+    QString name;
+    switch (setting)
+    {
+    case PendingSettings::Setting::NoiseControlMode:
+        name = tr("Noise control mode");
+        break;
+    case PendingSettings::Setting::ConversationalAwareness:
+        name = tr("Conversational awareness");
+        break;
+    case PendingSettings::Setting::AdaptiveNoiseLevel:
+        name = tr("Adaptive noise level");
+        break;
+    default:
+        return;
+    }
+
+    emit notificationRequested(tr("Setting not applied"),
+                               tr("%1 was not confirmed by your AirPods and has been reverted").arg(name));
+}
+
+void AirPodsController::onPhoneDisconnectRequested()
+{
+    const QString address = m_registry->activeAddress();
+    if (ConnectionStateMachine *connection = m_registry->connection(address))
+    {
+        connection->stop(); // The phone takes over, no reconnecting behind its back
+    }
+    if (session()->transport())
+    {
+        session()->transport()->close();
+    }
+    LOG_INFO("Disconnected from AirPods");
+    runBluetoothctl({"disconnect", address}, nullptr);
+}
+
+void AirPodsController::bluezDeviceConnected(const QString &address, const QString &name)
+{
+    connectToBluetoothDevice(address, name);
+}
+
+void AirPodsController::bluezDeviceDisconnected(const QString &address, const QString &name)
+{
+    Q_UNUSED(name);
+    if (m_registry->session(address))
+    {
+        onDeviceDisconnected(address);
+    }
+    else
+    {
+        LOG_WARN("Disconnected device has no session: " << address);
+    }
+}
+
+void AirPodsController::onDeviceDisconnected(const QString &address)
+{
+    LOG_INFO("Device disconnected: " << address);
+    Metrics::add(Metrics::Counter::Disconnects);
+    AirPodsSession *session = m_registry->session(address);
+    const PacketFramer::Stats &framerStats = session->framerStats();
+    LOG_INFO("Packets received: " << framerStats.frames << ", split across reads: " << framerStats.framesSplit
+             << ", merged in one read: " << framerStats.framesMerged << ", bytes dropped: " << framerStats.bytesDropped);
+    const CommandQueue::Stats queueStats = session->commandQueue()->stats();
+    LOG_INFO("Packets sent: " << queueStats.packetsWritten << ", settings coalesced: " << queueStats.coalesced
+             << ", peak queue depth: " << queueStats.peakDepth << ", backpressure stalls: " << queueStats.backpressureStalls);
+    m_registry->connection(address)->stop();
+    if (session->transport())
+    {
+        LOG_WARN("Socket is still open, closing it");
+        session->setTransport(nullptr);
+    }
+
+    bool wasActive = session == m_registry->active();
+    m_registry->release(address);
+    if (wasActive)
+    {
+        m_relay->notifyAirPodsDisconnected();
+        if (m_registry->count() == 0)
+        {
+            // The idle session stays active, so there is no activeChanged
+            m_mediaController->setConnectedDeviceMacAddress(QString());
+        }
+        m_mediaController->pause(); // Since the device is deconnected, we don't know if it was the active output device. Pause to be safe
+        emit airPodsStatusChanged();
+    }
+
+    emit notificationRequested(tr("AirPods Disconnected"), tr("Your AirPods have been disconnected"));
+}
+
+void AirPodsController::connectToBluetoothDevice(const QString &address, const QString &name)
+{
+    AirPodsSession *session = m_registry->acquire(address);
+    ConnectionStateMachine *connection = m_registry->connection(address);
+    if (connection->state() != ConnectionStateMachine::State::Idle && connection->state() != ConnectionStateMachine::State::Backoff)
+    {
+        LOG_INFO("Already connected to the device: " << name);
+        return;
+    }
+
+    LOG_INFO("Connecting to device: " << name);
+    session->restoreCachedState(address);
+
+    // Every caller has just seen the device, so earlier failures no longer count
+    connection->setTransportFactory([address]() { return new BluetoothTransport(QBluetoothAddress(address)); });
+    connection->rearm();
+    if (session == m_registry->active())
+    {
+        m_relay->notifyAirPodsConnected();
+    }
+}
+
+void AirPodsController::handleMediaStateChange(MediaController::MediaState state)
+{
+    if (state == MediaController::MediaState::Playing)
+    {
+        LOG_INFO("Media started playing, sending disconnect request to Android and taking over audio");
+        m_relay->sendDisconnectRequest();
+        connectToAirPods(true);
+    }
+}
+
+void AirPodsController::connectToAirPods(bool force)
+{
+    if (session()->isConnected())
+    {
+        LOG_INFO("Already connected to AirPods");
+        return;
+    }
+
+    if (force)
+    {
+        LOG_INFO("Forcing connection to AirPods");
+        const QString address = m_registry->activeAddress();
+        runBluetoothctl({"connect", address}, [this, address](const QString &output) {
+            if (output.contains("Connection successful"))
+            {
+                LOG_INFO("Connection successful, proceeding with L2CAP connection");
+                LOG_INFO("Retrying L2CAP connection for up to 10 seconds...");
+                forceL2capConnection(address, QDeadlineTimer(10000));
+            }
+            else
+            {
+                LOG_ERROR("Connection failed, cannot proceed with L2CAP connection");
+            }
+        });
+    }
+
+    // BluetoothMonitor knows which devices are AirPods, no need to ask BlueZ again
+    const QList<BluetoothMonitor::Device> connected = monitor ? monitor->connectedAirPods() : QList<BluetoothMonitor::Device>();
+    if (!connected.isEmpty())
+    {
+        for (const BluetoothMonitor::Device &device : connected)
+        {
+            connectToBluetoothDevice(device.address, device.name);
+        }
+        return;
+    }
+    LOG_WARN("AirPods not found among connected devices");
+}
+
+void AirPodsController::forceL2capConnection(const QString &address, QDeadlineTimer deadline)
+{
+    if (deadline.hasExpired())
+    {
+        LOG_ERROR("Failed to connect to device within 10 seconds: " << address);
+        return;
+    }
+
+    runBluetoothctl({"connect", address}, [this, address, deadline](const QString &output) {
+        if (!output.contains("Connection successful"))
+        {
+            LOG_WARN("Connection attempt failed, retrying...");
+            forceL2capConnection(address, deadline);
+            return;
+        }
+        connectToBluetoothDevice(address, QString());
+        // Give the socket a second to open
+        QTimer::singleShot(1000, this, [this, address, deadline]() {
+            AirPodsSession *session = m_registry->session(address);
+            if (session && session->isConnected())
+            {
+                LOG_INFO("Successfully connected to device: " << address);
+                return;
+            }
+            forceL2capConnection(address, deadline);
+        });
+    });
+}
+
+void AirPodsController::runBluetoothctl(const QStringList &arguments, std::function<void(const QString &)> done)
+{
+    // Never waited for, the I/O thread must keep reading the AirPods meanwhile
+    QProcess *process = new QProcess(this);
+    connect(process, &QProcess::finished, this, [process, done]() {
+        QString output = process->readAllStandardOutput().trimmed();
+        LOG_INFO("Bluetoothctl output: " << output);
+        process->deleteLater();
+        if (done)
+        {
+            done(output);
+        }
+    });
+    connect(process, &QProcess::errorOccurred, this, [process, done](QProcess::ProcessError error) {
+        if (error != QProcess::FailedToStart)
+        {
+            return;
+        }
+        LOG_ERROR("Cannot run bluetoothctl: " << process->errorString());
+        process->deleteLater();
+        if (done)
+        {
+            done(QString());
+        }
+    });
+    process->start("bluetoothctl", arguments);
+}
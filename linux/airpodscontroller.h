@@ -0,0 +1,120 @@
+#ifndef AIRPODSCONTROLLER_H
+#define AIRPODSCONTROLLER_H
+
+#include <QDeadlineTimer>
+#include <QHash>
+#include <QObject>
+#include <QPointer>
+#include <QString>
+#include <QStringList>
+#include <functional>
+
+#include "devicecache.h"
+#include "enums.h"
+#include "mediacontroller.h"
+#include "pendingsettings.h"
+#include "sessionregistry.h"
+
+#define PHONE_MAC_ADDRESS "22:22:F5:BB:1C:A0"
+
+class AirPodsSession;
+class BluetoothMonitor;
+class PacketCapture;
+class PhoneRelay;
+class QSettings;
+class SnapshotChannel;
+
+// Everything the app does without a user interface: finding and connecting
+// the AirPods, media and audio output control, the phone relay and settings.
+//
+// The tray app and the headless daemon are thin frontends on top of this.
+class AirPodsController : public QObject
+{
+    Q_OBJECT
+public:
+    struct Options
+    {
+        QString captureFile;    // Record all traffic to this btsnoop file
+        QStringList emulatorSockets; // Talk to tools/aapemulator instead of Bluetooth, one session per socket
+        QString metricsSocket;  // Serve Prometheus metrics on this Unix socket
+        quint16 metricsPort = 0; // And/or on this loopback TCP port
+    };
+
+    explicit AirPodsController(const Options &options, QObject *parent = nullptr);
+    ~AirPodsController() override;
+
+    // MPRIS, audio and BlueZ discovery answer asynchronously, so they run side by side
+    void start();
+
+    // The active device, the one the user interface shows and media control follows
+    AirPodsSession *session() const { return m_registry->active(); }
+    SessionRegistry *sessions() const { return m_registry; }
+
+    // The controller may run on its own thread. Frontends on other threads
+    // follow the active device through the channel instead of the session,
+    // the channel has to live on their thread. Set before start().
+    void setSnapshotChannel(SnapshotChannel *channel);
+    MediaController *mediaController() const { return m_mediaController; }
+    PhoneRelay *phoneRelay() const { return m_relay; }
+
+    bool isCrossDeviceEnabled() const;
+    void setCrossDeviceEnabled(bool enabled);
+
+public slots:
+    void connectToDevice(const QString &address);
+    void connectToEmulator(const QString &socketPath);
+    void setNoiseControlMode(AirpodsTrayApp::Enums::NoiseControlMode mode);
+    void setConversationalAwareness(bool enabled);
+    void setAdaptiveNoiseLevel(int level);
+    void renameAirPods(const QString &newName);
+    void initiateMagicPairing();
+    void dumpCaptureRing();
+    bool selectDevice(const QString &address);
+
+signals:
+    void airPodsStatusChanged();
+    // A device was added or removed, or its name or connection changed
+    void devicesChanged(const QList<SessionRegistry::Device> &devices);
+    void activeSessionChanged(AirPodsSession *session);
+    // Something the user should hear about, the tray app shows it as a notification
+    void notificationRequested(const QString &title, const QString &message);
+
+private slots:
+    void onSettingRolledBack(PendingSettings::Setting setting);
+    void onPhoneDisconnectRequested();
+    void bluezDeviceConnected(const QString &address, const QString &name);
+    void bluezDeviceDisconnected(const QString &address, const QString &name);
+    void handleMediaStateChange(MediaController::MediaState state);
+
+private:
+    void setupSession(AirPodsSession *session);
+    void onActiveChanged(AirPodsSession *session);
+    void onMetadataReceived(AirPodsSession *session);
+    void connectToBluetoothDevice(const QString &address, const QString &name);
+    void onDeviceDisconnected(const QString &address);
+    void connectToAirPods(bool force);
+    void forceL2capConnection(const QString &address, QDeadlineTimer deadline);
+    // Calls done with the output once bluetoothctl exits
+    void runBluetoothctl(const QStringList &arguments, std::function<void(const QString &output)> done);
+    void reportDevices();
+    // Per device gauges, appended to the counters of Metrics::render()
+    QByteArray renderDeviceMetrics() const;
+
+    QStringList m_emulatorSockets;
+    QString m_metricsSocket;
+    quint16 m_metricsPort;
+    SessionRegistry *m_registry;
+    QPointer<AirPodsSession> m_mediaSession; // The session media control listens to
+    SnapshotChannel *m_snapshotChannel = nullptr;
+    PacketCapture *m_capture;
+    // ACL handle each session's frames are captured with, so pairs can be told apart in one capture
+    QHash<const AirPodsSession *, quint16> m_captureHandles;
+    quint16 m_nextCaptureHandle;
+    PhoneRelay *m_relay;
+    MediaController *m_mediaController;
+    BluetoothMonitor *monitor = nullptr;
+    QSettings *m_settings;
+    DeviceCache m_deviceCache;
+};
+
+#endif // AIRPODSCONTROLLER_H
@@ -0,0 +1,68 @@
+// Headless frontend: automatic pause, audio output switching, conversational
+// awareness and the phone relay, without the tray icon and QML window.
+//
+//   airpodsd [--debug] [--capture FILE] [--emulator SOCKET]... [--startup-trace FILE] [--stats]
+//            [--metrics SOCKET] [--metrics-port PORT]
+//
+// Links neither QtQuick nor QtWidgets. SIGINT and SIGTERM quit cleanly so the
+// settings are saved.
+
+#include <QCoreApplication>
+#include <QLoggingCategory>
+#include <QTextStream>
+#include <QTimer>
+#include <csignal>
+
+#include "airpodscontroller.h"
+#include "logger.h"
+#include "reactionlatency.h"
+#include "startuptimeline.h"
+#include "unixsignalnotifier.h"
+
+Q_LOGGING_CATEGORY(airpodsApp, "airpodsApp")
+
+int main(int argc, char *argv[])
+{
+    StartupTimeline::begin();
+    AsyncLogger::installCrashHandler();
+    QCoreApplication app(argc, argv);
+
+    bool debugMode = false;
+    bool printStats = false;
+    AirPodsController::Options options;
+    const QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        if (args[i] == "--debug") {
+            debugMode = true;
+        } else if (args[i] == "--capture" && i + 1 < args.size()) {
+            options.captureFile = args[++i];
+        } else if (args[i] == "--emulator" && i + 1 < args.size()) {
+            options.emulatorSockets.append(args[++i]);
+        } else if (args[i] == "--startup-trace" && i + 1 < args.size()) {
+            StartupTimeline::setTraceFile(args[++i]);
+        } else if (args[i] == "--metrics" && i + 1 < args.size()) {
+            options.metricsSocket = args[++i];
+        } else if (args[i] == "--metrics-port" && i + 1 < args.size()) {
+            options.metricsPort = args[++i].toUShort();
+        } else if (args[i] == "--stats") {
+            printStats = true;
+        }
+    }
+    QLoggingCategory::setFilterRules(debugMode ? "airpodsApp.debug=true" : "airpodsApp.debug=false");
+    StartupTimeline::mark("application created");
+
+    AirPodsController controller(options);
+    QObject::connect(&controller, &AirPodsController::notificationRequested, &app,
+                     [](const QString &title, const QString &message) { LOG_INFO(title << ": " << message); });
+    QObject::connect(new UnixSignalNotifier(SIGINT, &app), &UnixSignalNotifier::activated, &app, &QCoreApplication::quit);
+    QObject::connect(new UnixSignalNotifier(SIGTERM, &app), &UnixSignalNotifier::activated, &app, &QCoreApplication::quit);
+    QObject::connect(&app, &QCoreApplication::aboutToQuit, [printStats]() {
+        StartupTimeline::finish();
+        if (printStats) {
+            QTextStream(stdout) << ReactionLatency::report();
+        }
+    });
+
+    QTimer::singleShot(0, &controller, &AirPodsController::start);
+    return app.exec();
+}
@@ -0,0 +1,667 @@
+#include "airpodssession.h"
+#include "devicecache.h"
+#include "logger.h"
+#include "metrics.h"
+#include "reactionlatency.h"
+#include "transport.h"
+
+#include <QIODevice>
+
+using namespace AirpodsTrayApp;
+using namespace AirpodsTrayApp::Enums;
+
+AirPodsSession::AirPodsSession(QObject *parent)
+    : QObject(parent)
+    , m_commandQueue(new CommandQueue(this))
+    , m_pendingSettings(new PendingSettings(this))
+    , m_handshake(new Handshake([this](QByteArrayView packet, const char *logTag) { return sendPacket(packet, logTag); }, this))
+    , m_battery(new Battery(this))
+    , m_dispatcher(this)
+{
+    setupPacketHandlers();
+    connect(m_commandQueue, &CommandQueue::packetWritten, this, &AirPodsSession::onPacketWritten);
+    connect(m_pendingSettings, &PendingSettings::rolledBack, this, &AirPodsSession::onSettingRolledBack);
+    connect(m_pendingSettings, &PendingSettings::confirmed, this, []() {
+        ReactionLatency::finish(ReactionLatency::Reaction::SettingChange);
+    });
+    connect(m_battery, &Battery::primaryChanged, this, &AirPodsSession::primaryChanged);
+    connect(m_handshake, &Handshake::fellBack, this, [this]() {
+        if (m_deviceCache)
+        {
+            m_deviceCache->storeSerialHandshake(address(), true);
+        }
+    });
+
+    // Connected first, so the snapshot is current by the time other listeners run
+    for (auto changed : {&AirPodsSession::connected, &AirPodsSession::disconnected, &AirPodsSession::ready,
+                         &AirPodsSession::earDetectionStatusChanged, &AirPodsSession::modelChanged,
+                         &AirPodsSession::primaryChanged})
+    {
+        connect(this, changed, this, &AirPodsSession::publishSnapshot);
+    }
+    connect(this, &AirPodsSession::noiseControlModeChanged, this, &AirPodsSession::publishSnapshot);
+    connect(this, &AirPodsSession::batteryLevelsChanged, this, &AirPodsSession::publishSnapshot);
+    connect(this, &AirPodsSession::conversationalAwarenessChanged, this, &AirPodsSession::publishSnapshot);
+    connect(this, &AirPodsSession::adaptiveNoiseLevelChanged, this, &AirPodsSession::publishSnapshot);
+    connect(this, &AirPodsSession::deviceNameChanged, this, &AirPodsSession::publishSnapshot);
+}
+
+void AirPodsSession::publishSnapshot()
+{
+    DeviceSnapshot snapshot;
+    snapshot.version = m_snapshot.version() + 1;
+    snapshot.connected = isConnected();
+    snapshot.ready = m_ready;
+    snapshot.battery = m_batteryLevels;
+    snapshot.earDetection = m_earDetection;
+    snapshot.leftInEar = isLeftPodInEar();
+    snapshot.rightInEar = isRightPodInEar();
+    snapshot.noiseControlMode = m_noiseControlMode;
+    snapshot.conversationalAwareness = m_conversationalAwareness;
+    snapshot.adaptiveNoiseLevel = quint8(m_adaptiveNoiseLevel);
+    snapshot.model = m_model;
+    snapshot.setDeviceName(m_deviceName);
+    m_snapshot.publish(snapshot);
+    emit snapshotPublished(snapshot);
+}
+
+void AirPodsSession::setTransport(Transport *transport)
+{
+    if (m_transport)
+    {
+        disconnect(m_transport, nullptr, this, nullptr);
+        disconnect(m_transport->device(), nullptr, this, nullptr);
+        m_transport->close();
+        m_transport->deleteLater();
+    }
+
+    m_transport = transport;
+    m_framer.reset();
+    m_commandQueue->clear();
+    m_commandQueue->setDevice(transport ? transport->device() : nullptr);
+    m_ready = false;
+    m_handshake->stop();
+    if (!transport)
+    {
+        publishSnapshot();
+        return;
+    }
+
+    transport->setParent(this);
+    connect(transport, &Transport::connected, this, &AirPodsSession::onTransportConnected);
+    connect(transport, &Transport::disconnected, this, &AirPodsSession::onTransportDisconnected);
+    connect(transport, &Transport::errorOccurred, this, &AirPodsSession::errorOccurred);
+    connect(transport->device(), &QIODevice::readyRead, this, &AirPodsSession::readTransport);
+}
+
+QString AirPodsSession::address() const
+{
+    return m_transport ? m_transport->peerAddress() : QString();
+}
+
+bool AirPodsSession::isConnected() const
+{
+    return m_transport && m_transport->isOpen();
+}
+
+void AirPodsSession::onTransportConnected()
+{
+    LOG_INFO("Connected to device, sending initial packets");
+    m_handshake->start();
+    emit connected();
+}
+
+void AirPodsSession::onTransportDisconnected()
+{
+    LOG_INFO("Transport to " << address() << " closed");
+    m_commandQueue->clear();
+    m_pendingSettings->clear();
+    m_handshake->stop();
+    m_ready = false;
+    emit disconnected();
+}
+
+void AirPodsSession::readTransport()
+{
+    QIODevice *device = m_transport->device();
+    char buffer[4096];
+    qint64 bytesRead;
+    while ((bytesRead = device->read(buffer, sizeof(buffer))) > 0)
+    {
+        handleData(QByteArrayView(buffer, bytesRead));
+    }
+}
+
+void AirPodsSession::handleData(QByteArrayView data)
+{
+    // Reactions to anything in this read are measured from here
+    m_readNs = ReactionLatency::nowNs();
+    // A read may hold several packets or only part of one
+    m_framer.feed(data, [this](QByteArrayView frame) {
+        LOG_PACKET("Received:", frame);
+        Metrics::countPacket(Metrics::Direction::Received, frame);
+        emit frameReceived(frame);
+        m_dispatcher.dispatch(frame);
+    });
+}
+
+void AirPodsSession::reset()
+{
+    m_commandQueue->clear();
+    m_pendingSettings->clear();
+    m_framer.reset();
+    m_handshake->stop();
+    m_handshake->setPipelined(true);
+    m_ready = false;
+    m_readNs = 0;
+
+    if (!m_deviceName.isEmpty())
+    {
+        m_deviceName.clear();
+        emit deviceNameChanged(m_deviceName);
+    }
+    if (m_model != AirPodsModel::Unknown)
+    {
+        m_model = AirPodsModel::Unknown;
+        emit modelChanged();
+    }
+
+    // Reset battery status
+    m_battery->reset();
+    m_batteryLevels = BatteryLevels();
+    emit batteryLevelsChanged(m_batteryLevels);
+
+    // Reset ear detection
+    m_earDetection = EarDetectionState();
+    m_earDetectionLive = false;
+    emit earDetectionChanged(m_earDetection);
+    emit earDetectionStatusChanged();
+    emit primaryChanged();
+
+    // Reset noise control mode
+    m_noiseControlMode = NoiseControlMode::Off;
+    emit noiseControlModeChanged(m_noiseControlMode);
+}
+
+bool AirPodsSession::sendPacket(QByteArrayView packet, const char *logTag, CommandQueue::Priority priority)
+{
+    if (!m_transport)
+    {
+        LOG_ERROR("Socket is not open, cannot write packet");
+        return false;
+    }
+    if (packet.isEmpty())
+    {
+        LOG_ERROR("Refusing to queue an empty packet (" << logTag << ")");
+        return false;
+    }
+
+    m_commandQueue->enqueue(packet, priority);
+    LOG_PACKET(logTag, packet);
+    return true;
+}
+
+bool AirPodsSession::setNoiseControlMode(NoiseControlMode mode)
+{
+    LOG_INFO("Setting noise control mode to: " << mode);
+    if (m_noiseControlMode == mode)
+    {
+        LOG_INFO("Noise control mode is already " << mode);
+        return true;
+    }
+    QByteArrayView packet = AirPodsPackets::NoiseControl::getPacketForMode(mode);
+    ReactionLatency::start(ReactionLatency::Reaction::SettingChange, ReactionLatency::nowNs());
+    if (!sendPacket(packet, "Noise control mode packet queued:", CommandQueue::Priority::User))
+    {
+        ReactionLatency::cancel(ReactionLatency::Reaction::SettingChange);
+        return false;
+    }
+    ReactionLatency::mark(ReactionLatency::Reaction::SettingChange, ReactionLatency::Stage::Dispatch);
+
+    // Show the new mode right away, the AirPods echo it back once applied
+    m_pendingSettings->begin(PendingSettings::Setting::NoiseControlMode, static_cast<int>(mode), static_cast<int>(m_noiseControlMode));
+    m_noiseControlMode = mode;
+    emit noiseControlModeChanged(m_noiseControlMode);
+    return true;
+}
+
+bool AirPodsSession::setConversationalAwareness(bool enabled)
+{
+    if (m_conversationalAwareness == enabled)
+    {
+        LOG_INFO("Conversational awareness is already " << (enabled ? "enabled" : "disabled"));
+        return true;
+    }
+
+    LOG_INFO("Setting conversational awareness to: " << (enabled ? "enabled" : "disabled"));
+    QByteArrayView packet = enabled ? AirPodsPackets::ConversationalAwareness::ENABLED
+                                    : AirPodsPackets::ConversationalAwareness::DISABLED;
+
+    ReactionLatency::start(ReactionLatency::Reaction::SettingChange, ReactionLatency::nowNs());
+    if (!sendPacket(packet, "Conversational awareness packet queued:", CommandQueue::Priority::User))
+    {
+        ReactionLatency::cancel(ReactionLatency::Reaction::SettingChange);
+        return false;
+    }
+    ReactionLatency::mark(ReactionLatency::Reaction::SettingChange, ReactionLatency::Stage::Dispatch);
+    m_pendingSettings->begin(PendingSettings::Setting::ConversationalAwareness, enabled, m_conversationalAwareness);
+    m_conversationalAwareness = enabled;
+    emit conversationalAwarenessChanged(enabled);
+    return true;
+}
+
+bool AirPodsSession::setAdaptiveNoiseLevel(int level)
+{
+    level = qBound(0, level, 100);
+    if (m_adaptiveNoiseLevel == level || m_noiseControlMode != NoiseControlMode::Adaptive)
+    {
+        return false;
+    }
+
+    auto packet = AirPodsPackets::AdaptiveNoise::getPacket(level);
+    ReactionLatency::start(ReactionLatency::Reaction::SettingChange, ReactionLatency::nowNs());
+    if (!sendPacket(packet, "Adaptive noise level packet queued:", CommandQueue::Priority::User))
+    {
+        ReactionLatency::cancel(ReactionLatency::Reaction::SettingChange);
+        return false;
+    }
+    ReactionLatency::mark(ReactionLatency::Reaction::SettingChange, ReactionLatency::Stage::Dispatch);
+    m_pendingSettings->begin(PendingSettings::Setting::AdaptiveNoiseLevel, level, m_adaptiveNoiseLevel);
+    m_adaptiveNoiseLevel = level;
+    emit adaptiveNoiseLevelChanged(level);
+    return true;
+}
+
+bool AirPodsSession::rename(const QString &name)
+{
+    QByteArray nameBytes = name.toUtf8();
+    char buffer[AirPodsPackets::Rename::MAX_PACKET_SIZE];
+    AirPodsPackets::PacketBuilder builder(buffer, sizeof(buffer));
+    QByteArrayView packet = AirPodsPackets::Rename::buildPacket(nameBytes, builder);
+    if (packet.isEmpty())
+    {
+        LOG_ERROR("Name is " << nameBytes.size() << " bytes in UTF-8, at most "
+                  << AirPodsPackets::Rename::MAX_NAME_SIZE << " fit in the rename packet");
+        return false;
+    }
+    if (!sendPacket(packet, "Rename packet queued:", CommandQueue::Priority::User))
+    {
+        return false;
+    }
+
+    m_deviceName = name;
+    emit deviceNameChanged(name);
+    return true;
+}
+
+bool AirPodsSession::requestMagicCloudKeys()
+{
+    if (!isConnected())
+    {
+        LOG_ERROR("Socket not open, cannot start Magic Pairing");
+        return false;
+    }
+
+    return sendPacket(AirPodsPackets::MagicPairing::REQUEST_MAGIC_CLOUD_KEYS, "Magic Pairing packet written:");
+}
+
+bool AirPodsSession::isLeftPodInEar() const
+{
+    if (m_battery->getPrimaryPod() == Battery::Component::Left)
+    {
+        return m_earDetection.isPrimaryInEar();
+    }
+    return m_earDetection.isSecondaryInEar();
+}
+
+bool AirPodsSession::isRightPodInEar() const
+{
+    if (m_battery->getPrimaryPod() == Battery::Component::Right)
+    {
+        return m_earDetection.isPrimaryInEar();
+    }
+    return m_earDetection.isSecondaryInEar();
+}
+
+void AirPodsSession::setupPacketHandlers()
+{
+    using namespace AirPodsPackets;
+    m_dispatcher.setHandshakeAckHandler(&AirPodsSession::onHandshakeAck);
+    m_dispatcher.setHandler(Opcode::FEATURES_ACK, &AirPodsSession::onFeaturesAck);
+    m_dispatcher.setHandler(Opcode::MAGIC_CLOUD_KEYS, &AirPodsSession::onMagicCloudKeys);
+    m_dispatcher.setHandler(Opcode::EAR_DETECTION, &AirPodsSession::onEarDetection);
+    m_dispatcher.setHandler(Opcode::BATTERY_STATUS, &AirPodsSession::onBatteryStatus);
+    m_dispatcher.setHandler(Opcode::CONVERSATIONAL_AWARENESS_DATA, &AirPodsSession::onConversationalAwarenessData);
+    m_dispatcher.setHandler(Opcode::METADATA, &AirPodsSession::onMetadata);
+    m_dispatcher.setControlHandler(ControlCommand::NOISE_CONTROL_MODE, &AirPodsSession::onNoiseControlMode);
+    m_dispatcher.setControlHandler(ControlCommand::CONVERSATIONAL_AWARENESS, &AirPodsSession::onConversationalAwarenessState);
+    m_dispatcher.setFallbackHandler(&AirPodsSession::onUnrecognizedPacket);
+}
+
+void AirPodsSession::onHandshakeAck(QByteArrayView)
+{
+    m_handshake->handshakeAcked();
+    // The AirPods accept commands once the handshake is acknowledged, release anything the user queued before
+    m_commandQueue->setReady(true);
+}
+
+void AirPodsSession::onFeaturesAck(QByteArrayView)
+{
+    m_handshake->featuresAcked();
+}
+
+void AirPodsSession::onMagicCloudKeys(QByteArrayView data)
+{
+    if (!data.startsWith(AirPodsPackets::MagicPairing::MAGIC_CLOUD_KEYS_HEADER))
+    {
+        onMalformedPacket(data);
+        return;
+    }
+
+    auto keys = AirPodsPackets::MagicPairing::parseMagicCloudKeysPacket(data);
+    LOG_INFO("Received Magic Cloud Keys:");
+    LOG_INFO("MagicAccIRK: " << AsyncLogger::hex(keys.magicAccIRK));
+    LOG_INFO("MagicAccEncKey: " << AsyncLogger::hex(keys.magicAccEncKey));
+
+    // Store the keys for later use if needed
+    m_magicAccIRK = keys.magicAccIRK;
+    m_magicAccEncKey = keys.magicAccEncKey;
+    emit magicCloudKeysReceived(m_magicAccIRK, m_magicAccEncKey);
+}
+
+void AirPodsSession::onConversationalAwarenessState(QByteArrayView data)
+{
+    auto result = AirPodsPackets::ConversationalAwareness::parseCAState(data);
+    if (!result.has_value())
+    {
+        LOG_ERROR("Failed to parse conversational awareness state");
+        return;
+    }
+
+    LOG_INFO("Conversational awareness state received: " << result.value());
+    if (m_pendingSettings->confirm(PendingSettings::Setting::ConversationalAwareness, result.value())
+        == PendingSettings::Result::Superseded)
+    {
+        return;
+    }
+    if (m_conversationalAwareness != result.value())
+    {
+        m_conversationalAwareness = result.value();
+        emit conversationalAwarenessChanged(m_conversationalAwareness);
+    }
+}
+
+void AirPodsSession::onNoiseControlMode(QByteArrayView data)
+{
+    if (data.size() != AirPodsPackets::NoiseControl::PACKET_SIZE)
+    {
+        onMalformedPacket(data);
+        return;
+    }
+
+    quint8 rawMode = data[AirPodsPackets::NoiseControl::MODE_OFFSET] - 1; // Offset still needed due to protocol
+    if (rawMode > static_cast<quint8>(NoiseControlMode::MaxValue))
+    {
+        LOG_ERROR("Invalid noise control mode value received: " << rawMode);
+        return;
+    }
+
+    LOG_INFO("Noise control mode: " << rawMode);
+    NoiseControlMode mode = static_cast<NoiseControlMode>(rawMode);
+    if (m_pendingSettings->confirm(PendingSettings::Setting::NoiseControlMode, rawMode)
+        == PendingSettings::Result::Superseded)
+    {
+        return; // Echo of a mode the user already moved past
+    }
+    if (m_deviceCache)
+    {
+        m_deviceCache->storeNoiseControlMode(address(), mode);
+    }
+    if (m_noiseControlMode != mode)
+    {
+        m_noiseControlMode = mode;
+        emit noiseControlModeChanged(m_noiseControlMode);
+    }
+}
+
+void AirPodsSession::onEarDetection(QByteArrayView data)
+{
+    if (data.size() != AirPodsPackets::Parse::EAR_DETECTION_PACKET_SIZE)
+    {
+        onMalformedPacket(data);
+        return;
+    }
+
+    EarDetectionState state;
+    state.primary = EarDetectionState::fromByte(data[6]);
+    state.secondary = EarDetectionState::fromByte(data[7]);
+    if (state == m_earDetection && m_earDetectionLive)
+    {
+        return;
+    }
+
+    m_earDetection = state;
+    m_earDetectionLive = true;
+    if (m_deviceCache)
+    {
+        m_deviceCache->storeEarDetection(address(), m_earDetection);
+    }
+    ReactionLatency::start(ReactionLatency::Reaction::EarDetectionPause, m_readNs);
+    ReactionLatency::mark(ReactionLatency::Reaction::EarDetectionPause, ReactionLatency::Stage::Decode);
+    LOG_INFO("Ear detection status: " << m_earDetection.primary << ", " << m_earDetection.secondary);
+    emit earDetectionChanged(m_earDetection);
+    emit earDetectionStatusChanged();
+    emit primaryChanged();
+}
+
+void AirPodsSession::onBatteryStatus(QByteArrayView data)
+{
+    if (!m_battery->parsePacket(data))
+    {
+        onMalformedPacket(data);
+        return;
+    }
+
+    if (!m_ready)
+    {
+        m_ready = true;
+        m_handshake->notificationReceived();
+        emit ready();
+    }
+
+    if (updateBatteryLevels() && m_deviceCache)
+    {
+        m_deviceCache->storeBatteryPacket(address(), data);
+    }
+}
+
+bool AirPodsSession::updateBatteryLevels()
+{
+    BatteryLevels levels;
+    levels.left = m_battery->getLeftPodLevel();
+    levels.right = m_battery->getRightPodLevel();
+    levels.caseLevel = m_battery->getCaseLevel();
+    levels.leftCharging = m_battery->isLeftPodCharging();
+    levels.rightCharging = m_battery->isRightPodCharging();
+    levels.caseCharging = m_battery->isCaseCharging();
+    levels.leftAvailable = m_battery->isLeftPodAvailable();
+    levels.rightAvailable = m_battery->isRightPodAvailable();
+    levels.caseAvailable = m_battery->isCaseAvailable();
+    levels.single = m_battery->getSingleLevel();
+    levels.singleCharging = m_battery->isSingleCharging();
+    levels.singleAvailable = m_battery->isSingleAvailable();
+    if (levels == m_batteryLevels)
+    {
+        return false;
+    }
+
+    m_batteryLevels = levels;
+    LOG_INFO("Battery status:" << qPrintable(m_batteryLevels.toString()));
+    emit batteryLevelsChanged(m_batteryLevels);
+    return true;
+}
+
+void AirPodsSession::onConversationalAwarenessData(QByteArrayView data)
+{
+    if (data.size() != AirPodsPackets::ConversationalAwareness::DATA_PACKET_SIZE
+        || !data.startsWith(AirPodsPackets::ConversationalAwareness::DATA_HEADER))
+    {
+        onMalformedPacket(data);
+        return;
+    }
+
+    ReactionLatency::start(ReactionLatency::Reaction::ConversationalAwarenessDuck, m_readNs);
+    ReactionLatency::mark(ReactionLatency::Reaction::ConversationalAwarenessDuck, ReactionLatency::Stage::Decode);
+    LOG_INFO("Received conversational awareness data");
+    emit conversationalAwarenessData(data);
+}
+
+void AirPodsSession::onMetadata(QByteArrayView data)
+{
+    if (parseMetadata(data) && m_deviceCache)
+    {
+        m_deviceCache->storeMetadata(address(), data, m_model);
+    }
+    requestMagicCloudKeys();
+    emit metadataReceived();
+}
+
+void AirPodsSession::onUnrecognizedPacket(QByteArrayView data)
+{
+    Metrics::add(Metrics::Counter::PacketsUnrecognized);
+    LOG_PACKET("Unrecognized packet format:", data);
+}
+
+void AirPodsSession::onMalformedPacket(QByteArrayView data)
+{
+    Metrics::add(Metrics::Counter::ParseFailures);
+    LOG_PACKET("Malformed packet:", data);
+}
+
+bool AirPodsSession::parseMetadata(QByteArrayView data)
+{
+    auto fields = AirPodsPackets::Metadata::parse(data);
+    if (!fields)
+    {
+        LOG_ERROR("Invalid metadata packet: " << AsyncLogger::hex(data));
+        return false;
+    }
+
+    applyMetadata(*fields);
+
+    // Log extracted metadata
+    LOG_INFO("Parsed AirPods metadata:");
+    LOG_INFO("Device Name: " << fields->name);
+    LOG_INFO("Model Number: " << fields->modelNumber);
+    LOG_INFO("Manufacturer: " << fields->manufacturer);
+    LOG_INFO("Hardware Version: " << fields->hardwareVersion);
+    LOG_INFO("Firmware Version: " << fields->firmwareVersion);
+    LOG_INFO("Firmware Version2: " << fields->firmwareVersion2);
+    LOG_INFO("Software Version: " << fields->softwareVersion);
+    LOG_INFO("App Identifier: " << fields->appIdentifier);
+    LOG_INFO("Serial Number 1: " << fields->serialNumber1);
+    LOG_INFO("Serial Number 2: " << fields->serialNumber2);
+    LOG_INFO("Unknown Numeric: " << fields->unknownNumeric);
+    LOG_INFO("Unknown Hash: " << fields->unknownHash);
+    LOG_INFO("Trailing Byte: " << fields->trailingByte);
+    return true;
+}
+
+void AirPodsSession::applyMetadata(const AirPodsPackets::Metadata::Fields &fields)
+{
+    QString name = QString::fromUtf8(fields.name);
+    if (m_deviceName != name)
+    {
+        m_deviceName = name;
+        emit deviceNameChanged(m_deviceName);
+    }
+
+    AirPodsModel model = parseModelNumber(fields.modelNumber);
+    if (m_model != model)
+    {
+        m_model = model;
+        emit modelChanged();
+    }
+}
+
+// Fills in the state from the last session with this device, live packets correct it later
+void AirPodsSession::restoreCachedState(const QString &address)
+{
+    if (!m_deviceCache)
+    {
+        return;
+    }
+    auto cached = m_deviceCache->load(address);
+    if (!cached)
+    {
+        return;
+    }
+
+    LOG_INFO("Restoring cached state for " << address);
+    m_handshake->setPipelined(!cached->serialHandshake);
+    if (auto fields = AirPodsPackets::Metadata::parse(cached->metadataPacket))
+    {
+        applyMetadata(*fields);
+    }
+    if (m_battery->parsePacket(cached->batteryPacket))
+    {
+        updateBatteryLevels();
+    }
+    if (cached->noiseControlMode && m_noiseControlMode != *cached->noiseControlMode)
+    {
+        m_noiseControlMode = *cached->noiseControlMode;
+        emit noiseControlModeChanged(m_noiseControlMode);
+    }
+    if (!cached->earDetection.isEmpty())
+    {
+        // Only shown, earDetectionChanged would make MediaController act on stale state
+        m_earDetection = cached->earDetection;
+        m_earDetectionLive = false;
+        emit earDetectionStatusChanged();
+        emit primaryChanged();
+    }
+}
+
+void AirPodsSession::onPacketWritten(const QByteArray &packet, CommandQueue::Priority priority)
+{
+    using namespace AirPodsPackets;
+    Metrics::countPacket(Metrics::Direction::Sent, packet);
+    if (priority != CommandQueue::Priority::User || packet.size() <= Frame::CONTROL_VALUE_OFFSET
+        || static_cast<quint8>(packet[Frame::OPCODE_OFFSET]) != Opcode::CONTROL_COMMAND)
+    {
+        return;
+    }
+
+    ReactionLatency::mark(ReactionLatency::Reaction::SettingChange, ReactionLatency::Stage::ActionIssued);
+
+    // The AirPods don't echo the adaptive noise level, it is confirmed once it reaches the socket
+    if (static_cast<quint8>(packet[Frame::CONTROL_IDENTIFIER_OFFSET]) == ControlCommand::ADAPTIVE_NOISE_LEVEL)
+    {
+        quint8 value = static_cast<quint8>(packet[Frame::CONTROL_VALUE_OFFSET]);
+        m_pendingSettings->confirm(PendingSettings::Setting::AdaptiveNoiseLevel, value, PendingSettings::Source::Written);
+    }
+}
+
+void AirPodsSession::onSettingRolledBack(PendingSettings::Setting setting, int restoredValue)
+{
+    // Never confirmed, so not a latency either
+    ReactionLatency::cancel(ReactionLatency::Reaction::SettingChange);
+    switch (setting)
+    {
+    case PendingSettings::Setting::NoiseControlMode:
+        m_noiseControlMode = static_cast<NoiseControlMode>(restoredValue);
+        emit noiseControlModeChanged(m_noiseControlMode);
+        break;
+    case PendingSettings::Setting::ConversationalAwareness:
+        m_conversationalAwareness = restoredValue;
+        emit conversationalAwarenessChanged(m_conversationalAwareness);
+        break;
+    case PendingSettings::Setting::AdaptiveNoiseLevel:
+        m_adaptiveNoiseLevel = restoredValue;
+        emit adaptiveNoiseLevelChanged(m_adaptiveNoiseLevel);
+        break;
+    default:
+        return;
+    }
+    emit settingRolledBack(setting);
+}
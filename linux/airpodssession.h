@@ -0,0 +1,174 @@
+#ifndef AIRPODSSESSION_H
+#define AIRPODSSESSION_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QObject>
+#include <QPointer>
+#include <QString>
+
+#include "airpods_packets.h"
+#include "battery.hpp"
+#include "commandqueue.h"
+#include "deviceevents.h"
+#include "enums.h"
+#include "handshake.h"
+#include "packetdispatcher.h"
+#include "packetframer.h"
+#include "pendingsettings.h"
+#include "seqlock.h"
+
+class DeviceCache;
+class Transport;
+
+// AAP connection to one pair of AirPods: handshake, parsing and device state.
+//
+// Runs over any Transport and needs nothing beyond QtCore. The tray app and
+// the emulator benchmark connect it to a transport, the replay tool feeds
+// captured frames straight to handleData().
+// Reactions outside the protocol (media control, tray, phone relay) are left
+// to whoever listens to the signals.
+class AirPodsSession : public QObject
+{
+    Q_OBJECT
+public:
+    // Milliseconds since the transport connected, -1 until reached
+    using HandshakeTimings = Handshake::Timings;
+
+    explicit AirPodsSession(QObject *parent = nullptr);
+
+    // Takes ownership. The previous transport is closed and deleted.
+    void setTransport(Transport *transport);
+    Transport *transport() const { return m_transport; }
+    QString address() const;
+    bool isConnected() const;
+    // Notifications are flowing: the first battery status arrived after the handshake
+    bool isReady() const { return m_ready; }
+    // ReactionLatency::nowNs() clock, 0 before the first read
+    qint64 lastReadNs() const { return m_readNs; }
+    const HandshakeTimings &handshakeTimings() const { return m_handshake->timings(); }
+
+    // Optional, state is saved per address and restored by restoreCachedState()
+    void setDeviceCache(DeviceCache *cache) { m_deviceCache = cache; }
+    void restoreCachedState(const QString &address);
+
+    // Forgets the device state, e.g. after a disconnect
+    void reset();
+
+    // Parses bytes as if they came from the transport
+    void handleData(QByteArrayView data);
+
+    // logTag is a string literal, see LOG_PACKET
+    bool sendPacket(QByteArrayView packet, const char *logTag,
+                    CommandQueue::Priority priority = CommandQueue::Priority::Control);
+
+    bool setNoiseControlMode(AirpodsTrayApp::Enums::NoiseControlMode mode);
+    bool setConversationalAwareness(bool enabled);
+    bool setAdaptiveNoiseLevel(int level);
+    bool rename(const QString &name);
+    bool requestMagicCloudKeys();
+
+    Battery *battery() const { return m_battery; }
+    const AirpodsTrayApp::BatteryLevels &batteryLevels() const { return m_batteryLevels; }
+    const AirpodsTrayApp::EarDetectionState &earDetection() const { return m_earDetection; }
+    AirpodsTrayApp::Enums::NoiseControlMode noiseControlMode() const { return m_noiseControlMode; }
+    bool conversationalAwareness() const { return m_conversationalAwareness; }
+    int adaptiveNoiseLevel() const { return m_adaptiveNoiseLevel; }
+    const QString &deviceName() const { return m_deviceName; }
+    AirpodsTrayApp::Enums::AirPodsModel model() const { return m_model; }
+    bool isLeftPodInEar() const;
+    bool isRightPodInEar() const;
+
+    // The getters above belong to the session's thread. This one works from
+    // any thread without locks or allocation and returns a consistent copy as
+    // of the last change signal.
+    AirpodsTrayApp::DeviceSnapshot snapshot() const { return m_snapshot.read(); }
+
+    CommandQueue *commandQueue() const { return m_commandQueue; }
+    PendingSettings *pendingSettings() const { return m_pendingSettings; }
+    Handshake *handshake() const { return m_handshake; }
+    const PacketFramer::Stats &framerStats() const { return m_framer.stats(); }
+
+signals:
+    void connected();
+    void disconnected();
+    void errorOccurred(const QString &message);
+    void ready();
+
+    // Every complete frame, before it is parsed. The view points into the read
+    // buffer and is only valid during the emission, so receivers must live on
+    // the session's thread (direct connections only).
+    void frameReceived(QByteArrayView frame);
+
+    void noiseControlModeChanged(AirpodsTrayApp::Enums::NoiseControlMode mode);
+    // Live ear detection changes only, never restored from the cache
+    void earDetectionChanged(const AirpodsTrayApp::EarDetectionState &state);
+    void earDetectionStatusChanged();
+    void batteryLevelsChanged(const AirpodsTrayApp::BatteryLevels &levels);
+    void conversationalAwarenessChanged(bool enabled);
+    void adaptiveNoiseLevelChanged(int level);
+    void deviceNameChanged(const QString &name);
+    void modelChanged();
+    void primaryChanged();
+    void metadataReceived();
+    void conversationalAwarenessData(QByteArrayView data);
+    void magicCloudKeysReceived(const QByteArray &irk, const QByteArray &encKey);
+    void settingRolledBack(PendingSettings::Setting setting);
+    // After every change, with the state snapshot() now returns
+    void snapshotPublished(const AirpodsTrayApp::DeviceSnapshot &snapshot);
+
+private:
+    void setupPacketHandlers();
+    void onTransportConnected();
+    void onTransportDisconnected();
+    void readTransport();
+    void publishSnapshot();
+
+    // Packet handlers, called by m_dispatcher with a view of the received frame
+    void onHandshakeAck(QByteArrayView data);
+    void onFeaturesAck(QByteArrayView data);
+    void onMagicCloudKeys(QByteArrayView data);
+    void onConversationalAwarenessState(QByteArrayView data);
+    void onNoiseControlMode(QByteArrayView data);
+    void onEarDetection(QByteArrayView data);
+    void onBatteryStatus(QByteArrayView data);
+    void onConversationalAwarenessData(QByteArrayView data);
+    void onMetadata(QByteArrayView data);
+    // No handler for the frame
+    void onUnrecognizedPacket(QByteArrayView data);
+    // A handler that could not parse its frame
+    void onMalformedPacket(QByteArrayView data);
+
+    bool updateBatteryLevels();
+    bool parseMetadata(QByteArrayView data);
+    void applyMetadata(const AirPodsPackets::Metadata::Fields &fields);
+    void onPacketWritten(const QByteArray &packet, CommandQueue::Priority priority);
+    void onSettingRolledBack(PendingSettings::Setting setting, int restoredValue);
+
+    QPointer<Transport> m_transport;
+    CommandQueue *m_commandQueue;
+    PendingSettings *m_pendingSettings;
+    Handshake *m_handshake;
+    DeviceCache *m_deviceCache = nullptr;
+    Battery *m_battery;
+    PacketDispatcher<AirPodsSession> m_dispatcher;
+    PacketFramer m_framer;
+
+    bool m_ready = false;
+    qint64 m_readNs = 0; // ReactionLatency::nowNs() of the read being handled, or the last one
+
+    AirpodsTrayApp::BatteryLevels m_batteryLevels;
+    AirpodsTrayApp::EarDetectionState m_earDetection;
+    bool m_earDetectionLive = false; // False while m_earDetection comes from the cache
+    AirpodsTrayApp::Enums::NoiseControlMode m_noiseControlMode = AirpodsTrayApp::Enums::NoiseControlMode::Off;
+    bool m_conversationalAwareness = false;
+    int m_adaptiveNoiseLevel = 50;
+    QString m_deviceName;
+    AirpodsTrayApp::Enums::AirPodsModel m_model = AirpodsTrayApp::Enums::AirPodsModel::Unknown;
+    QByteArray m_magicAccIRK;
+    QByteArray m_magicAccEncKey;
+
+    SeqLock<AirpodsTrayApp::DeviceSnapshot> m_snapshot;
+};
+
+#endif // AIRPODSSESSION_H
@@ -0,0 +1,662 @@
+#include "asynclogger.h"
+#include "spscqueue.h"
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <pthread.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    using Level = AsyncLogger::Level;
+
+    constexpr size_t RingCapacity = 1024; // Records per thread
+    constexpr int MaxThreads = 64;        // Threads past this write synchronously
+    constexpr size_t FlightBytes = 4 * 1024 * 1024;
+    constexpr qsizetype MaxFlightLine = 64 * 1024;
+    constexpr qint64 FlightWindowNs = 60'000'000'000;
+    constexpr auto IdleWait = std::chrono::milliseconds(100);
+
+    enum Flags : quint8
+    {
+        Continued = 1, // The message goes on in the next record
+        Printed = 2,   // Also for stderr, not only the flight recorder
+        Packet = 4,    // Raw bytes to print after tag, otherwise UTF-16 text
+        Items = 8,     // Message items to format, otherwise UTF-16 text
+    };
+
+    // Type byte of each Message item, followed by the value or, for sized
+    // items, a quint32 size and the bytes
+    enum Item : quint8
+    {
+        Signed,    // qint64
+        Unsigned,  // quint64
+        Double,
+        Bool,
+        Char,
+        Utf8,      // const char *, printed as is
+        Utf16,     // QString, quoted like QDebug does
+        Bytes,     // QByteArray, quoted like QDebug does
+        HexBytes,  // Printed as hex
+        Formatted, // Already formatted by QDebug
+    };
+
+    struct Record
+    {
+        qint64 timeNs;
+        const char *tag;
+        quint16 size;
+        Level level;
+        quint8 flags;
+        char payload[232];
+    };
+    static_assert(sizeof(Record) == 256, "Records should fill whole cache lines");
+
+    struct ThreadRing
+    {
+        SpscQueue<Record, RingCapacity> queue;
+        char name[16] = {};
+    };
+
+    // Pending text of a message split across records, per ring
+    struct Partial
+    {
+        QByteArray bytes;
+        qint64 timeNs = 0;
+    };
+
+    std::once_flag s_started;
+    qint64 s_startNs = 0;
+    bool s_journal = false;
+    bool s_colors = false;
+
+    std::array<std::atomic<ThreadRing *>, MaxThreads> s_rings{};
+    std::atomic<int> s_ringCount{0};
+    thread_local ThreadRing *t_ring = nullptr;
+    thread_local bool t_ringRegistered = false;
+
+    std::mutex s_wakeMutex;
+    std::condition_variable s_wake;
+    std::atomic<bool> s_sleeping{false};
+    std::atomic<bool> s_stopping{false};
+    std::atomic<bool> s_stopped{false};
+    std::atomic<bool> s_dumpRequested{false};
+    std::atomic<quint64> s_passes{0};
+    std::atomic<quint64> s_dropped{0};
+    std::thread *s_writer = nullptr;
+
+    // Written by the background thread only, read by the crash handler
+    char s_flight[FlightBytes];
+    std::atomic<size_t> s_flightWritten{0};
+    std::deque<std::pair<qint64, size_t>> s_flightLines; // Time and start of each line
+    char s_crashPath[64];
+    char s_crashMessage[128];
+
+    qint64 nowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void writeAll(int fd, const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t written = ::write(fd, data, size);
+            if (written <= 0)
+            {
+                return;
+            }
+            data += written;
+            size -= written;
+        }
+    }
+
+    template <typename T>
+    bool readValue(const char *&data, const char *end, T &value)
+    {
+        if (size_t(end - data) < sizeof(T))
+        {
+            return false;
+        }
+        std::memcpy(&value, data, sizeof(T));
+        data += sizeof(T);
+        return true;
+    }
+
+    // Formats Message items the way QDebug formats the same arguments
+    QString itemsText(const QByteArray &payload)
+    {
+        QString text;
+        QDebug debug(&text);
+        const char *data = payload.constData();
+        const char *end = data + payload.size();
+        while (data < end)
+        {
+            const quint8 type = quint8(*data++);
+            if (type >= Utf8)
+            {
+                quint32 size = 0;
+                if (!readValue(data, end, size) || size > size_t(end - data))
+                {
+                    break; // Truncated, never written that way
+                }
+                switch (type)
+                {
+                case Utf8:
+                    debug.noquote() << QString::fromUtf8(data, size);
+                    debug.quote();
+                    break;
+                case Utf16:
+                    debug << QString::fromUtf16(reinterpret_cast<const char16_t *>(data), size / 2);
+                    break;
+                case Bytes:
+                    debug << QByteArray(data, size);
+                    break;
+                case HexBytes:
+                    debug << QByteArray(data, size).toHex();
+                    break;
+                default:
+                    debug.noquote() << QString::fromUtf16(reinterpret_cast<const char16_t *>(data), size / 2);
+                    debug.quote();
+                    break;
+                }
+                data += size;
+                continue;
+            }
+
+            bool complete = false;
+            switch (type)
+            {
+            case Signed:
+            {
+                qint64 value;
+                if ((complete = readValue(data, end, value)))
+                {
+                    debug << value;
+                }
+                break;
+            }
+            case Unsigned:
+            {
+                quint64 value;
+                if ((complete = readValue(data, end, value)))
+                {
+                    debug << value;
+                }
+                break;
+            }
+            case Double:
+            {
+                double value;
+                if ((complete = readValue(data, end, value)))
+                {
+                    debug << value;
+                }
+                break;
+            }
+            case Bool:
+            case Char:
+            {
+                char value;
+                if ((complete = readValue(data, end, value)))
+                {
+                    if (type == Bool)
+                    {
+                        debug << (value != 0);
+                    }
+                    else
+                    {
+                        debug << value;
+                    }
+                }
+                break;
+            }
+            default:
+                break;
+            }
+            if (!complete)
+            {
+                break;
+            }
+        }
+        return text;
+    }
+
+    QByteArray messageText(quint8 flags, const char *tag, const QByteArray &payload)
+    {
+        if (flags & Packet)
+        {
+            return QByteArray(tag) + ' ' + payload.toHex();
+        }
+        // QDebug leaves a space after the last item
+        QString text = (flags & Items)
+                           ? itemsText(payload)
+                           : QString::fromUtf16(reinterpret_cast<const char16_t *>(payload.constData()), payload.size() / 2);
+        while (text.endsWith(' '))
+        {
+            text.chop(1);
+        }
+        return text.toUtf8();
+    }
+
+    void appendStderrLine(QByteArray &out, Level level, const QByteArray &text)
+    {
+        static const char *const priorities[] = {"<7>", "<6>", "<4>", "<3>"};
+        static const char *const colors[] = {"\033[34m", "\033[32m", "\033[33m", "\033[31m"};
+        if (s_journal)
+        {
+            out += priorities[int(level)];
+        }
+        else if (s_colors)
+        {
+            out += colors[int(level)];
+        }
+        out += text;
+        if (s_colors && !s_journal)
+        {
+            out += "\033[0m";
+        }
+        out += '\n';
+    }
+
+    void appendFlightLine(qint64 timeNs, Level level, const char *thread, const QByteArray &text)
+    {
+        static const char levels[] = {'D', 'I', 'W', 'E'};
+        QByteArray line = QByteArray::number((timeNs - s_startNs) / 1e9, 'f', 3) + ' ' + levels[int(level)] + " ["
+                          + thread + "] " + text + '\n';
+        if (line.size() > MaxFlightLine)
+        {
+            line.truncate(MaxFlightLine - 1);
+            line += '\n';
+        }
+        const size_t start = s_flightWritten.load(std::memory_order_relaxed);
+        size_t offset = start % FlightBytes;
+        const char *data = line.constData();
+        size_t size = line.size();
+        while (size > 0)
+        {
+            const size_t chunk = std::min(size, FlightBytes - offset);
+            std::memcpy(s_flight + offset, data, chunk);
+            data += chunk;
+            size -= chunk;
+            offset = 0;
+        }
+        s_flightWritten.store(start + line.size(), std::memory_order_release);
+
+        s_flightLines.emplace_back(timeNs, start);
+        const size_t written = start + line.size();
+        while (!s_flightLines.empty()
+               && (written - s_flightLines.front().second > FlightBytes || timeNs - s_flightLines.front().first > FlightWindowNs))
+        {
+            s_flightLines.pop_front();
+        }
+    }
+
+    void writeFlightFile()
+    {
+        const QString path = "/tmp/aln-flight-" + QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss") + ".log";
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly))
+        {
+            AsyncLogger::text(Level::Error, "Cannot write flight recorder to " + path + ": " + file.errorString());
+            return;
+        }
+        const size_t written = s_flightWritten.load(std::memory_order_relaxed);
+        size_t position = s_flightLines.empty() ? written : s_flightLines.front().second;
+        while (position < written)
+        {
+            const size_t offset = position % FlightBytes;
+            const size_t chunk = std::min(written - position, FlightBytes - offset);
+            file.write(s_flight + offset, chunk);
+            position += chunk;
+        }
+        AsyncLogger::text(Level::Info, "Flight recorder written to " + path);
+    }
+
+    // Returns false if there was nothing to write
+    bool drain(std::vector<Partial> &partials)
+    {
+        QByteArray out;
+        bool any = false;
+        const int count = std::min(s_ringCount.load(std::memory_order_acquire), MaxThreads);
+        for (int i = 0; i < count; ++i)
+        {
+            ThreadRing *ring = s_rings[i].load(std::memory_order_acquire);
+            if (!ring)
+            {
+                continue; // Still being registered
+            }
+            Partial &partial = partials[i];
+            while (const Record *record = ring->queue.peek())
+            {
+                any = true;
+                // A record that doesn't belong to the pending message means its end was dropped
+                if (!partial.bytes.isEmpty() && partial.timeNs != record->timeNs)
+                {
+                    partial.bytes.clear();
+                }
+                partial.bytes.append(record->payload, record->size);
+                partial.timeNs = record->timeNs;
+                if (!(record->flags & Continued))
+                {
+                    const QByteArray text = messageText(record->flags, record->tag, partial.bytes);
+                    appendFlightLine(record->timeNs, record->level, ring->name, text);
+                    if (record->flags & Printed)
+                    {
+                        appendStderrLine(out, record->level, text);
+                    }
+                    partial.bytes.clear();
+                }
+                ring->queue.release();
+            }
+        }
+        writeAll(STDERR_FILENO, out.constData(), out.size());
+        return any;
+    }
+
+    bool anyPending()
+    {
+        const int count = std::min(s_ringCount.load(std::memory_order_acquire), MaxThreads);
+        for (int i = 0; i < count; ++i)
+        {
+            ThreadRing *ring = s_rings[i].load(std::memory_order_acquire);
+            if (ring && !ring->queue.isEmpty())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void writerLoop()
+    {
+        std::vector<Partial> partials(MaxThreads);
+        while (true)
+        {
+            const bool stopping = s_stopping.load(std::memory_order_acquire);
+            const bool wrote = drain(partials);
+            if (s_dumpRequested.exchange(false))
+            {
+                writeFlightFile();
+                continue;
+            }
+            s_passes.fetch_add(1, std::memory_order_release);
+            if (stopping && !wrote)
+            {
+                return;
+            }
+            if (!wrote)
+            {
+                std::unique_lock<std::mutex> lock(s_wakeMutex);
+                s_sleeping.store(true);
+                s_wake.wait_for(lock, IdleWait, []() {
+                    return !s_sleeping.load() || s_stopping.load() || s_dumpRequested.load() || anyPending();
+                });
+                s_sleeping.store(false);
+            }
+        }
+    }
+
+    void wake()
+    {
+        // Pairs with the writer announcing it sleeps and then looking at the rings once more
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (s_sleeping.load(std::memory_order_relaxed) && s_sleeping.exchange(false))
+        {
+            s_wake.notify_one();
+        }
+    }
+
+    void stop()
+    {
+        s_stopping.store(true, std::memory_order_release);
+        s_wake.notify_one();
+        s_writer->join();
+        s_stopped.store(true, std::memory_order_release);
+    }
+
+    void ensureStarted()
+    {
+        std::call_once(s_started, []() {
+            s_startNs = nowNs();
+            s_journal = std::getenv("JOURNAL_STREAM") != nullptr;
+            s_colors = ::isatty(STDERR_FILENO);
+            s_writer = new std::thread(writerLoop);
+            std::atexit(stop);
+        });
+    }
+
+    ThreadRing *threadRing()
+    {
+        if (t_ringRegistered)
+        {
+            return t_ring;
+        }
+        t_ringRegistered = true;
+        // Rings outlive their threads, threads here live as long as the process
+        const int index = s_ringCount.fetch_add(1, std::memory_order_relaxed);
+        if (index >= MaxThreads)
+        {
+            return nullptr;
+        }
+        t_ring = new ThreadRing();
+        ::pthread_getname_np(::pthread_self(), t_ring->name, sizeof(t_ring->name));
+        s_rings[index].store(t_ring, std::memory_order_release);
+        return t_ring;
+    }
+
+    void append(Level level, quint8 flags, const char *tag, const char *data, size_t size)
+    {
+        ensureStarted();
+        ThreadRing *ring = threadRing();
+        if (!ring || s_stopped.load(std::memory_order_acquire))
+        {
+            // Nothing left to hand the record to, write it here
+            if ((flags & Printed) && !(flags & Packet))
+            {
+                QByteArray out;
+                appendStderrLine(out, level, messageText(flags, tag, QByteArray(data, size)));
+                writeAll(STDERR_FILENO, out.constData(), out.size());
+            }
+            return;
+        }
+
+        const qint64 timeNs = nowNs();
+        do
+        {
+            Record *record = ring->queue.claim();
+            if (!record)
+            {
+                s_dropped.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            const size_t chunk = std::min(size, sizeof(record->payload));
+            record->timeNs = timeNs;
+            record->tag = tag;
+            record->size = quint16(chunk);
+            record->level = level;
+            record->flags = flags | (size > chunk ? Continued : 0);
+            std::memcpy(record->payload, data, chunk);
+            ring->queue.commit();
+            data += chunk;
+            size -= chunk;
+        } while (size > 0);
+        wake();
+    }
+
+    void onCrash(int signalNumber)
+    {
+        // Only what is safe in a signal handler: records not yet drained are lost
+        int fd = ::open(s_crashPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd >= 0)
+        {
+            const size_t written = s_flightWritten.load(std::memory_order_acquire);
+            if (written > FlightBytes)
+            {
+                const size_t offset = written % FlightBytes;
+                writeAll(fd, s_flight + offset, FlightBytes - offset);
+                writeAll(fd, s_flight, offset);
+            }
+            else
+            {
+                writeAll(fd, s_flight, written);
+            }
+            ::close(fd);
+            writeAll(STDERR_FILENO, s_crashMessage, std::strlen(s_crashMessage));
+        }
+        ::raise(signalNumber); // SA_RESETHAND restored the default action
+    }
+}
+
+AsyncLogger::Message::~Message()
+{
+    append(m_level, Items | (m_printed ? Printed : 0), nullptr, m_items.constData(), m_items.size());
+}
+
+AsyncLogger::Message &AsyncLogger::Message::operator<<(const char *text)
+{
+    appendItem(Utf8, text, text ? std::strlen(text) : 0);
+    return *this;
+}
+
+AsyncLogger::Message &AsyncLogger::Message::operator<<(const QString &text)
+{
+    appendItem(Utf16, text.utf16(), text.size() * sizeof(char16_t));
+    return *this;
+}
+
+AsyncLogger::Message &AsyncLogger::Message::operator<<(QByteArrayView bytes)
+{
+    appendItem(Bytes, bytes.data(), bytes.size());
+    return *this;
+}
+
+AsyncLogger::Message &AsyncLogger::Message::operator<<(Hex hex)
+{
+    appendItem(HexBytes, hex.bytes.data(), hex.bytes.size());
+    return *this;
+}
+
+AsyncLogger::Message &AsyncLogger::Message::operator<<(bool value)
+{
+    const char byte = value;
+    appendItem(Bool, &byte, sizeof(byte));
+    return *this;
+}
+
+AsyncLogger::Message &AsyncLogger::Message::operator<<(char value)
+{
+    appendItem(Char, &value, sizeof(value));
+    return *this;
+}
+
+AsyncLogger::Message &AsyncLogger::Message::operator<<(double value)
+{
+    appendItem(Double, &value, sizeof(value));
+    return *this;
+}
+
+AsyncLogger::Message &AsyncLogger::Message::appendSigned(qint64 value)
+{
+    appendItem(Signed, &value, sizeof(value));
+    return *this;
+}
+
+AsyncLogger::Message &AsyncLogger::Message::appendUnsigned(quint64 value)
+{
+    appendItem(Unsigned, &value, sizeof(value));
+    return *this;
+}
+
+AsyncLogger::Message &AsyncLogger::Message::appendFormatted(QString &text)
+{
+    // QDebug leaves a space after the item, the background thread adds its own
+    if (text.endsWith(' '))
+    {
+        text.chop(1);
+    }
+    appendItem(Formatted, text.utf16(), text.size() * sizeof(char16_t));
+    return *this;
+}
+
+void AsyncLogger::Message::appendItem(quint8 type, const void *data, size_t size)
+{
+    m_items.append(char(type));
+    if (type >= Utf8)
+    {
+        const quint32 length = quint32(size);
+        m_items.append(reinterpret_cast<const char *>(&length), sizeof(length));
+    }
+    m_items.append(static_cast<const char *>(data), qsizetype(size));
+}
+
+void AsyncLogger::text(Level level, const QString &message, bool printed)
+{
+    append(level, printed ? Printed : 0, nullptr, reinterpret_cast<const char *>(message.utf16()), message.size() * sizeof(char16_t));
+}
+
+void AsyncLogger::packet(const char *tag, QByteArrayView bytes, bool printed)
+{
+    append(Level::Debug, Packet | (printed ? Printed : 0), tag, bytes.data(), bytes.size());
+}
+
+void AsyncLogger::dumpFlightRecorder()
+{
+    ensureStarted();
+    s_dumpRequested.store(true);
+    s_wake.notify_one();
+}
+
+void AsyncLogger::installCrashHandler()
+{
+    ensureStarted();
+    std::snprintf(s_crashPath, sizeof(s_crashPath), "/tmp/aln-crash-%d.log", int(::getpid()));
+    std::snprintf(s_crashMessage, sizeof(s_crashMessage), "Crashed, flight recorder written to %s\n", s_crashPath);
+
+    struct sigaction action = {};
+    action.sa_handler = &onCrash;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESETHAND;
+    for (int signalNumber : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT})
+    {
+        ::sigaction(signalNumber, &action, nullptr);
+    }
+}
+
+void AsyncLogger::flush()
+{
+    ensureStarted();
+    if (s_stopped.load(std::memory_order_acquire))
+    {
+        return;
+    }
+    // The second pass from now started after this call
+    const quint64 target = s_passes.load(std::memory_order_acquire) + 2;
+    while (s_passes.load(std::memory_order_acquire) < target && !s_stopped.load(std::memory_order_acquire))
+    {
+        s_sleeping.store(false);
+        s_wake.notify_one();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+quint64 AsyncLogger::dropped()
+{
+    return s_dropped.load(std::memory_order_relaxed);
+}
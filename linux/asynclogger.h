@@ -0,0 +1,112 @@
+#ifndef ASYNCLOGGER_H
+#define ASYNCLOGGER_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QDebug>
+#include <QString>
+#include <QVarLengthArray>
+#include <type_traits>
+
+// Where the LOG_* macros end up. A call copies the raw arguments of the
+// message, numbers as they are and strings and packets as their bytes, into
+// a lock-free ring owned by the calling thread. A background thread turns
+// the records into text, writes them to stderr
+// (with journald priority prefixes when running under systemd) and keeps
+// the last minute of everything, debug output and packets included, in a
+// flight recorder.
+//
+// The flight recorder is written to /tmp/aln-flight-<time>.log on request,
+// and to /tmp/aln-crash-<pid>.log when the process crashes once
+// installCrashHandler() was called.
+class AsyncLogger
+{
+public:
+    enum class Level : quint8
+    {
+        Debug,
+        Info,
+        Warning,
+        Error
+    };
+
+    // Bytes a LOG_* message prints as hex, converted on the background thread
+    struct Hex
+    {
+        QByteArrayView bytes;
+    };
+    static Hex hex(QByteArrayView bytes) { return Hex{bytes}; }
+
+    // The arguments of one LOG_* message as binary items, handed to the ring
+    // when it goes out of scope. The background thread formats them like
+    // QDebug would; types without an overload here are formatted by QDebug
+    // right away.
+    class Message
+    {
+    public:
+        Message(Level level, bool printed) : m_level(level), m_printed(printed) {}
+        ~Message();
+        Message(const Message &) = delete;
+        Message &operator=(const Message &) = delete;
+
+        Message &operator<<(const char *text);
+        Message &operator<<(const QString &text);
+        Message &operator<<(const QByteArray &bytes) { return *this << QByteArrayView(bytes); }
+        Message &operator<<(QByteArrayView bytes);
+        Message &operator<<(Hex hex);
+        Message &operator<<(bool value);
+        Message &operator<<(char value);
+        Message &operator<<(double value);
+
+        template <typename T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>
+                                                   && !std::is_same_v<T, char>, int> = 0>
+        Message &operator<<(T value)
+        {
+            if constexpr (std::is_signed_v<T>)
+            {
+                return appendSigned(qint64(value));
+            }
+            else
+            {
+                return appendUnsigned(quint64(value));
+            }
+        }
+
+        template <typename T, std::enable_if_t<!std::is_arithmetic_v<T> && !std::is_pointer_v<T>
+                                                   && !std::is_array_v<T>, int> = 0>
+        Message &operator<<(const T &value)
+        {
+            QString text;
+            QDebug(&text) << value;
+            return appendFormatted(text);
+        }
+
+    private:
+        Message &appendSigned(qint64 value);
+        Message &appendUnsigned(quint64 value);
+        Message &appendFormatted(QString &text);
+        void appendItem(quint8 type, const void *data, size_t size);
+
+        QVarLengthArray<char, 256> m_items;
+        Level m_level;
+        bool m_printed;
+    };
+
+    // Records arriving faster than the background thread writes them are
+    // dropped and counted instead of blocking the caller. Without printed,
+    // the message only goes to the flight recorder.
+    static void text(Level level, const QString &message, bool printed = true);
+    // The bytes are turned into hex on the background thread. Without
+    // printed, the packet only goes to the flight recorder.
+    static void packet(const char *tag, QByteArrayView bytes, bool printed);
+
+    static void dumpFlightRecorder();
+    // Dumps the flight recorder on SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT
+    static void installCrashHandler();
+    // Returns once everything recorded so far is written
+    static void flush();
+
+    static quint64 dropped();
+};
+
+#endif // ASYNCLOGGER_H
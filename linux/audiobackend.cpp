@@ -0,0 +1,100 @@
+#include "audiobackend.h"
+
+const AudioBackend::Sink *AudioBackend::findSink(const QString &name) const
+{
+    // A handful of entries, a scan is cheaper than keeping a second index
+    for (const Sink &sink : m_sinks)
+    {
+        if (sink.name == name)
+        {
+            return &sink;
+        }
+    }
+    return nullptr;
+}
+
+const AudioBackend::Card *AudioBackend::findCard(const QString &name) const
+{
+    for (const Card &card : m_cards)
+    {
+        if (card.name == name)
+        {
+            return &card;
+        }
+    }
+    return nullptr;
+}
+
+void AudioBackend::setReady(bool ready)
+{
+    if (m_ready == ready)
+    {
+        return;
+    }
+    m_ready = ready;
+    emit readyChanged(ready);
+}
+
+void AudioBackend::setDefaultSinkName(const QString &name)
+{
+    if (m_defaultSinkName == name)
+    {
+        return;
+    }
+    m_defaultSinkName = name;
+    emit defaultSinkChanged(name);
+}
+
+void AudioBackend::updateSink(const Sink &sink)
+{
+    auto it = m_sinks.find(sink.index);
+    if (it != m_sinks.end() && it->name == sink.name && it->card == sink.card && it->volume == sink.volume
+        && it->channels == sink.channels)
+    {
+        return;
+    }
+    m_sinks.insert(sink.index, sink);
+    emit sinkChanged(sink.name);
+}
+
+void AudioBackend::removeSink(quint32 index)
+{
+    auto it = m_sinks.find(index);
+    if (it == m_sinks.end())
+    {
+        return;
+    }
+    QString name = it->name;
+    m_sinks.erase(it);
+    emit sinkChanged(name);
+}
+
+void AudioBackend::updateCard(const Card &card)
+{
+    auto it = m_cards.find(card.index);
+    if (it != m_cards.end() && it->name == card.name && it->activeProfile == card.activeProfile)
+    {
+        return;
+    }
+    m_cards.insert(card.index, card);
+    emit cardChanged(card.name);
+}
+
+void AudioBackend::removeCard(quint32 index)
+{
+    auto it = m_cards.find(index);
+    if (it == m_cards.end())
+    {
+        return;
+    }
+    QString name = it->name;
+    m_cards.erase(it);
+    emit cardChanged(name);
+}
+
+void AudioBackend::clearCache()
+{
+    m_sinks.clear();
+    m_cards.clear();
+    setDefaultSinkName(QString());
+}
@@ -0,0 +1,74 @@
+#ifndef AUDIOBACKEND_H
+#define AUDIOBACKEND_H
+
+#include <QHash>
+#include <QObject>
+#include <QString>
+
+// Sound server state that MediaController needs, kept up to date from change
+// events so that queries never have to ask the server.
+//
+// Implementations fill the cache through the protected update functions, on
+// the thread the backend lives in. Requests are asynchronous; the cache
+// changes once the server reports the new state.
+class AudioBackend : public QObject
+{
+    Q_OBJECT
+public:
+    struct Sink
+    {
+        quint32 index = 0;
+        QString name;
+        quint32 card = InvalidIndex;
+        int volume = 0; // Percent, averaged over the channels
+        quint8 channels = 2;
+    };
+
+    struct Card
+    {
+        quint32 index = 0;
+        QString name;
+        QString activeProfile;
+    };
+
+    static constexpr quint32 InvalidIndex = 0xFFFFFFFF;
+
+    using QObject::QObject;
+
+    // Connects to the server and subscribes to changes, false if that can't even be started
+    virtual bool start() = 0;
+    bool isReady() const { return m_ready; }
+
+    const QString &defaultSinkName() const { return m_defaultSinkName; }
+    const Sink *defaultSink() const { return findSink(m_defaultSinkName); }
+    const Sink *findSink(const QString &name) const;
+    const Card *findCard(const QString &name) const;
+
+    virtual void setSinkVolume(const QString &sinkName, int percent) = 0;
+    virtual void setCardProfile(const QString &cardName, const QString &profile) = 0;
+
+signals:
+    void readyChanged(bool ready);
+    void defaultSinkChanged(const QString &name);
+    void sinkChanged(const QString &name);
+    void cardChanged(const QString &name);
+    // A request was rejected by the server
+    void requestFailed(const QString &description);
+
+protected:
+    void setReady(bool ready);
+    void setDefaultSinkName(const QString &name);
+    void updateSink(const Sink &sink);
+    void removeSink(quint32 index);
+    void updateCard(const Card &card);
+    void removeCard(quint32 index);
+    void clearCache();
+
+private:
+    bool m_ready = false;
+    QString m_defaultSinkName;
+    QHash<quint32, Sink> m_sinks;
+    QHash<quint32, Card> m_cards;
+};
+
+#endif // AUDIOBACKEND_H
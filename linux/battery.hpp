@@ -1,42 +1,49 @@
+#pragma once
+
 #include <QByteArray>
-#include <QMap>
+#include <QByteArrayView>
 #include <QString>
 #include <QObject>
+#include <array>
 
 #include "airpods_packets.h"
+#include "deviceevents.h"
 
 class Battery : public QObject
 {
     Q_OBJECT
 
-    Q_PROPERTY(quint8 leftPodLevel READ getLeftPodLevel NOTIFY batteryStatusChanged)
-    Q_PROPERTY(bool leftPodCharging READ isLeftPodCharging NOTIFY batteryStatusChanged)
-    Q_PROPERTY(bool leftPodAvailable READ isLeftPodAvailable NOTIFY batteryStatusChanged)
-    Q_PROPERTY(quint8 rightPodLevel READ getRightPodLevel NOTIFY batteryStatusChanged)
-    Q_PROPERTY(bool rightPodCharging READ isRightPodCharging NOTIFY batteryStatusChanged)
-    Q_PROPERTY(bool rightPodAvailable READ isRightPodAvailable NOTIFY batteryStatusChanged)
-    Q_PROPERTY(quint8 caseLevel READ getCaseLevel NOTIFY batteryStatusChanged)
-    Q_PROPERTY(bool caseCharging READ isCaseCharging NOTIFY batteryStatusChanged)
-    Q_PROPERTY(bool caseAvailable READ isCaseAvailable NOTIFY batteryStatusChanged)
+    Q_PROPERTY(quint8 leftPodLevel READ getLeftPodLevel NOTIFY leftPodLevelChanged)
+    Q_PROPERTY(bool leftPodCharging READ isLeftPodCharging NOTIFY leftPodChargingChanged)
+    Q_PROPERTY(bool leftPodAvailable READ isLeftPodAvailable NOTIFY leftPodAvailableChanged)
+    Q_PROPERTY(quint8 rightPodLevel READ getRightPodLevel NOTIFY rightPodLevelChanged)
+    Q_PROPERTY(bool rightPodCharging READ isRightPodCharging NOTIFY rightPodChargingChanged)
+    Q_PROPERTY(bool rightPodAvailable READ isRightPodAvailable NOTIFY rightPodAvailableChanged)
+    Q_PROPERTY(quint8 caseLevel READ getCaseLevel NOTIFY caseLevelChanged)
+    Q_PROPERTY(bool caseCharging READ isCaseCharging NOTIFY caseChargingChanged)
+    Q_PROPERTY(bool caseAvailable READ isCaseAvailable NOTIFY caseAvailableChanged)
+    Q_PROPERTY(quint8 singleLevel READ getSingleLevel NOTIFY singleLevelChanged)
+    Q_PROPERTY(bool singleCharging READ isSingleCharging NOTIFY singleChargingChanged)
+    Q_PROPERTY(bool singleAvailable READ isSingleAvailable NOTIFY singleAvailableChanged)
 
 public:
     explicit Battery(QObject *parent = nullptr) : QObject(parent)
     {
-        reset();
     }
 
     void reset()
     {
-        // Initialize all components to unknown state
-        states[Component::Left] = {};
-        states[Component::Right] = {};
-        states[Component::Case] = {};
-        emit batteryStatusChanged();
+        // Set all components back to unknown state
+        applyStates({});
     }
 
     // Enum for AirPods components
     enum class Component
     {
+        // The one battery of over-ear models like AirPods Max. AAP Definitions.md
+        // only lists 02, 04 and 08, from AirPods Pro captures, so a
+        // one-component packet with any other type is taken as this one.
+        Single = 0x01,
         Right = 0x02,
         Left = 0x04,
         Case = 0x08,
@@ -56,32 +63,56 @@ public:
     {
         quint8 level = 0; // Battery level (0-100), 0 if unknown
         BatteryStatus status = BatteryStatus::Disconnected;
+
+        bool operator==(const BatteryState &other) const { return level == other.level && status == other.status; }
+        bool operator!=(const BatteryState &other) const { return !(*this == other); }
+    };
+
+    // Properties that changed in the last parsePacket() or reset()
+    enum Change : quint16
+    {
+        LeftLevelChanged = 1 << 0,
+        LeftChargingChanged = 1 << 1,
+        LeftAvailableChanged = 1 << 2,
+        RightLevelChanged = 1 << 3,
+        RightChargingChanged = 1 << 4,
+        RightAvailableChanged = 1 << 5,
+        CaseLevelChanged = 1 << 6,
+        CaseChargingChanged = 1 << 7,
+        CaseAvailableChanged = 1 << 8,
+        SingleLevelChanged = 1 << 9,
+        SingleChargingChanged = 1 << 10,
+        SingleAvailableChanged = 1 << 11,
     };
 
-    // Parse the battery status packet and detect primary/secondary pods
-    bool parsePacket(const QByteArray &packet)
+    // Parse the battery status packet and detect primary/secondary pods.
+    // Components missing from the packet keep their previous state.
+    bool parsePacket(QByteArrayView packet)
     {
-        if (!packet.startsWith(AirPodsPackets::Parse::BATTERY_STATUS))
+        using namespace AirPodsPackets;
+        constexpr qsizetype COUNT_OFFSET = Parse::BATTERY_STATUS.size();
+        if (!packet.startsWith(Parse::BATTERY_STATUS) || packet.size() <= COUNT_OFFSET)
         {
             return false;
         }
 
-        // Get battery count (number of components)
-        quint8 batteryCount = static_cast<quint8>(packet[6]);
-        if (batteryCount > 3 || packet.size() != 7 + 5 * batteryCount)
+        // Get battery count (number of components), 1 for AirPods Max, 3 for the others
+        quint8 batteryCount = static_cast<quint8>(packet[COUNT_OFFSET]);
+        if (batteryCount > Parse::MAX_BATTERY_COMPONENTS
+            || packet.size() != COUNT_OFFSET + 1 + Parse::BATTERY_COMPONENT_SIZE * batteryCount)
         {
             return false; // Invalid count or size mismatch
         }
 
-        QMap<Component, BatteryState> newStates = states;
+        States newStates = states;
 
-        // Track pods to determine primary and secondary based on order
-        QList<Component> podsInPacket;
-        podsInPacket.reserve(2);
+        // Pods in the order they appear, the first one is primary
+        Component podsInPacket[2];
+        int podCount = 0;
 
         for (quint8 i = 0; i < batteryCount; ++i)
         {
-            int offset = 7 + (5 * i);
+            qsizetype offset = COUNT_OFFSET + 1 + Parse::BATTERY_COMPONENT_SIZE * i;
             quint8 type = static_cast<quint8>(packet[offset]);
 
             // Verify spacer and end bytes
@@ -92,46 +123,67 @@ public:
             }
 
             Component comp = static_cast<Component>(type);
+            int index = indexOf(comp);
+            if (index < 0 && batteryCount == 1)
+            {
+                comp = Component::Single;
+                index = SingleIndex;
+            }
+            if (index < 0)
+            {
+                continue; // Unknown component, skip it
+            }
+
             auto level = static_cast<quint8>(packet[offset + 2]);
             auto status = static_cast<BatteryStatus>(packet[offset + 3]);
+            newStates[index] = {level, status};
 
-            newStates[comp] = {level, status};
-
-            // If this is a pod (Left or Right), add it to the list
-            if (comp == Component::Left || comp == Component::Right)
+            if ((comp == Component::Left || comp == Component::Right) && podCount < 2)
             {
-                podsInPacket.append(comp);
+                podsInPacket[podCount++] = comp;
             }
         }
 
-        // Update states
-        states = newStates;
+        applyStates(newStates);
 
         // Set primary and secondary pods based on order
-        if (!podsInPacket.isEmpty())
+        if (podCount > 0 && podsInPacket[0] != primaryPod)
         {
-            Component newPrimaryPod = podsInPacket[0]; // First pod is primary
-            if (newPrimaryPod != primaryPod)
-            {
-                primaryPod = newPrimaryPod;
-                emit primaryChanged();
-            }
+            primaryPod = podsInPacket[0];
+            emit primaryChanged();
         }
-        if (podsInPacket.size() >= 2)
+        if (podCount >= 2)
         {
-            secondaryPod = podsInPacket[1]; // Second pod is secondary
+            secondaryPod = podsInPacket[1];
         }
 
-        // Emit signal to notify about battery status change
-        emit batteryStatusChanged();
-
         return true;
     }
 
+    quint16 lastChanges() const { return changes; }
+
+    // Mirrors decoded levels, for a copy of the state on another thread
+    void applyLevels(const AirpodsTrayApp::BatteryLevels &levels)
+    {
+        auto stateOf = [](quint8 level, bool charging, bool available) {
+            BatteryStatus status = charging ? BatteryStatus::Charging
+                                 : available ? BatteryStatus::Discharging
+                                             : BatteryStatus::Disconnected;
+            return BatteryState{level, status};
+        };
+        States newStates = states;
+        newStates[LeftIndex] = stateOf(levels.left, levels.leftCharging, levels.leftAvailable);
+        newStates[RightIndex] = stateOf(levels.right, levels.rightCharging, levels.rightAvailable);
+        newStates[CaseIndex] = stateOf(levels.caseLevel, levels.caseCharging, levels.caseAvailable);
+        newStates[SingleIndex] = stateOf(levels.single, levels.singleCharging, levels.singleAvailable);
+        applyStates(newStates);
+    }
+
     // Get the raw state for a component
     BatteryState getState(Component comp) const
     {
-        return states.value(comp, {});
+        int index = indexOf(comp);
+        return index < 0 ? BatteryState() : states[index];
     }
 
     // Get a formatted status string including charging state
@@ -165,27 +217,117 @@ public:
     Component getPrimaryPod() const { return primaryPod; }
     Component getSecondaryPod() const { return secondaryPod; }
 
-    quint8 getLeftPodLevel() const { return states.value(Component::Left).level; }
-    bool isLeftPodCharging() const { return isStatus(Component::Left, BatteryStatus::Charging); }
-    bool isLeftPodAvailable() const { return !isStatus(Component::Left, BatteryStatus::Disconnected); }
-    quint8 getRightPodLevel() const { return states.value(Component::Right).level; }
-    bool isRightPodCharging() const { return isStatus(Component::Right, BatteryStatus::Charging); }
-    bool isRightPodAvailable() const { return !isStatus(Component::Right, BatteryStatus::Disconnected); }
-    quint8 getCaseLevel() const { return states.value(Component::Case).level; }
-    bool isCaseCharging() const { return isStatus(Component::Case, BatteryStatus::Charging); }
-    bool isCaseAvailable() const { return !isStatus(Component::Case, BatteryStatus::Disconnected); }
+    quint8 getLeftPodLevel() const { return states[LeftIndex].level; }
+    bool isLeftPodCharging() const { return states[LeftIndex].status == BatteryStatus::Charging; }
+    bool isLeftPodAvailable() const { return states[LeftIndex].status != BatteryStatus::Disconnected; }
+    quint8 getRightPodLevel() const { return states[RightIndex].level; }
+    bool isRightPodCharging() const { return states[RightIndex].status == BatteryStatus::Charging; }
+    bool isRightPodAvailable() const { return states[RightIndex].status != BatteryStatus::Disconnected; }
+    quint8 getCaseLevel() const { return states[CaseIndex].level; }
+    bool isCaseCharging() const { return states[CaseIndex].status == BatteryStatus::Charging; }
+    bool isCaseAvailable() const { return states[CaseIndex].status != BatteryStatus::Disconnected; }
+    quint8 getSingleLevel() const { return states[SingleIndex].level; }
+    bool isSingleCharging() const { return states[SingleIndex].status == BatteryStatus::Charging; }
+    bool isSingleAvailable() const { return states[SingleIndex].status != BatteryStatus::Disconnected; }
 
 signals:
-    void batteryStatusChanged();
+    void batteryStatusChanged(); // Any of the properties below
+    void leftPodLevelChanged();
+    void leftPodChargingChanged();
+    void leftPodAvailableChanged();
+    void rightPodLevelChanged();
+    void rightPodChargingChanged();
+    void rightPodAvailableChanged();
+    void caseLevelChanged();
+    void caseChargingChanged();
+    void caseAvailableChanged();
+    void singleLevelChanged();
+    void singleChargingChanged();
+    void singleAvailableChanged();
     void primaryChanged();
 
 private:
-    bool isStatus(Component component, BatteryStatus status) const
+    enum Index
+    {
+        LeftIndex,
+        RightIndex,
+        CaseIndex,
+        SingleIndex,
+        ComponentCount
+    };
+    using States = std::array<BatteryState, ComponentCount>;
+
+    static int indexOf(Component comp)
+    {
+        switch (comp)
+        {
+        case Component::Left:
+            return LeftIndex;
+        case Component::Right:
+            return RightIndex;
+        case Component::Case:
+            return CaseIndex;
+        case Component::Single:
+            return SingleIndex;
+        }
+        return -1;
+    }
+
+    // Changes of level, charging and availability of one component, shifted to its bits
+    static quint16 diff(const BatteryState &from, const BatteryState &to)
     {
-        return states.value(component).status == status;
+        quint16 mask = 0;
+        if (from.level != to.level)
+            mask |= 1 << 0;
+        if ((from.status == BatteryStatus::Charging) != (to.status == BatteryStatus::Charging))
+            mask |= 1 << 1;
+        if ((from.status == BatteryStatus::Disconnected) != (to.status == BatteryStatus::Disconnected))
+            mask |= 1 << 2;
+        return mask;
+    }
+
+    void applyStates(const States &newStates)
+    {
+        changes = diff(states[LeftIndex], newStates[LeftIndex])
+                  | diff(states[RightIndex], newStates[RightIndex]) << 3
+                  | diff(states[CaseIndex], newStates[CaseIndex]) << 6
+                  | diff(states[SingleIndex], newStates[SingleIndex]) << 9;
+        states = newStates;
+        if (changes == 0)
+        {
+            return;
+        }
+
+        // Only the bindings of properties that changed get re-evaluated
+        if (changes & LeftLevelChanged)
+            emit leftPodLevelChanged();
+        if (changes & LeftChargingChanged)
+            emit leftPodChargingChanged();
+        if (changes & LeftAvailableChanged)
+            emit leftPodAvailableChanged();
+        if (changes & RightLevelChanged)
+            emit rightPodLevelChanged();
+        if (changes & RightChargingChanged)
+            emit rightPodChargingChanged();
+        if (changes & RightAvailableChanged)
+            emit rightPodAvailableChanged();
+        if (changes & CaseLevelChanged)
+            emit caseLevelChanged();
+        if (changes & CaseChargingChanged)
+            emit caseChargingChanged();
+        if (changes & CaseAvailableChanged)
+            emit caseAvailableChanged();
+        if (changes & SingleLevelChanged)
+            emit singleLevelChanged();
+        if (changes & SingleChargingChanged)
+            emit singleChargingChanged();
+        if (changes & SingleAvailableChanged)
+            emit singleAvailableChanged();
+        emit batteryStatusChanged();
     }
 
-    QMap<Component, BatteryState> states;
-    Component primaryPod;
-    Component secondaryPod;
+    States states{};
+    quint16 changes = 0;
+    Component primaryPod = Component::Left;
+    Component secondaryPod = Component::Right;
 };
@@ -0,0 +1,32 @@
+#include "bluetoothtransport.h"
+#include "logger.h"
+
+BluetoothTransport::BluetoothTransport(const QBluetoothAddress &address, const QBluetoothUuid &service,
+                                       QObject *parent)
+    : Transport(parent)
+    , m_address(address)
+    , m_service(service)
+    , m_socket(new QBluetoothSocket(QBluetoothServiceInfo::L2capProtocol, this))
+{
+    connect(m_socket, &QBluetoothSocket::connected, this, &Transport::connected);
+    connect(m_socket, &QBluetoothSocket::disconnected, this, &Transport::disconnected);
+    connect(m_socket, &QBluetoothSocket::errorOccurred, this, [this](QBluetoothSocket::SocketError error) {
+        LOG_ERROR("Socket error: " << error << ", " << m_socket->errorString());
+        emit errorOccurred(m_socket->errorString());
+    });
+}
+
+void BluetoothTransport::open()
+{
+    m_socket->connectToService(m_address, m_service);
+}
+
+void BluetoothTransport::close()
+{
+    m_socket->close();
+}
+
+bool BluetoothTransport::isOpen() const
+{
+    return m_socket->isOpen() && m_socket->state() == QBluetoothSocket::SocketState::ConnectedState;
+}
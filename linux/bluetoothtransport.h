@@ -0,0 +1,37 @@
+#ifndef BLUETOOTHTRANSPORT_H
+#define BLUETOOTHTRANSPORT_H
+
+#include <QBluetoothAddress>
+#include <QBluetoothSocket>
+#include <QBluetoothUuid>
+
+#include "transport.h"
+
+// AAP over the L2CAP channel the AirPods advertise (PSM 0x1001), or over
+// the channel of another service such as the ALN app on a phone
+class BluetoothTransport : public Transport
+{
+    Q_OBJECT
+public:
+    static inline const QBluetoothUuid AapService{QStringLiteral("74ec2172-0bad-4d01-8f77-997b2be0722a")};
+    static inline const QBluetoothUuid PhoneService{QStringLiteral("1abbb9a4-10e4-4000-a75c-8953c5471342")};
+
+    explicit BluetoothTransport(const QBluetoothAddress &address, const QBluetoothUuid &service = AapService,
+                                QObject *parent = nullptr);
+
+    void open() override;
+    void close() override;
+    bool isOpen() const override;
+
+    QIODevice *device() const override { return m_socket; }
+    QString peerAddress() const override { return m_address.toString(); }
+
+    QBluetoothSocket *socket() const { return m_socket; }
+
+private:
+    QBluetoothAddress m_address;
+    QBluetoothUuid m_service;
+    QBluetoothSocket *m_socket;
+};
+
+#endif // BLUETOOTHTRANSPORT_H
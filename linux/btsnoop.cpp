@@ -0,0 +1,100 @@
+#include "btsnoop.h"
+
+#include <QtEndian>
+
+namespace Btsnoop
+{
+    namespace
+    {
+        constexpr char MAGIC[] = {'b', 't', 's', 'n', 'o', 'o', 'p', '\0'};
+        constexpr quint32 VERSION = 1;
+        constexpr quint32 DATALINK_H4 = 1002;
+        constexpr quint8 H4_ACL = 0x02;
+        constexpr quint16 PB_FIRST_FLUSHABLE = 0x2000;
+        constexpr quint32 FLAG_RECEIVED = 0x01;
+
+        template <typename T>
+        void appendBigEndian(QByteArray &out, T value)
+        {
+            char bytes[sizeof(T)];
+            qToBigEndian(value, bytes);
+            out.append(bytes, sizeof(T));
+        }
+
+        template <typename T>
+        void appendLittleEndian(QByteArray &out, T value)
+        {
+            char bytes[sizeof(T)];
+            qToLittleEndian(value, bytes);
+            out.append(bytes, sizeof(T));
+        }
+    }
+
+    void appendFileHeader(QByteArray &out)
+    {
+        out.append(MAGIC, sizeof(MAGIC));
+        appendBigEndian<quint32>(out, VERSION);
+        appendBigEndian<quint32>(out, DATALINK_H4);
+    }
+
+    void appendRecord(QByteArray &out, Direction direction, qint64 timestampUs, QByteArrayView payload, quint16 cid,
+                      quint16 handle)
+    {
+        const quint32 length = static_cast<quint32>(ACL_HEADER_SIZE + payload.size());
+        appendBigEndian<quint32>(out, length); // Original length
+        appendBigEndian<quint32>(out, length); // Included length
+        appendBigEndian<quint32>(out, direction == Direction::Received ? FLAG_RECEIVED : 0);
+        appendBigEndian<quint32>(out, 0); // Cumulative drops
+        appendBigEndian<qint64>(out, timestampUs + EPOCH_OFFSET_US);
+
+        out.append(static_cast<char>(H4_ACL));
+        appendLittleEndian<quint16>(out, (handle & 0x0FFF) | PB_FIRST_FLUSHABLE);
+        appendLittleEndian<quint16>(out, static_cast<quint16>(payload.size() + 4)); // ACL data length
+        appendLittleEndian<quint16>(out, static_cast<quint16>(payload.size()));     // L2CAP length
+        appendLittleEndian<quint16>(out, cid);
+        out.append(payload.data(), payload.size());
+    }
+
+    Reader::Reader(QByteArrayView data) : m_data(data)
+    {
+        m_valid = data.size() >= FILE_HEADER_SIZE
+                  && data.startsWith(QByteArrayView(MAGIC, sizeof(MAGIC)))
+                  && qFromBigEndian<quint32>(data.data() + 8) == VERSION
+                  && qFromBigEndian<quint32>(data.data() + 12) == DATALINK_H4;
+    }
+
+    bool Reader::next(Record &record)
+    {
+        while (m_valid && m_pos + RECORD_HEADER_SIZE <= m_data.size())
+        {
+            const char *header = m_data.data() + m_pos;
+            const quint32 included = qFromBigEndian<quint32>(header + 4);
+            const quint32 flags = qFromBigEndian<quint32>(header + 8);
+            const qint64 timestamp = qFromBigEndian<qint64>(header + 16);
+            if (m_pos + RECORD_HEADER_SIZE + included > static_cast<quint64>(m_data.size()))
+            {
+                break; // Truncated, e.g. the app was killed while writing
+            }
+
+            QByteArrayView packet = m_data.sliced(m_pos + RECORD_HEADER_SIZE, included);
+            m_pos += RECORD_HEADER_SIZE + included;
+
+            // Only the first fragment of an ACL packet carries the L2CAP header
+            if (packet.size() < ACL_HEADER_SIZE || static_cast<quint8>(packet[0]) != H4_ACL
+                || (qFromLittleEndian<quint16>(packet.data() + 1) & 0x3000) == 0x1000)
+            {
+                ++m_skipped;
+                continue;
+            }
+
+            const quint16 l2capLength = qFromLittleEndian<quint16>(packet.data() + 5);
+            record.timestampUs = timestamp - EPOCH_OFFSET_US;
+            record.direction = (flags & FLAG_RECEIVED) ? Direction::Received : Direction::Sent;
+            record.handle = qFromLittleEndian<quint16>(packet.data() + 1) & 0x0FFF;
+            record.cid = qFromLittleEndian<quint16>(packet.data() + 7);
+            record.payload = packet.sliced(ACL_HEADER_SIZE, qMin<qsizetype>(l2capLength, packet.size() - ACL_HEADER_SIZE));
+            return true;
+        }
+        return false;
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef BTSNOOP_H
+#define BTSNOOP_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QtGlobal>
+
+// Reading and writing btsnoop capture files (the format of Android's HCI
+// snoop log, readable by Wireshark).
+//
+// AAP frames are stored as H4 ACL packets with a basic L2CAP header, so
+// Wireshark shows them on one L2CAP channel in the right direction. The ACL
+// handle tells connections apart, one per pair when several are captured.
+// Only the payload matters when reading them back.
+namespace Btsnoop
+{
+    enum class Direction
+    {
+        Sent,
+        Received
+    };
+
+    constexpr quint16 DEFAULT_HANDLE = 0x0001;
+    constexpr quint16 MAX_HANDLE = 0x0EFF;
+    constexpr quint16 DEFAULT_CID = 0x0040; // First dynamically allocated channel
+    constexpr qsizetype FILE_HEADER_SIZE = 16;
+    constexpr qsizetype RECORD_HEADER_SIZE = 24;
+    constexpr qsizetype ACL_HEADER_SIZE = 9; // H4 type, ACL header, L2CAP header
+
+    // Microseconds between 0000-01-01 and 1970-01-01, btsnoop timestamps start at year 0
+    constexpr qint64 EPOCH_OFFSET_US = Q_INT64_C(0x00dcddb30f2f8000);
+
+    struct Record
+    {
+        qint64 timestampUs = 0; // Since 1970-01-01
+        Direction direction = Direction::Received;
+        quint16 handle = 0;
+        quint16 cid = 0;
+        QByteArrayView payload; // Points into the data given to Reader
+    };
+
+    void appendFileHeader(QByteArray &out);
+    void appendRecord(QByteArray &out, Direction direction, qint64 timestampUs, QByteArrayView payload,
+                      quint16 cid = DEFAULT_CID, quint16 handle = DEFAULT_HANDLE);
+
+    // Walks the L2CAP records of a capture held in memory; other HCI packets are skipped
+    class Reader
+    {
+    public:
+        explicit Reader(QByteArrayView data);
+
+        bool isValid() const { return m_valid; }
+        bool next(Record &record);
+        quint64 skipped() const { return m_skipped; }
+
+    private:
+        QByteArrayView m_data;
+        qsizetype m_pos = FILE_HEADER_SIZE;
+        bool m_valid = false;
+        quint64 m_skipped = 0;
+    };
+}
+
+#endif // BTSNOOP_H
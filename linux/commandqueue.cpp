@@ -0,0 +1,189 @@
+#include "commandqueue.h"
+#include "airpods_packets.h"
+#include "logger.h"
+
+#include <QIODevice>
+#include <QTimer>
+
+CommandQueue::CommandQueue(QObject *parent)
+    : QObject(parent), m_settingTimer(new QTimer(this))
+{
+    // Settings are paced so that a burst collapses into the latest value
+    m_settingTimer->setSingleShot(true);
+    m_settingTimer->setInterval(50);
+    connect(m_settingTimer, &QTimer::timeout, this, &CommandQueue::scheduleFlush);
+}
+
+void CommandQueue::setDevice(QIODevice *device)
+{
+    if (m_device)
+    {
+        disconnect(m_device, nullptr, this, nullptr);
+    }
+    m_device = device;
+    if (m_device)
+    {
+        connect(m_device, &QIODevice::bytesWritten, this, &CommandQueue::scheduleFlush);
+        scheduleFlush();
+    }
+}
+
+void CommandQueue::setReady(bool ready)
+{
+    m_ready = ready;
+    if (m_ready)
+    {
+        scheduleFlush();
+    }
+}
+
+void CommandQueue::setSettingInterval(int msec)
+{
+    m_settingTimer->setInterval(msec);
+}
+
+void CommandQueue::enqueue(QByteArrayView packet, Priority priority)
+{
+    if (priority == Priority::User)
+    {
+        enqueueSetting(packet);
+        return;
+    }
+
+    (priority == Priority::Control ? m_control : m_relay).enqueue(packet.toByteArray());
+    updatePeakDepth();
+    scheduleFlush();
+}
+
+void CommandQueue::enqueueSetting(QByteArrayView packet)
+{
+    quint16 key = settingKey(packet);
+    for (PendingSetting &setting : m_settings)
+    {
+        if (setting.key == key)
+        {
+            setting.packet = packet.toByteArray();
+            ++m_stats.coalesced;
+            return;
+        }
+    }
+
+    m_settings.append({key, packet.toByteArray()});
+    updatePeakDepth();
+    scheduleFlush();
+}
+
+void CommandQueue::clear()
+{
+    m_control.clear();
+    m_settings.clear();
+    m_relay.clear();
+    m_settingTimer->stop();
+    m_ready = false;
+}
+
+CommandQueue::Stats CommandQueue::stats() const
+{
+    Stats stats = m_stats;
+    stats.controlDepth = m_control.size();
+    stats.settingDepth = m_settings.size();
+    stats.relayDepth = m_relay.size();
+    return stats;
+}
+
+void CommandQueue::flush()
+{
+    m_flushScheduled = false;
+    if (!m_device || !m_device->isOpen())
+    {
+        return;
+    }
+
+    while (depth() > 0)
+    {
+        if (m_device->bytesToWrite() >= m_maxBytesInFlight)
+        {
+            ++m_stats.backpressureStalls;
+            return; // Resumed by bytesWritten
+        }
+
+        if (!m_control.isEmpty())
+        {
+            if (!write(m_control.dequeue(), Priority::Control))
+            {
+                return;
+            }
+        }
+        else if (!m_ready)
+        {
+            return; // Resumed by setReady
+        }
+        else if (!m_settings.isEmpty() && !m_settingTimer->isActive())
+        {
+            if (!write(m_settings.takeFirst().packet, Priority::User))
+            {
+                return;
+            }
+            m_settingTimer->start();
+        }
+        else if (!m_relay.isEmpty())
+        {
+            if (!write(m_relay.dequeue(), Priority::Relay))
+            {
+                return;
+            }
+        }
+        else
+        {
+            return; // Only settings left, resumed by m_settingTimer
+        }
+    }
+}
+
+quint16 CommandQueue::settingKey(QByteArrayView packet)
+{
+    using namespace AirPodsPackets;
+    if (packet.size() < Frame::HEADER_SIZE)
+    {
+        return 0;
+    }
+    quint8 opcode = static_cast<quint8>(packet[Frame::OPCODE_OFFSET]);
+    quint8 identifier = 0;
+    if (opcode == Opcode::CONTROL_COMMAND && packet.size() > Frame::CONTROL_IDENTIFIER_OFFSET)
+    {
+        identifier = static_cast<quint8>(packet[Frame::CONTROL_IDENTIFIER_OFFSET]);
+    }
+    return static_cast<quint16>((opcode << 8) | identifier);
+}
+
+void CommandQueue::scheduleFlush()
+{
+    // Deferred to the event loop so that everything queued in one go is written together
+    if (!m_flushScheduled)
+    {
+        m_flushScheduled = true;
+        QMetaObject::invokeMethod(this, &CommandQueue::flush, Qt::QueuedConnection);
+    }
+}
+
+void CommandQueue::updatePeakDepth()
+{
+    m_stats.peakDepth = qMax(m_stats.peakDepth, depth());
+}
+
+bool CommandQueue::write(const QByteArray &packet, Priority priority)
+{
+    qint64 written = m_device->write(packet);
+    if (written != packet.size())
+    {
+        LOG_ERROR("Failed to write packet: " << m_device->errorString());
+        return false;
+    }
+
+    ++m_stats.packetsWritten;
+    m_stats.bytesWritten += written;
+    static const char *const tags[] = {"Packet written (Control):", "Packet written (User):", "Packet written (Relay):"};
+    LOG_PACKET(tags[int(priority)], packet);
+    emit packetWritten(packet, priority);
+    return true;
+}
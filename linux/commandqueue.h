@@ -0,0 +1,96 @@
+#ifndef COMMANDQUEUE_H
+#define COMMANDQUEUE_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QIODevice>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QQueue>
+
+class QTimer;
+
+// Outbound packet scheduler for the AirPods socket.
+//
+// Packets are written in priority order: control (handshake), then user
+// settings, then packets relayed from the phone. Settings and relayed packets
+// are held back until the handshake is done. A setting that hasn't been
+// written yet is replaced when a newer value for it comes in, so a burst of
+// changes ends up as a single write. Writes stop while the device has more
+// than maxBytesInFlight bytes waiting, and resume on bytesWritten.
+class CommandQueue : public QObject
+{
+    Q_OBJECT
+public:
+    enum class Priority
+    {
+        Control,
+        User,
+        Relay
+    };
+    Q_ENUM(Priority)
+
+    struct Stats
+    {
+        int controlDepth = 0;
+        int settingDepth = 0;
+        int relayDepth = 0;
+        int peakDepth = 0;
+        quint64 packetsWritten = 0;
+        quint64 bytesWritten = 0;
+        quint64 coalesced = 0;          // Settings replaced before they were written
+        quint64 backpressureStalls = 0; // Flushes stopped by maxBytesInFlight
+    };
+
+    explicit CommandQueue(QObject *parent = nullptr);
+
+    void setDevice(QIODevice *device);
+    void setReady(bool ready);
+    bool isReady() const { return m_ready; }
+
+    void setMaxBytesInFlight(qint64 bytes) { m_maxBytesInFlight = bytes; }
+    void setSettingInterval(int msec);
+
+    void enqueue(QByteArrayView packet, Priority priority);
+    // Latest value wins: the setting is identified by the opcode and, for
+    // control commands, the identifier byte of the packet
+    void enqueueSetting(QByteArrayView packet);
+
+    void clear();
+
+    int depth() const { return m_control.size() + m_settings.size() + m_relay.size(); }
+    Stats stats() const;
+
+signals:
+    // The packet is shared, not copied, so it is safe to queue across threads
+    void packetWritten(const QByteArray &packet, CommandQueue::Priority priority);
+
+private slots:
+    void flush();
+
+private:
+    struct PendingSetting
+    {
+        quint16 key;
+        QByteArray packet;
+    };
+
+    static quint16 settingKey(QByteArrayView packet);
+    void scheduleFlush();
+    void updatePeakDepth();
+    bool write(const QByteArray &packet, Priority priority);
+
+    QPointer<QIODevice> m_device;
+    QTimer *m_settingTimer;
+    bool m_ready = false;
+    bool m_flushScheduled = false;
+    qint64 m_maxBytesInFlight = 256;
+
+    QQueue<QByteArray> m_control;
+    QList<PendingSetting> m_settings;
+    QQueue<QByteArray> m_relay;
+    Stats m_stats;
+};
+
+#endif // COMMANDQUEUE_H
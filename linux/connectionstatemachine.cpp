@@ -0,0 +1,189 @@
+#include "connectionstatemachine.h"
+#include "airpodssession.h"
+#include "logger.h"
+#include "metrics.h"
+#include "transport.h"
+
+#include <QRandomGenerator>
+#include <QTimer>
+#include <algorithm>
+#include <cmath>
+
+ConnectionStateMachine::ConnectionStateMachine(AirPodsSession *session, const QString &address, QObject *parent)
+    : QObject(parent)
+    , m_session(session)
+    , m_address(address)
+    , m_timer(new QTimer(this))
+{
+    m_timer->setSingleShot(true);
+    connect(m_timer, &QTimer::timeout, this, &ConnectionStateMachine::onTimeout);
+    connect(session, &AirPodsSession::connected, this, &ConnectionStateMachine::onConnected);
+    connect(session, &AirPodsSession::ready, this, &ConnectionStateMachine::onReady);
+    connect(session, &AirPodsSession::errorOccurred, this, [this](const QString &message) {
+        Metrics::add(Metrics::Counter::ConnectionErrors);
+        fail(message);
+    });
+    connect(session, &AirPodsSession::disconnected, this, [this]() { fail("link closed"); });
+    m_sinceChange.start();
+}
+
+const char *ConnectionStateMachine::stateName(State state)
+{
+    static constexpr const char *Names[] = {"idle", "connecting", "handshaking", "ready", "backoff"};
+    static_assert(std::size(Names) == int(State::Count), "Every state needs a name");
+    return Names[int(state)];
+}
+
+void ConnectionStateMachine::setTransportFactory(TransportFactory factory)
+{
+    m_factory = std::move(factory);
+}
+
+void ConnectionStateMachine::connectNow()
+{
+    if (m_state == State::Connecting || m_state == State::Handshaking)
+    {
+        return;
+    }
+    if (m_state == State::Ready && m_session->isConnected())
+    {
+        return;
+    }
+    attempt();
+}
+
+void ConnectionStateMachine::rearm()
+{
+    m_failures = 0;
+    connectNow();
+}
+
+void ConnectionStateMachine::stop()
+{
+    m_timer->stop();
+    setState(State::Idle);
+}
+
+qint64 ConnectionStateMachine::timeInStateMs(State state) const
+{
+    qint64 total = m_totalMs[int(state)];
+    if (state == m_state)
+    {
+        total += m_sinceChange.elapsed();
+    }
+    return total;
+}
+
+void ConnectionStateMachine::setState(State state)
+{
+    if (state == m_state)
+    {
+        return;
+    }
+    const qint64 elapsed = m_sinceChange.restart();
+    m_totalMs[int(m_state)] += elapsed;
+    LOG_DEBUG(m_address << ": " << stateName(m_state) << " -> " << stateName(state) << " after " << elapsed << " ms");
+    m_state = state;
+    emit stateChanged(state);
+}
+
+void ConnectionStateMachine::attempt()
+{
+    if (!m_factory)
+    {
+        LOG_WARN("No way to connect to " << m_address);
+        return;
+    }
+    if (m_failures > 0)
+    {
+        Metrics::add(Metrics::Counter::ReconnectAttempts);
+        LOG_INFO("Retrying connection to " << m_address << " (attempt " << m_failures + 1 << ")");
+    }
+
+    // The state goes first, so errors reported while opening already count against this attempt
+    setState(State::Connecting);
+    m_timer->start(m_policy.connectTimeoutMs);
+    Transport *transport = m_factory();
+    m_session->setTransport(transport); // Disposes of the previous one
+    transport->open();
+}
+
+void ConnectionStateMachine::onTimeout()
+{
+    switch (m_state)
+    {
+    case State::Connecting:
+        fail("connection timed out");
+        break;
+    case State::Handshaking:
+        fail("handshake timed out");
+        break;
+    case State::Backoff:
+        attempt();
+        break;
+    default:
+        break;
+    }
+}
+
+void ConnectionStateMachine::onConnected()
+{
+    if (m_state != State::Connecting)
+    {
+        return;
+    }
+    setState(State::Handshaking);
+    m_timer->start(m_policy.handshakeTimeoutMs);
+}
+
+void ConnectionStateMachine::onReady()
+{
+    if (m_state != State::Connecting && m_state != State::Handshaking)
+    {
+        return;
+    }
+    m_timer->stop();
+    Metrics::add(Metrics::Counter::ConnectionsReady);
+    if (m_failures > 0)
+    {
+        Metrics::add(Metrics::Counter::ReconnectsSucceeded);
+    }
+    m_failures = 0;
+    setState(State::Ready);
+}
+
+void ConnectionStateMachine::fail(const QString &reason)
+{
+    if (m_state == State::Idle || m_state == State::Backoff)
+    {
+        return;
+    }
+    ++m_failures;
+    const bool givingUp = m_policy.maxAttempts > 0 && m_failures >= m_policy.maxAttempts;
+
+    // Leave the state before dropping the transport, whatever it reports on the way out is stale
+    setState(givingUp ? State::Idle : State::Backoff);
+    m_session->setTransport(nullptr);
+
+    if (givingUp)
+    {
+        m_timer->stop();
+        LOG_ERROR("Failed to connect to " << m_address << " after " << m_failures << " attempts (" << reason
+                  << "), waiting for the device to show up again");
+        Metrics::add(Metrics::Counter::ReconnectsFailed);
+        emit gaveUp();
+        return;
+    }
+    const int delayMs = backoffDelayMs();
+    LOG_INFO("Connection to " << m_address << " failed (" << reason << "), retrying in " << delayMs << " ms");
+    m_timer->start(delayMs);
+}
+
+int ConnectionStateMachine::backoffDelayMs() const
+{
+    double delay = m_policy.initialDelayMs * std::pow(m_policy.multiplier, m_failures - 1);
+    delay = std::min(delay, double(m_policy.maxDelayMs));
+    // Somewhere in [1 - jitter, 1 + jitter) of the nominal delay
+    delay *= 1.0 + m_policy.jitter * (2.0 * QRandomGenerator::global()->generateDouble() - 1.0);
+    return std::max(0, int(delay));
+}
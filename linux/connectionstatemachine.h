@@ -0,0 +1,99 @@
+#ifndef CONNECTIONSTATEMACHINE_H
+#define CONNECTIONSTATEMACHINE_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <array>
+#include <functional>
+
+class AirPodsSession;
+class QTimer;
+class Transport;
+
+// Connects one session and keeps it connected:
+//
+//   Idle -> Connecting -> Handshaking -> Ready
+//              ^              |            |
+//              +-- Backoff <--+------------+  on errors, timeouts and lost links
+//
+// Every attempt gets a fresh transport from the factory, the session
+// disposes of the previous one. Failed attempts wait exponentially longer,
+// with jitter so several pairs don't retry in lockstep. After maxAttempts
+// the machine goes back to Idle until rearm(), which BlueZ reporting the
+// device as connected triggers, so an absent device costs nothing.
+class ConnectionStateMachine : public QObject
+{
+    Q_OBJECT
+public:
+    enum class State
+    {
+        Idle,
+        Connecting,
+        Handshaking,
+        Ready,
+        Backoff,
+        Count
+    };
+    Q_ENUM(State)
+
+    struct Policy
+    {
+        int initialDelayMs = 500;
+        int maxDelayMs = 60000;
+        double multiplier = 2.0;
+        double jitter = 0.2;       // Delays vary by up to this fraction either way
+        int maxAttempts = 8;       // Failed attempts in a row before going Idle, 0 for no limit
+        int connectTimeoutMs = 15000;
+        int handshakeTimeoutMs = 10000;
+    };
+
+    using TransportFactory = std::function<Transport *()>;
+
+    ConnectionStateMachine(AirPodsSession *session, const QString &address, QObject *parent = nullptr);
+
+    void setTransportFactory(TransportFactory factory);
+    void setPolicy(const Policy &policy) { m_policy = policy; }
+    const Policy &policy() const { return m_policy; }
+
+    static const char *stateName(State state);
+
+    // Starts an attempt unless one is under way or the session is ready
+    void connectNow();
+    // The device is known to be there: forget earlier failures and connect right away
+    void rearm();
+    // Back to Idle without touching the transport, e.g. when the device went away
+    void stop();
+
+    State state() const { return m_state; }
+    // Failed attempts since the session was last ready
+    int failures() const { return m_failures; }
+    // Total time spent in the state so far, including the current stay
+    qint64 timeInStateMs(State state) const;
+    qint64 msInCurrentState() const { return m_sinceChange.elapsed(); }
+
+signals:
+    void stateChanged(ConnectionStateMachine::State state);
+    // Nothing more is tried until rearm() or connectNow()
+    void gaveUp();
+
+private:
+    void setState(State state);
+    void attempt();
+    void fail(const QString &reason);
+    void onTimeout();
+    void onConnected();
+    void onReady();
+    int backoffDelayMs() const;
+
+    AirPodsSession *m_session;
+    QString m_address;
+    TransportFactory m_factory;
+    Policy m_policy;
+    State m_state = State::Idle;
+    int m_failures = 0;
+    QTimer *m_timer; // Backoff delay, or the timeout of Connecting and Handshaking
+    QElapsedTimer m_sinceChange;
+    std::array<qint64, int(State::Count)> m_totalMs{};
+};
+
+#endif // CONNECTIONSTATEMACHINE_H
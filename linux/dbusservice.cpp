@@ -0,0 +1,278 @@
+#include "dbusservice.h"
+#include "airpodscontroller.h"
+#include "airpodssession.h"
+#include "logger.h"
+
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QMetaEnum>
+#include <QMetaProperty>
+#include <QTimer>
+
+using namespace AirpodsTrayApp::Enums;
+
+DBusService::DBusService(AirPodsController *controller)
+    : QDBusAbstractAdaptor(controller)
+    , m_controller(controller)
+    , m_flushTimer(new QTimer(this))
+{
+    // Zero interval: runs once the events already queued, such as the rest of a packet burst, are handled
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setInterval(0);
+    connect(m_flushTimer, &QTimer::timeout, this, &DBusService::flushChanges);
+
+    connect(m_controller, &AirPodsController::airPodsStatusChanged, this, [this]() { markChanged({"Connected"}); });
+    connect(m_controller, &AirPodsController::devicesChanged, this, [this]() { markChanged({"Devices", "ActiveDevice"}); });
+    connect(m_controller, &AirPodsController::activeSessionChanged, this, &DBusService::bindSession);
+    bindSession(controller->session());
+}
+
+void DBusService::bindSession(AirPodsSession *session)
+{
+    if (m_session)
+    {
+        disconnect(m_session, nullptr, this, nullptr);
+    }
+    m_session = session;
+
+    connect(m_session, &AirPodsSession::connected, this, [this]() { markChanged({"Connected"}); });
+    connect(m_session, &AirPodsSession::disconnected, this, [this]() { markChanged({"Connected"}); });
+    connect(m_session, &AirPodsSession::deviceNameChanged, this, [this]() { markChanged({"DeviceName"}); });
+    connect(m_session, &AirPodsSession::modelChanged, this, [this]() { markChanged({"Model"}); });
+    connect(m_session, &AirPodsSession::batteryLevelsChanged, this, [this]() {
+        markChanged({"BatteryLeft", "BatteryRight", "BatteryCase", "BatterySingle", "ChargingLeft", "ChargingRight",
+                     "ChargingCase", "ChargingSingle"});
+    });
+    connect(m_session, &AirPodsSession::earDetectionStatusChanged, this, [this]() {
+        markChanged({"LeftInEar", "RightInEar", "EarDetection"});
+    });
+    connect(m_session, &AirPodsSession::primaryChanged, this, [this]() { markChanged({"LeftInEar", "RightInEar"}); });
+    connect(m_session, &AirPodsSession::noiseControlModeChanged, this, [this]() { markChanged({"NoiseControlMode"}); });
+    connect(m_session, &AirPodsSession::conversationalAwarenessChanged, this, [this]() {
+        markChanged({"ConversationalAwareness"});
+    });
+    connect(m_session, &AirPodsSession::adaptiveNoiseLevelChanged, this, [this]() { markChanged({"AdaptiveNoiseLevel"}); });
+
+    // Another device, every value may differ. Unchanged ones are filtered out when flushing.
+    const QMetaObject *meta = metaObject();
+    for (int i = meta->propertyOffset(); i < meta->propertyCount(); ++i)
+    {
+        m_dirty.insert(QByteArray(meta->property(i).name()));
+    }
+    if (!m_flushTimer->isActive())
+    {
+        m_flushTimer->start();
+    }
+}
+
+void DBusService::registerOnBus()
+{
+    QDBusConnection bus = QDBusConnection::sessionBus();
+    if (!bus.registerObject(ObjectPath, m_controller, QDBusConnection::ExportAdaptors))
+    {
+        LOG_WARN("Cannot export " << ObjectPath << " on the session bus");
+        return;
+    }
+
+    // DBUS_NAME_FLAG_DO_NOT_QUEUE, a second instance just goes without the name
+    QDBusMessage request = QDBusMessage::createMethodCall("org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                                          "org.freedesktop.DBus", "RequestName");
+    request << ServiceName << 4u;
+    auto *watcher = new QDBusPendingCallWatcher(bus.asyncCall(request), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [](QDBusPendingCallWatcher *call) {
+        QDBusPendingReply<uint> reply = *call;
+        call->deleteLater();
+        // 1 is DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER
+        if (reply.isError() || reply.value() != 1)
+        {
+            LOG_WARN("Cannot own " << ServiceName << " on the session bus, is another instance running?");
+            return;
+        }
+        LOG_INFO("AirPods state available on D-Bus as " << ServiceName);
+    });
+}
+
+bool DBusService::connected() const
+{
+    return m_session->isConnected();
+}
+
+QString DBusService::deviceName() const
+{
+    return m_session->deviceName();
+}
+
+QString DBusService::model() const
+{
+    return QString::fromLatin1(QMetaEnum::fromType<AirPodsModel>().valueToKey(static_cast<int>(m_session->model())));
+}
+
+int DBusService::batteryLeft() const
+{
+    return m_session->batteryLevels().left;
+}
+
+int DBusService::batteryRight() const
+{
+    return m_session->batteryLevels().right;
+}
+
+int DBusService::batteryCase() const
+{
+    return m_session->batteryLevels().caseLevel;
+}
+
+bool DBusService::chargingLeft() const
+{
+    return m_session->batteryLevels().leftCharging;
+}
+
+bool DBusService::chargingRight() const
+{
+    return m_session->batteryLevels().rightCharging;
+}
+
+bool DBusService::chargingCase() const
+{
+    return m_session->batteryLevels().caseCharging;
+}
+
+int DBusService::batterySingle() const
+{
+    return m_session->batteryLevels().single;
+}
+
+bool DBusService::chargingSingle() const
+{
+    return m_session->batteryLevels().singleCharging;
+}
+
+bool DBusService::leftInEar() const
+{
+    return m_session->isLeftPodInEar();
+}
+
+bool DBusService::rightInEar() const
+{
+    return m_session->isRightPodInEar();
+}
+
+QString DBusService::earDetection() const
+{
+    return m_session->earDetection().toString();
+}
+
+QString DBusService::noiseControlMode() const
+{
+    return QString::fromLatin1(QMetaEnum::fromType<NoiseControlMode>().valueToKey(static_cast<int>(m_session->noiseControlMode())));
+}
+
+bool DBusService::conversationalAwareness() const
+{
+    return m_session->conversationalAwareness();
+}
+
+int DBusService::adaptiveNoiseLevel() const
+{
+    return m_session->adaptiveNoiseLevel();
+}
+
+QVariantMap DBusService::devices() const
+{
+    QVariantMap devices;
+    for (const SessionRegistry::Device &device : m_controller->sessions()->devices())
+    {
+        devices.insert(device.address, device.name);
+    }
+    return devices;
+}
+
+QString DBusService::activeDevice() const
+{
+    return m_controller->sessions()->activeAddress();
+}
+
+bool DBusService::SelectDevice(const QString &address)
+{
+    if (!m_controller->selectDevice(address))
+    {
+        LOG_WARN("D-Bus client selected unknown device " << address);
+        return false;
+    }
+    return true;
+}
+
+bool DBusService::SetNoiseControlMode(const QString &mode)
+{
+    bool ok = false;
+    int value = QMetaEnum::fromType<NoiseControlMode>().keyToValue(mode.toLatin1().constData(), &ok);
+    if (!ok || value < static_cast<int>(NoiseControlMode::MinValue) || value > static_cast<int>(NoiseControlMode::MaxValue))
+    {
+        LOG_WARN("D-Bus client asked for unknown noise control mode " << mode);
+        return false;
+    }
+    return m_session->setNoiseControlMode(static_cast<NoiseControlMode>(value));
+}
+
+bool DBusService::SetConversationalAwareness(bool enabled)
+{
+    return m_session->setConversationalAwareness(enabled);
+}
+
+bool DBusService::SetAdaptiveNoiseLevel(int level)
+{
+    if (level < 0 || level > 100)
+    {
+        return false;
+    }
+    return m_session->setAdaptiveNoiseLevel(level);
+}
+
+bool DBusService::Rename(const QString &name)
+{
+    if (name.isEmpty() || name.size() > 32)
+    {
+        return false;
+    }
+    return m_session->rename(name);
+}
+
+void DBusService::markChanged(std::initializer_list<const char *> properties)
+{
+    for (const char *property : properties)
+    {
+        m_dirty.insert(QByteArray(property));
+    }
+    if (!m_flushTimer->isActive())
+    {
+        m_flushTimer->start();
+    }
+}
+
+void DBusService::flushChanges()
+{
+    QVariantMap changed;
+    for (const QByteArray &name : std::as_const(m_dirty))
+    {
+        QVariant value = property(name.constData());
+        QString key = QString::fromLatin1(name);
+        auto published = m_published.constFind(key);
+        if (published == m_published.cend() || *published != value)
+        {
+            changed.insert(key, value);
+            m_published.insert(key, value);
+        }
+    }
+    m_dirty.clear();
+    if (changed.isEmpty())
+    {
+        return;
+    }
+
+    QDBusMessage signal = QDBusMessage::createSignal(ObjectPath, "org.freedesktop.DBus.Properties", "PropertiesChanged");
+    signal << QString::fromLatin1(metaObject()->classInfo(metaObject()->indexOfClassInfo("D-Bus Interface")).value())
+           << changed << QStringList();
+    QDBusConnection::sessionBus().send(signal);
+}
@@ -0,0 +1,105 @@
+#ifndef DBUSSERVICE_H
+#define DBUSSERVICE_H
+
+#include <QDBusAbstractAdaptor>
+#include <QSet>
+#include <QString>
+#include <QVariantMap>
+
+class AirPodsController;
+class AirPodsSession;
+class QTimer;
+
+// AirPods state on the session bus, for status bars and scripts.
+//
+// Service me.kavishdevar.aln, object /me/kavishdevar/aln, interface
+// me.kavishdevar.aln.AirPods. Properties are read and written through
+// org.freedesktop.DBus.Properties. Changes are collected until the event loop
+// comes back around, so a burst of packets ends in one PropertiesChanged
+// signal that only carries values that actually changed.
+//
+// With several pairs connected everything refers to ActiveDevice, which
+// clients can change to any address in Devices.
+class DBusService : public QDBusAbstractAdaptor
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "me.kavishdevar.aln.AirPods")
+    Q_PROPERTY(bool Connected READ connected)
+    Q_PROPERTY(QString DeviceName READ deviceName)
+    Q_PROPERTY(QString Model READ model)
+    Q_PROPERTY(int BatteryLeft READ batteryLeft)
+    Q_PROPERTY(int BatteryRight READ batteryRight)
+    Q_PROPERTY(int BatteryCase READ batteryCase)
+    Q_PROPERTY(bool ChargingLeft READ chargingLeft)
+    Q_PROPERTY(bool ChargingRight READ chargingRight)
+    Q_PROPERTY(bool ChargingCase READ chargingCase)
+    Q_PROPERTY(int BatterySingle READ batterySingle)
+    Q_PROPERTY(bool ChargingSingle READ chargingSingle)
+    Q_PROPERTY(bool LeftInEar READ leftInEar)
+    Q_PROPERTY(bool RightInEar READ rightInEar)
+    Q_PROPERTY(QString EarDetection READ earDetection)
+    Q_PROPERTY(QString NoiseControlMode READ noiseControlMode WRITE setNoiseControlMode)
+    Q_PROPERTY(bool ConversationalAwareness READ conversationalAwareness WRITE setConversationalAwareness)
+    Q_PROPERTY(int AdaptiveNoiseLevel READ adaptiveNoiseLevel WRITE setAdaptiveNoiseLevel)
+    Q_PROPERTY(QVariantMap Devices READ devices)
+    Q_PROPERTY(QString ActiveDevice READ activeDevice WRITE setActiveDevice)
+
+public:
+    static inline const QString ServiceName = QStringLiteral("me.kavishdevar.aln");
+    static inline const QString ObjectPath = QStringLiteral("/me/kavishdevar/aln");
+
+    explicit DBusService(AirPodsController *controller);
+
+    // Exports the controller and asks for the service name without waiting
+    void registerOnBus();
+
+    bool connected() const;
+    QString deviceName() const;
+    QString model() const;
+    int batteryLeft() const;
+    int batteryRight() const;
+    int batteryCase() const;
+    bool chargingLeft() const;
+    bool chargingRight() const;
+    bool chargingCase() const;
+    // AirPods Max and other models with one battery
+    int batterySingle() const;
+    bool chargingSingle() const;
+    bool leftInEar() const;
+    bool rightInEar() const;
+    QString earDetection() const;
+    QString noiseControlMode() const;
+    bool conversationalAwareness() const;
+    int adaptiveNoiseLevel() const;
+    // Address to name of every pair with a session
+    QVariantMap devices() const;
+    QString activeDevice() const;
+
+    // Property writes, not exported as methods
+    void setNoiseControlMode(const QString &mode) { SetNoiseControlMode(mode); }
+    void setConversationalAwareness(bool enabled) { SetConversationalAwareness(enabled); }
+    void setAdaptiveNoiseLevel(int level) { SetAdaptiveNoiseLevel(level); }
+    void setActiveDevice(const QString &address) { SelectDevice(address); }
+
+public slots:
+    // Off, NoiseCancellation, Transparency or Adaptive
+    bool SetNoiseControlMode(const QString &mode);
+    bool SetConversationalAwareness(bool enabled);
+    bool SetAdaptiveNoiseLevel(int level);
+    bool Rename(const QString &name);
+    // The device the other properties and methods refer to
+    bool SelectDevice(const QString &address);
+
+private:
+    void markChanged(std::initializer_list<const char *> properties);
+    void flushChanges();
+    void bindSession(AirPodsSession *session);
+
+    AirPodsController *m_controller;
+    AirPodsSession *m_session = nullptr;
+    QTimer *m_flushTimer;
+    QSet<QByteArray> m_dirty;
+    QVariantMap m_published; // Last values sent in PropertiesChanged
+};
+
+#endif // DBUSSERVICE_H
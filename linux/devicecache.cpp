@@ -0,0 +1,91 @@
+#include "devicecache.h"
+#include "logger.h"
+
+using namespace AirpodsTrayApp;
+using namespace AirpodsTrayApp::Enums;
+
+DeviceCache::DeviceCache()
+    : m_settings(QSettings::IniFormat, QSettings::UserScope, "AirPodsTrayApp", "devices")
+{
+}
+
+std::optional<DeviceCache::Entry> DeviceCache::load(const QString &address) const
+{
+    if (!m_settings.contains(key(address, "model")))
+    {
+        return std::nullopt;
+    }
+
+    Entry entry;
+    entry.metadataPacket = m_settings.value(key(address, "metadata")).toByteArray();
+    entry.batteryPacket = m_settings.value(key(address, "battery")).toByteArray();
+    entry.model = static_cast<AirPodsModel>(m_settings.value(key(address, "model")).toInt());
+
+    // Ear detection is packed as primary << 8 | secondary
+    bool ok = false;
+    uint earDetection = m_settings.value(key(address, "earDetection")).toUInt(&ok);
+    if (ok)
+    {
+        entry.earDetection.primary = static_cast<EarState>(earDetection >> 8);
+        entry.earDetection.secondary = static_cast<EarState>(earDetection & 0xFF);
+    }
+
+    int mode = m_settings.value(key(address, "noiseControlMode")).toInt(&ok);
+    if (ok && mode >= static_cast<int>(NoiseControlMode::MinValue) && mode <= static_cast<int>(NoiseControlMode::MaxValue))
+    {
+        entry.noiseControlMode = static_cast<NoiseControlMode>(mode);
+    }
+    entry.serialHandshake = m_settings.value(key(address, "serialHandshake"), false).toBool();
+    return entry;
+}
+
+void DeviceCache::storeMetadata(const QString &address, QByteArrayView packet, AirPodsModel model)
+{
+    store(address, "metadata", packet.toByteArray());
+    store(address, "model", static_cast<int>(model));
+}
+
+void DeviceCache::storeBatteryPacket(const QString &address, QByteArrayView packet)
+{
+    store(address, "battery", packet.toByteArray());
+}
+
+void DeviceCache::storeEarDetection(const QString &address, const EarDetectionState &state)
+{
+    store(address, "earDetection", (static_cast<uint>(state.primary) << 8) | static_cast<uint>(state.secondary));
+}
+
+void DeviceCache::storeNoiseControlMode(const QString &address, NoiseControlMode mode)
+{
+    store(address, "noiseControlMode", static_cast<int>(mode));
+}
+
+void DeviceCache::storeSerialHandshake(const QString &address, bool serial)
+{
+    store(address, "serialHandshake", serial);
+}
+
+QString DeviceCache::key(const QString &address, const char *name)
+{
+    // Addresses come in as either AA:BB:... or AA_BB_...
+    QString group = address.toUpper();
+    group.remove(':');
+    group.remove('_');
+    return group + '/' + QLatin1String(name);
+}
+
+void DeviceCache::store(const QString &address, const char *name, const QVariant &value)
+{
+    if (address.isEmpty())
+    {
+        return;
+    }
+
+    // QSettings writes to disk on its own schedule, skip values that didn't change
+    QString settingKey = key(address, name);
+    if (m_settings.value(settingKey) != value)
+    {
+        LOG_DEBUG("Caching " << settingKey);
+        m_settings.setValue(settingKey, value);
+    }
+}
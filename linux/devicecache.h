@@ -0,0 +1,49 @@
+#ifndef DEVICECACHE_H
+#define DEVICECACHE_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QSettings>
+#include <QString>
+#include <QVariant>
+#include <optional>
+
+#include "deviceevents.h"
+#include "enums.h"
+
+// Last known state of each AirPods, keyed by MAC address, so the UI can be
+// filled in as soon as the device shows up instead of after the handshake.
+//
+// Metadata and battery are kept as the raw packets they came from and go
+// through the regular parsers again when restored.
+class DeviceCache
+{
+public:
+    struct Entry
+    {
+        QByteArray metadataPacket;
+        QByteArray batteryPacket;
+        AirpodsTrayApp::Enums::AirPodsModel model = AirpodsTrayApp::Enums::AirPodsModel::Unknown;
+        AirpodsTrayApp::EarDetectionState earDetection;
+        std::optional<AirpodsTrayApp::Enums::NoiseControlMode> noiseControlMode;
+        bool serialHandshake = false; // Did not take the pipelined handshake
+    };
+
+    DeviceCache();
+
+    std::optional<Entry> load(const QString &address) const;
+
+    void storeMetadata(const QString &address, QByteArrayView packet, AirpodsTrayApp::Enums::AirPodsModel model);
+    void storeBatteryPacket(const QString &address, QByteArrayView packet);
+    void storeEarDetection(const QString &address, const AirpodsTrayApp::EarDetectionState &state);
+    void storeNoiseControlMode(const QString &address, AirpodsTrayApp::Enums::NoiseControlMode mode);
+    void storeSerialHandshake(const QString &address, bool serial);
+
+private:
+    static QString key(const QString &address, const char *name);
+    void store(const QString &address, const char *name, const QVariant &value);
+
+    QSettings m_settings;
+};
+
+#endif // DEVICECACHE_H
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <QByteArray>
+#include <QMetaType>
+#include <QString>
+#include <cstring>
+
+#include "enums.h"
+
+// Decoded device state passed around in signals. Display strings are only
+// built when something asks for them.
+namespace AirpodsTrayApp
+{
+    struct EarDetectionState
+    {
+        Enums::EarState primary = Enums::EarState::Unknown;
+        Enums::EarState secondary = Enums::EarState::Unknown;
+
+        static Enums::EarState fromByte(quint8 value)
+        {
+            switch (value)
+            {
+            case 0x00:
+                return Enums::EarState::InEar;
+            case 0x01:
+                return Enums::EarState::OutOfEar;
+            default:
+                return Enums::EarState::InCase;
+            }
+        }
+
+        bool isPrimaryInEar() const { return primary == Enums::EarState::InEar; }
+        bool isSecondaryInEar() const { return secondary == Enums::EarState::InEar; }
+        bool isAnyInCase() const { return primary == Enums::EarState::InCase || secondary == Enums::EarState::InCase; }
+        bool isEmpty() const { return primary == Enums::EarState::Unknown && secondary == Enums::EarState::Unknown; }
+
+        static QString toString(Enums::EarState state)
+        {
+            switch (state)
+            {
+            case Enums::EarState::InEar:
+                return "In Ear";
+            case Enums::EarState::OutOfEar:
+                return "Out of Ear";
+            case Enums::EarState::InCase:
+                return "In case";
+            default:
+                return "Unknown";
+            }
+        }
+
+        QString toString() const
+        {
+            if (isEmpty())
+            {
+                return QString();
+            }
+            return QString("Primary: %1, Secondary: %2").arg(toString(primary), toString(secondary));
+        }
+
+        bool operator==(const EarDetectionState &other) const { return primary == other.primary && secondary == other.secondary; }
+        bool operator!=(const EarDetectionState &other) const { return !(*this == other); }
+    };
+
+    struct BatteryLevels
+    {
+        quint8 left = 0;
+        quint8 right = 0;
+        quint8 caseLevel = 0;
+        bool leftCharging = false;
+        bool rightCharging = false;
+        bool caseCharging = false;
+        bool leftAvailable = false;
+        bool rightAvailable = false;
+        bool caseAvailable = false;
+        // Over-ear models report one battery instead of pods and case
+        quint8 single = 0;
+        bool singleCharging = false;
+        bool singleAvailable = false;
+
+        bool isEmpty() const { return *this == BatteryLevels(); }
+
+        QString toString() const
+        {
+            if (isEmpty())
+            {
+                return QString();
+            }
+            if (singleAvailable && !leftAvailable && !rightAvailable)
+            {
+                return QString("%1%").arg(single);
+            }
+            return QString("Left: %1%, Right: %2%, Case: %3%").arg(left).arg(right).arg(caseLevel);
+        }
+
+        bool operator==(const BatteryLevels &other) const
+        {
+            return left == other.left && right == other.right && caseLevel == other.caseLevel
+                && leftCharging == other.leftCharging && rightCharging == other.rightCharging
+                && caseCharging == other.caseCharging && leftAvailable == other.leftAvailable
+                && rightAvailable == other.rightAvailable && caseAvailable == other.caseAvailable
+                && single == other.single && singleCharging == other.singleCharging
+                && singleAvailable == other.singleAvailable;
+        }
+        bool operator!=(const BatteryLevels &other) const { return !(*this == other); }
+    };
+
+    // Everything known about one pair at one moment, copied out of
+    // AirPodsSession::snapshot() on any thread. Plain bytes only, so it can
+    // be published through a SeqLock.
+    struct DeviceSnapshot
+    {
+        quint64 version = 0; // Bumped on every change, 0 before the first
+        bool connected = false;
+        bool ready = false;
+        BatteryLevels battery;
+        EarDetectionState earDetection;
+        bool leftInEar = false; // Ear detection mapped to sides with the primary pod
+        bool rightInEar = false;
+        Enums::NoiseControlMode noiseControlMode = Enums::NoiseControlMode::Off;
+        bool conversationalAwareness = false;
+        quint8 adaptiveNoiseLevel = 50;
+        Enums::AirPodsModel model = Enums::AirPodsModel::Unknown;
+        char name[64] = {}; // UTF-8, cut at a character boundary if longer
+
+        QString deviceName() const { return QString::fromUtf8(name, qstrnlen(name, sizeof(name))); }
+        void setDeviceName(const QString &deviceName)
+        {
+            QByteArray utf8 = deviceName.toUtf8();
+            qsizetype length = qMin<qsizetype>(utf8.size(), sizeof(name) - 1);
+            // Don't leave half of a multibyte character behind
+            while (length > 0 && length < utf8.size() && (quint8(utf8[length]) & 0xC0) == 0x80)
+            {
+                --length;
+            }
+            std::memcpy(name, utf8.constData(), length);
+            name[length] = '\0';
+        }
+    };
+}
+
+Q_DECLARE_METATYPE(AirpodsTrayApp::EarDetectionState)
+Q_DECLARE_METATYPE(AirpodsTrayApp::BatteryLevels)
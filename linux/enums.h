@@ -1,7 +1,9 @@
 #pragma once
 
 #include <QMetaType>
-#include <QHash>
+#include <QByteArrayView>
+#include <QPair>
+#include <QString>
 
 namespace AirpodsTrayApp
 {
@@ -21,6 +23,16 @@ namespace AirpodsTrayApp
         };
         Q_ENUM_NS(NoiseControlMode)
 
+        // Pod status reported in ear detection packets
+        enum class EarState : quint8
+        {
+            InEar = 0x00,
+            OutOfEar = 0x01,
+            InCase = 0x02,
+            Unknown = 0xFF, // Nothing received yet
+        };
+        Q_ENUM_NS(EarState)
+
         enum class AirPodsModel
         {
             Unknown,
@@ -38,10 +50,16 @@ namespace AirpodsTrayApp
         Q_ENUM_NS(AirPodsModel)
 
         // Get model enum from model number
-        inline AirPodsModel parseModelNumber(const QString &modelNumber)
+        inline AirPodsModel parseModelNumber(QByteArrayView modelNumber)
         {
+            struct ModelNumber
+            {
+                const char *number;
+                AirPodsModel model;
+            };
+
             // Model numbers taken from https://support.apple.com/en-us/109525
-            QHash<QString, AirPodsModel> modelNumberMap = {
+            static constexpr ModelNumber modelNumbers[] = {
                 {"A1523", AirPodsModel::AirPods1},
                 {"A1722", AirPodsModel::AirPods1},
                 {"A2032", AirPodsModel::AirPods2},
@@ -65,7 +83,14 @@ namespace AirpodsTrayApp
                 {"A3055", AirPodsModel::AirPods4ANC},
                 {"A3057", AirPodsModel::AirPods4ANC}};
 
-            return modelNumberMap.value(modelNumber, AirPodsModel::Unknown);
+            for (const ModelNumber &entry : modelNumbers)
+            {
+                if (modelNumber == QByteArrayView(entry.number))
+                {
+                    return entry.model;
+                }
+            }
+            return AirPodsModel::Unknown;
         }
 
         // Return icons based on model
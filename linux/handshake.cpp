@@ -0,0 +1,149 @@
+#include "handshake.h"
+#include "airpods_packets.h"
+#include "logger.h"
+
+#include <QTimer>
+#include <algorithm>
+
+namespace
+{
+    constexpr int RoundTrips = 4;      // Handshake round trips to wait before resending
+    constexpr int MinTimeoutMs = 250;
+    constexpr int MaxTimeoutMs = 2000; // What the fixed retry used to wait
+    constexpr int MaxResends = 3;      // Per phase, the connection's own timeout takes it from there
+}
+
+Handshake::Handshake(Sender sender, QObject *parent)
+    : QObject(parent)
+    , m_send(std::move(sender))
+    , m_timer(new QTimer(this))
+{
+    m_timer->setSingleShot(true);
+    connect(m_timer, &QTimer::timeout, this, &Handshake::onTimeout);
+}
+
+void Handshake::start()
+{
+    m_timer->stop();
+    m_timings = Timings();
+    m_timings.pipelined = m_pipelined;
+    m_elapsed.start();
+
+    // No timeout for the handshake itself, a device that never answers it is the connection's problem
+    m_phase = Phase::HandshakeAck;
+    m_attempts = 0;
+    send(Phase::HandshakeAck);
+    if (m_pipelined)
+    {
+        send(Phase::FeaturesAck);
+        send(Phase::Notifications);
+    }
+}
+
+void Handshake::stop()
+{
+    m_timer->stop();
+    m_phase = Phase::Idle;
+}
+
+void Handshake::handshakeAcked()
+{
+    if (m_phase != Phase::HandshakeAck)
+    {
+        return;
+    }
+    m_timings.handshakeAckMs = elapsedMs();
+    if (!m_pipelined)
+    {
+        send(Phase::FeaturesAck);
+    }
+    expect(Phase::FeaturesAck);
+}
+
+void Handshake::featuresAcked()
+{
+    if (m_phase != Phase::FeaturesAck)
+    {
+        return;
+    }
+    m_timings.featuresAckMs = elapsedMs();
+    if (!m_pipelined)
+    {
+        send(Phase::Notifications);
+    }
+    expect(Phase::Notifications);
+}
+
+void Handshake::notificationReceived()
+{
+    if (m_phase == Phase::Idle || m_phase == Phase::Done)
+    {
+        return;
+    }
+    m_timer->stop();
+    m_phase = Phase::Done;
+    m_timings.readyMs = elapsedMs();
+    LOG_INFO("Handshake done after " << m_timings.readyMs << " ms (" << (m_timings.pipelined ? "pipelined" : "serial")
+             << "), acks after " << m_timings.handshakeAckMs << " and " << m_timings.featuresAckMs << " ms, "
+             << m_timings.resends << " resends");
+}
+
+void Handshake::send(Phase phase)
+{
+    using namespace AirPodsPackets::Connection;
+    switch (phase)
+    {
+    case Phase::HandshakeAck:
+        m_send(HANDSHAKE, "Handshake packet written:");
+        break;
+    case Phase::FeaturesAck:
+        m_send(SET_SPECIFIC_FEATURES, "Set specific features packet written:");
+        break;
+    case Phase::Notifications:
+        m_send(REQUEST_NOTIFICATIONS, "Request notifications packet written:");
+        break;
+    default:
+        break;
+    }
+}
+
+void Handshake::expect(Phase phase)
+{
+    m_phase = phase;
+    m_attempts = 0;
+    m_timer->start(timeoutMs());
+}
+
+void Handshake::onTimeout()
+{
+    if (m_phase != Phase::FeaturesAck && m_phase != Phase::Notifications)
+    {
+        return;
+    }
+    if (m_attempts >= MaxResends)
+    {
+        LOG_WARN("AirPods still silent after " << m_attempts << " resends, waiting for " << m_phase);
+        return;
+    }
+
+    if (m_phase == Phase::FeaturesAck && m_pipelined)
+    {
+        LOG_WARN("AirPods ignored the pipelined handshake, continuing one packet at a time");
+        m_pipelined = false;
+        m_timings.pipelined = false;
+        emit fellBack();
+    }
+    ++m_attempts;
+    ++m_timings.resends;
+    send(m_phase);
+    m_timer->start(timeoutMs());
+}
+
+int Handshake::timeoutMs() const
+{
+    // The handshake ack gives the first round trip
+    qint64 timeout = m_timings.handshakeAckMs >= 0 ? RoundTrips * m_timings.handshakeAckMs : MaxTimeoutMs;
+    timeout = std::clamp<qint64>(timeout, MinTimeoutMs, MaxTimeoutMs);
+    // Backs off while the AirPods stay silent
+    return int(std::min<qint64>(timeout << m_attempts, MaxTimeoutMs));
+}
@@ -0,0 +1,87 @@
+#ifndef HANDSHAKE_H
+#define HANDSHAKE_H
+
+#include <QByteArrayView>
+#include <QElapsedTimer>
+#include <QObject>
+#include <functional>
+
+class QTimer;
+
+// Takes a freshly connected transport to the point where the AirPods send
+// notifications: HANDSHAKE, SET_SPECIFIC_FEATURES and REQUEST_NOTIFICATIONS.
+//
+// Pipelined, all three go out at once and the AirPods answer them within a
+// single round trip. Firmware that drops what arrives while it is still
+// busy with the handshake shows up as a missing features ack; the handshake
+// then falls back to sending each packet once the previous one was
+// acknowledged, and stays serial until setPipelined(true).
+//
+// Resends wait a few handshake round trips, not a fixed time, so a quick
+// device is asked again quickly and a slow one isn't flooded.
+class Handshake : public QObject
+{
+    Q_OBJECT
+public:
+    // What the handshake waits for
+    enum class Phase
+    {
+        Idle,
+        HandshakeAck,
+        FeaturesAck,
+        Notifications,
+        Done
+    };
+    Q_ENUM(Phase)
+
+    // Milliseconds since start(), -1 until reached
+    struct Timings
+    {
+        qint64 handshakeAckMs = -1;
+        qint64 featuresAckMs = -1;
+        qint64 readyMs = -1; // First battery notification
+        bool pipelined = false; // Still pipelined when done, false after a fallback
+        int resends = 0;
+    };
+
+    // logTag is a string literal, see LOG_PACKET
+    using Sender = std::function<bool(QByteArrayView packet, const char *logTag)>;
+
+    explicit Handshake(Sender sender, QObject *parent = nullptr);
+
+    void setPipelined(bool pipelined) { m_pipelined = pipelined; }
+    bool isPipelined() const { return m_pipelined; }
+
+    // The transport just connected
+    void start();
+    // The transport is gone, the timings of the last run stay available
+    void stop();
+
+    void handshakeAcked();
+    void featuresAcked();
+    void notificationReceived();
+
+    Phase phase() const { return m_phase; }
+    const Timings &timings() const { return m_timings; }
+
+signals:
+    // The AirPods did not take the pipelined handshake, later ones are serial
+    void fellBack();
+
+private:
+    void send(Phase phase);
+    void expect(Phase phase);
+    void onTimeout();
+    int timeoutMs() const;
+    qint64 elapsedMs() const { return m_elapsed.elapsed(); }
+
+    Sender m_send;
+    bool m_pipelined = true;
+    Phase m_phase = Phase::Idle;
+    int m_attempts = 0; // Resends in the current phase
+    QElapsedTimer m_elapsed;
+    QTimer *m_timer;
+    Timings m_timings;
+};
+
+#endif // HANDSHAKE_H
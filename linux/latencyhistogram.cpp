@@ -0,0 +1,91 @@
+#include "latencyhistogram.h"
+
+#include <QtAlgorithms>
+#include <cmath>
+
+int LatencyHistogram::bucketOf(qint64 us)
+{
+    if (us < SubBuckets)
+    {
+        return us < 0 ? 0 : int(us);
+    }
+    // Position of the highest bit picks the magnitude, the next four bits the bucket in it
+    const int exponent = 63 - qCountLeadingZeroBits(quint64(us));
+    const int magnitude = exponent - SubBucketBits;
+    if (magnitude >= Magnitudes)
+    {
+        return BucketCount - 1;
+    }
+    const int sub = int(us >> magnitude) & (SubBuckets - 1);
+    return SubBuckets + magnitude * SubBuckets + sub;
+}
+
+qint64 LatencyHistogram::upperEdge(int bucket)
+{
+    if (bucket < SubBuckets)
+    {
+        return bucket;
+    }
+    const int magnitude = (bucket - SubBuckets) / SubBuckets;
+    const int sub = (bucket - SubBuckets) % SubBuckets;
+    return ((qint64(SubBuckets + sub + 1)) << magnitude) - 1;
+}
+
+void LatencyHistogram::record(qint64 us)
+{
+    m_buckets[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(us, std::memory_order_relaxed);
+    qint64 max = m_max.load(std::memory_order_relaxed);
+    while (us > max && !m_max.compare_exchange_weak(max, us, std::memory_order_relaxed))
+    {
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for (std::atomic<quint32> &bucket : m_buckets)
+    {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+qint64 LatencyHistogram::mean() const
+{
+    const quint64 samples = count();
+    return samples ? m_sum.load(std::memory_order_relaxed) / qint64(samples) : 0;
+}
+
+qint64 LatencyHistogram::percentile(double fraction) const
+{
+    const quint64 samples = count();
+    if (samples == 0)
+    {
+        return 0;
+    }
+    const quint64 rank = qMax<quint64>(1, quint64(std::ceil(fraction * samples)));
+    quint64 seen = 0;
+    for (int bucket = 0; bucket < BucketCount; ++bucket)
+    {
+        seen += m_buckets[bucket].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            // Never above the largest sample actually seen
+            return qMin(upperEdge(bucket), max());
+        }
+    }
+    return max();
+}
+
+quint64 LatencyHistogram::countAbove(qint64 us) const
+{
+    quint64 above = 0;
+    for (int bucket = bucketOf(us) + 1; bucket < BucketCount; ++bucket)
+    {
+        above += m_buckets[bucket].load(std::memory_order_relaxed);
+    }
+    return above;
+}
@@ -0,0 +1,43 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QtGlobal>
+#include <array>
+#include <atomic>
+
+// Fixed-bucket latency histogram in microseconds, HDR style: every power of
+// two is split into 16 linear buckets, so a reported value is at most 6.25%
+// above the real one, from 1 us up to several hours.
+//
+// record() is a couple of relaxed atomic adds and can run on any thread
+// while another one reads the percentiles.
+class LatencyHistogram
+{
+public:
+    void record(qint64 us);
+    void reset();
+
+    quint64 count() const { return m_count.load(std::memory_order_relaxed); }
+    qint64 max() const { return m_max.load(std::memory_order_relaxed); }
+    qint64 mean() const;
+    // Upper edge of the bucket holding the value at fraction of the samples, 0 while empty
+    qint64 percentile(double fraction) const;
+    // Samples above us, rounded to the bucket us falls into
+    quint64 countAbove(qint64 us) const;
+
+private:
+    static constexpr int SubBuckets = 16;
+    static constexpr int SubBucketBits = 4;
+    static constexpr int Magnitudes = 32;
+    static constexpr int BucketCount = SubBuckets + Magnitudes * SubBuckets;
+
+    static int bucketOf(qint64 us);
+    static qint64 upperEdge(int bucket);
+
+    std::array<std::atomic<quint32>, BucketCount> m_buckets{};
+    std::atomic<quint64> m_count{0};
+    std::atomic<qint64> m_sum{0};
+    std::atomic<qint64> m_max{0};
+};
+
+#endif // LATENCYHISTOGRAM_H
@@ -3,9 +3,25 @@
 #include <QDebug>
 #include <QLoggingCategory>
 
+#include "asynclogger.h"
+
 Q_DECLARE_LOGGING_CATEGORY(airpodsApp)
 
-#define LOG_INFO(msg) qCInfo(airpodsApp) << "\033[32m" << msg << "\033[0m"
-#define LOG_WARN(msg) qCWarning(airpodsApp) << "\033[33m" << msg << "\033[0m"
-#define LOG_ERROR(msg) qCCritical(airpodsApp) << "\033[31m" << msg << "\033[0m"
-#define LOG_DEBUG(msg) qCDebug(airpodsApp) << "\033[34m" << msg << "\033[0m"
+// Only the raw arguments are recorded here, AsyncLogger's thread formats
+// them. Every message goes to the flight recorder, printed only decides
+// whether it also goes to stderr. Wrap bytes in AsyncLogger::hex() instead
+// of calling toHex().
+#define LOG_AT(level, printed, msg)                     \
+    do                                                  \
+    {                                                   \
+        AsyncLogger::Message(level, printed) << msg;    \
+    } while (false)
+
+#define LOG_INFO(msg) LOG_AT(AsyncLogger::Level::Info, airpodsApp().isInfoEnabled(), msg)
+#define LOG_WARN(msg) LOG_AT(AsyncLogger::Level::Warning, airpodsApp().isWarningEnabled(), msg)
+#define LOG_ERROR(msg) LOG_AT(AsyncLogger::Level::Error, airpodsApp().isCriticalEnabled(), msg)
+#define LOG_DEBUG(msg) LOG_AT(AsyncLogger::Level::Debug, airpodsApp().isDebugEnabled(), msg)
+
+// Raw bytes for the flight recorder, printed as hex with --debug like
+// LOG_DEBUG text. tag has to be a string literal, only the pointer is kept.
+#define LOG_PACKET(tag, bytes) AsyncLogger::packet(tag, bytes, airpodsApp().isDebugEnabled())
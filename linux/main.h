@@ -7,9 +7,6 @@
 #include <QMenu>
 #include <QAction>
 #include <QActionGroup>
-#include <QBluetoothDeviceDiscoveryAgent>
-#include <QBluetoothLocalDevice>
-#include <QBluetoothSocket>
 #include <QQuickWindow>
 #include <QDebug>
 #include <QInputDialog>
@@ -19,16 +16,11 @@
 #include <QTimer>
 #include <QPainter>
 #include <QPalette>
-#include <QDBusInterface>
-#include <QDBusReply>
-#include <QDBusConnectionInterface>
-#include <QProcess>
 #include <QRegularExpression>
 #include <QFile>
 #include <QTextStream>
 #include <QStandardPaths>
-
-#define PHONE_MAC_ADDRESS "22:22:F5:BB:1C:A0"
+#include <QVarLengthArray>
 
 #define MANUFACTURER_ID 0x1234
 #define MANUFACTURER_DATA "ALN_AirPods"
@@ -1,60 +1,53 @@
 #include "mediacontroller.h"
+#include "airpods_packets.h"
+#include "audiobackend.h"
 #include "logger.h"
+#include "metrics.h"
+#include "mprisclient.h"
+#include "pulseaudiobackend.h"
+#include "reactionlatency.h"
+#include "volumeducker.h"
 
 #include <QDebug>
-#include <QProcess>
-#include <QRegularExpression>
-#include <QDBusConnection>
-#include <QDBusConnectionInterface>
 
 MediaController::MediaController(QObject *parent) : QObject(parent) {
   // No additional initialization required here
 }
 
 void MediaController::initializeMprisInterface() {
-  QStringList services =
-      QDBusConnection::sessionBus().interface()->registeredServiceNames();
-  QString mprisService;
-
-  for (const QString &service : services) {
-    if (service.startsWith("org.mpris.MediaPlayer2.") &&
-        service != "org.mpris.MediaPlayer2") {
-      mprisService = service;
-      break;
+  mpris = new MprisClient(this);
+  // A pause is done once the player says so
+  connect(mpris, &MprisClient::statusChanged, this, [](MprisClient::PlaybackStatus status) {
+    if (status != MprisClient::PlaybackStatus::Playing) {
+      ReactionLatency::finish(ReactionLatency::Reaction::EarDetectionPause);
     }
-  }
+  });
+  mpris->start();
+}
 
-  if (!mprisService.isEmpty()) {
-    mprisInterface = new QDBusInterface(mprisService, "/org/mpris/MediaPlayer2",
-                                        "org.mpris.MediaPlayer2.Player",
-                                        QDBusConnection::sessionBus(), this);
-    if (!mprisInterface->isValid()) {
-      LOG_ERROR("Failed to initialize MPRIS interface for service: ") << mprisService;
-    } else {
-      LOG_INFO("Connected to MPRIS service: " << mprisService);
-    }
-  } else {
-    LOG_WARN("No active MPRIS media players found");
+void MediaController::initializeAudioBackend(AudioBackend *backend) {
+  delete audio;
+  audio = backend ? backend : new PulseAudioBackend();
+  audio->setParent(this);
+  delete ducker;
+  ducker = new VolumeDucker(audio, this);
+  if (!audio->start()) {
+    LOG_ERROR("Failed to start audio backend, audio output will not follow the AirPods");
   }
 }
 
-void MediaController::handleEarDetection(const QString &status)
+void MediaController::handleEarDetection(const AirpodsTrayApp::EarDetectionState &state)
 {
+  ReactionLatency::mark(ReactionLatency::Reaction::EarDetectionPause, ReactionLatency::Stage::Dispatch);
   if (earDetectionBehavior == Disabled)
   {
+    ReactionLatency::cancel(ReactionLatency::Reaction::EarDetectionPause);
     LOG_DEBUG("Ear detection is disabled, ignoring status");
     return;
   }
 
-  bool primaryInEar = false;
-  bool secondaryInEar = false;
-
-  QStringList parts = status.split(", ");
-  if (parts.size() == 2)
-  {
-    primaryInEar = parts[0].contains("In Ear");
-    secondaryInEar = parts[1].contains("In Ear");
-  }
+  bool primaryInEar = state.isPrimaryInEar();
+  bool secondaryInEar = state.isSecondaryInEar();
 
   LOG_DEBUG("Ear detection status: primaryInEar="
             << primaryInEar << ", secondaryInEar=" << secondaryInEar
@@ -75,18 +68,13 @@ void MediaController::handleEarDetection(const QString &status)
     shouldResume = primaryInEar || secondaryInEar;
   }
 
-  if (shouldPause && isActiveOutputDeviceAirPods())
+  if (shouldPause && isActiveOutputDeviceAirPods() && mpris && mpris->isPlaying())
   {
-    QProcess process;
-    process.start("playerctl", QStringList() << "status");
-    process.waitForFinished();
-    QString playbackStatus = process.readAllStandardOutput().trimmed();
-    LOG_DEBUG("Playback status: " << playbackStatus);
-    if (playbackStatus == "Playing")
-    {
-      pause();
-    }
+    ReactionLatency::mark(ReactionLatency::Reaction::EarDetectionPause, ReactionLatency::Stage::MediaQuery);
+    pause();
   }
+  // Unless a pause went out there is nothing to wait for
+  ReactionLatency::cancel(ReactionLatency::Reaction::EarDetectionPause);
 
   // Then handle device profile switching
   if (primaryInEar || secondaryInEar)
@@ -95,19 +83,14 @@ void MediaController::handleEarDetection(const QString &status)
     activateA2dpProfile();
 
     // Resume if conditions are met and we previously paused
-    if (shouldResume && wasPausedByApp && isActiveOutputDeviceAirPods())
+    if (shouldResume && wasPausedByApp && mpris && isActiveOutputDeviceAirPods())
     {
-      int result = QProcess::execute("playerctl", QStringList() << "play");
-      LOG_DEBUG("Executed 'playerctl play' with result: " << result);
-      if (result == 0)
-      {
-        LOG_INFO("Resumed playback via Playerctl");
-        wasPausedByApp = false;
-      }
-      else
-      {
-        LOG_ERROR("Failed to resume playback via Playerctl");
+      int resumed = mpris->resume();
+      if (resumed > 0) {
+        Metrics::add(Metrics::Counter::MediaResumes);
       }
+      LOG_INFO("Resumed playback on " << resumed << " player(s)");
+      wasPausedByApp = false;
     }
   }
   else
@@ -124,79 +107,80 @@ void MediaController::setEarDetectionBehavior(EarDetectionBehavior behavior)
 }
 
 void MediaController::followMediaChanges() {
-  playerctlProcess = new QProcess(this);
-  connect(playerctlProcess, &QProcess::readyReadStandardOutput, this,
-          [this]() {
-            QString output =
-                playerctlProcess->readAllStandardOutput().trimmed();
-            LOG_DEBUG("Playerctl output: " << output);
-            MediaState state = mediaStateFromPlayerctlOutput(output);
-            emit mediaStateChanged(state);
+  connect(mpris, &MprisClient::statusChanged, this,
+          [this](MprisClient::PlaybackStatus status) {
+            LOG_DEBUG("Playback status: " << status);
+            switch (status) {
+            case MprisClient::PlaybackStatus::Playing:
+              emit mediaStateChanged(MediaState::Playing);
+              break;
+            case MprisClient::PlaybackStatus::Paused:
+              emit mediaStateChanged(MediaState::Paused);
+              break;
+            default:
+              emit mediaStateChanged(MediaState::Stopped);
+              break;
+            }
           });
-  playerctlProcess->start("playerctl", QStringList() << "--follow" << "status");
 }
 
-bool MediaController::isActiveOutputDeviceAirPods() {
-  QProcess process;
-  process.start("pactl", QStringList() << "get-default-sink");
-  process.waitForFinished();
-  QString output = process.readAllStandardOutput().trimmed();
-  LOG_DEBUG("Default sink: " << output);
-  return output.contains(connectedDeviceMacAddress);
+bool MediaController::isActiveOutputDeviceAirPods() const {
+  // Answered from the cache the backend keeps up to date, no round trip to the server
+  if (!audio || connectedDeviceMacAddress.isEmpty()) {
+    return false;
+  }
+  return audio->defaultSinkName().contains(connectedDeviceMacAddress);
 }
 
-void MediaController::handleConversationalAwareness(const QByteArray &data) {
-  LOG_DEBUG("Handling conversational awareness data: " << data.toHex());
-  bool lowered = data[9] == 0x01;
-  LOG_INFO("Conversational awareness: " << (lowered ? "enabled" : "disabled"));
-
-  if (lowered) {
-    if (initialVolume == -1 && isActiveOutputDeviceAirPods()) {
-      QProcess process;
-      process.start("pactl", QStringList()
-                                 << "get-sink-volume" << "@DEFAULT_SINK@");
-      process.waitForFinished();
-      QString output = process.readAllStandardOutput();
-      QRegularExpression re("front-left: \\d+ /\\s*(\\d+)%");
-      QRegularExpressionMatch match = re.match(output);
-      if (match.hasMatch()) {
-        LOG_DEBUG("Matched: " << match.captured(1));
-        initialVolume = match.captured(1).toInt();
-      } else {
-        LOG_ERROR("Failed to parse initial volume from output: " << output);
-        return;
-      }
-    }
-    QProcess::execute(
-        "pactl", QStringList() << "set-sink-volume" << "@DEFAULT_SINK@"
-                               << QString::number(initialVolume * 0.20) + "%");
-    LOG_INFO("Volume lowered to 0.20 of initial which is "
-             << initialVolume * 0.20 << "%");
-  } else {
-    if (initialVolume != -1 && isActiveOutputDeviceAirPods()) {
-      QProcess::execute("pactl", QStringList()
-                                     << "set-sink-volume" << "@DEFAULT_SINK@"
-                                     << QString::number(initialVolume) + "%");
-      LOG_INFO("Volume restored to " << initialVolume << "%");
-      initialVolume = -1;
+void MediaController::handleConversationalAwareness(QByteArrayView data) {
+  const auto reaction = ReactionLatency::Reaction::ConversationalAwarenessDuck;
+  ReactionLatency::mark(reaction, ReactionLatency::Stage::Dispatch);
+  LOG_PACKET("Handling conversational awareness data:", data);
+  if (!ducker || data.size() <= AirPodsPackets::ConversationalAwareness::LEVEL_OFFSET) {
+    ReactionLatency::cancel(reaction);
+    return;
+  }
+  quint8 level = static_cast<quint8>(data[AirPodsPackets::ConversationalAwareness::LEVEL_OFFSET]);
+  LOG_DEBUG("Conversational awareness level: " << level);
+
+  // Only start ducking when the AirPods play the audio, a duck in progress always follows the level
+  const bool wasDucked = ducker->isDucked();
+  if (!wasDucked) {
+    if (!isActiveOutputDeviceAirPods()) {
+      ReactionLatency::cancel(reaction);
+      return;
     }
+    ReactionLatency::mark(reaction, ReactionLatency::Stage::MediaQuery);
+  }
+  ducker->handleSpeechLevel(audio->defaultSinkName(), level);
+  // Only the start of a duck is measured, the volume then follows the ramp
+  if (wasDucked || !ducker->isDucked()) {
+    ReactionLatency::cancel(reaction);
   }
 }
 
+QString MediaController::cardName() const {
+  return "bluez_card." + connectedDeviceMacAddress;
+}
+
 void MediaController::activateA2dpProfile() {
   if (connectedDeviceMacAddress.isEmpty()) {
     LOG_WARN("Connected device MAC address is empty, cannot activate A2DP profile");
     return;
   }
+  if (!audio) {
+    return;
+  }
 
-  LOG_INFO("Activating A2DP profile for AirPods");
-  int result = QProcess::execute(
-      "pactl", QStringList()
-                   << "set-card-profile"
-                   << "bluez_card." + connectedDeviceMacAddress << "a2dp-sink");
-  if (result != 0) {
-    LOG_ERROR("Failed to activate A2DP profile");
+  // Ear detection calls this on every change, only ask the server when the profile differs
+  const AudioBackend::Card *card = audio->findCard(cardName());
+  if (card && card->activeProfile == "a2dp-sink") {
+    return;
   }
+
+  LOG_INFO("Activating A2DP profile for AirPods");
+  audio->setCardProfile(cardName(), "a2dp-sink");
+  Metrics::add(Metrics::Counter::AudioProfileSwitches);
 }
 
 void MediaController::removeAudioOutputDevice() {
@@ -204,52 +188,38 @@ void MediaController::removeAudioOutputDevice() {
     LOG_WARN("Connected device MAC address is empty, cannot remove audio output device");
     return;
   }
-  
-  LOG_INFO("Removing AirPods as audio output device");
-  int result = QProcess::execute(
-      "pactl", QStringList()
-                   << "set-card-profile"
-                   << "bluez_card." + connectedDeviceMacAddress << "off");
-  if (result != 0) {
-    LOG_ERROR("Failed to remove AirPods as audio output device");
+  if (!audio) {
+    return;
   }
-}
 
-void MediaController::setConnectedDeviceMacAddress(const QString &macAddress) {
-  connectedDeviceMacAddress = macAddress;
+  const AudioBackend::Card *card = audio->findCard(cardName());
+  if (card && card->activeProfile == "off") {
+    return;
+  }
+
+  LOG_INFO("Removing AirPods as audio output device");
+  audio->setCardProfile(cardName(), "off");
+  Metrics::add(Metrics::Counter::AudioProfileSwitches);
 }
 
-MediaController::MediaState MediaController::mediaStateFromPlayerctlOutput(
-    const QString &output) {
-  if (output == "Playing") {
-    return MediaState::Playing;
-  } else if (output == "Paused") {
-    return MediaState::Paused;
-  } else {
-    return MediaState::Stopped;
+void MediaController::setConnectedDeviceMacAddress(const QString &macAddress) {
+  if (ducker && macAddress != connectedDeviceMacAddress) {
+    // Level packets won't come from another device, don't leave the volume lowered
+    ducker->restoreNow();
   }
+  connectedDeviceMacAddress = macAddress;
 }
 
 void MediaController::pause() {
-  int result = QProcess::execute("playerctl", QStringList() << "pause");
-  LOG_DEBUG("Executed 'playerctl pause' with result: " << result);
-  if (result == 0)
-  {
-    LOG_INFO("Paused playback via Playerctl");
-    wasPausedByApp = true;
+  if (!mpris) {
+    return;
   }
-  else
+  int paused = mpris->pause();
+  if (paused > 0)
   {
-    LOG_ERROR("Failed to pause playback via Playerctl");
+    ReactionLatency::mark(ReactionLatency::Reaction::EarDetectionPause, ReactionLatency::Stage::ActionIssued);
+    Metrics::add(Metrics::Counter::MediaPauses);
+    LOG_INFO("Paused playback on " << paused << " player(s)");
+    wasPausedByApp = true;
   }
 }
-
-MediaController::~MediaController() {
-  if (playerctlProcess) {
-    playerctlProcess->terminate();
-    if (!playerctlProcess->waitForFinished()) {
-      playerctlProcess->kill();
-      playerctlProcess->waitForFinished(1000);
-    }
-  }
-}
\ No newline at end of file
@@ -1,10 +1,14 @@
 #ifndef MEDIACONTROLLER_H
 #define MEDIACONTROLLER_H
 
-#include <QDBusInterface>
+#include <QByteArrayView>
 #include <QObject>
 
-class QProcess;
+#include "deviceevents.h"
+
+class AudioBackend;
+class MprisClient;
+class VolumeDucker;
 
 class MediaController : public QObject
 {
@@ -26,13 +30,17 @@ public:
   Q_ENUM(EarDetectionBehavior)
 
   explicit MediaController(QObject *parent = nullptr);
-  ~MediaController();
 
   void initializeMprisInterface();
-  void handleEarDetection(const QString &status);
+  // Takes ownership, uses PulseAudio if backend is null
+  void initializeAudioBackend(AudioBackend *backend = nullptr);
+  AudioBackend *audioBackend() const { return audio; }
+  void handleEarDetection(const AirpodsTrayApp::EarDetectionState &state);
   void followMediaChanges();
-  bool isActiveOutputDeviceAirPods();
-  void handleConversationalAwareness(const QByteArray &data);
+  MprisClient *mprisClient() const { return mpris; }
+  VolumeDucker *volumeDucker() const { return ducker; }
+  bool isActiveOutputDeviceAirPods() const;
+  void handleConversationalAwareness(QByteArrayView data);
   void activateA2dpProfile();
   void removeAudioOutputDevice();
   void setConnectedDeviceMacAddress(const QString &macAddress);
@@ -46,12 +54,12 @@ Q_SIGNALS:
   void mediaStateChanged(MediaState state);
 
 private:
-  MediaState mediaStateFromPlayerctlOutput(const QString &output);
+  QString cardName() const;
 
-  QDBusInterface *mprisInterface = nullptr;
-  QProcess *playerctlProcess = nullptr;
+  MprisClient *mpris = nullptr;
+  AudioBackend *audio = nullptr;
   bool wasPausedByApp = false;
-  int initialVolume = -1;
+  VolumeDucker *ducker = nullptr;
   QString connectedDeviceMacAddress;
   EarDetectionBehavior earDetectionBehavior = PauseWhenOneRemoved;
 };
@@ -0,0 +1,95 @@
+#include "metrics.h"
+
+#include <iterator>
+
+namespace
+{
+    struct CounterInfo
+    {
+        const char *family; // Counters with the same family are written together
+        const char *labels;
+        const char *help;
+    };
+
+    // In Metrics::Counter order
+    constexpr CounterInfo Counters[] = {
+        {"aln_packets_unrecognized_total", "", "Frames no handler knows"},
+        {"aln_parse_failures_total", "", "Frames a handler rejected as malformed"},
+        {"aln_framer_bytes_dropped_total", "", "Bytes thrown away because a frame did not fit the reassembly buffer"},
+        {"aln_connections_total", "outcome=\"ready\"", "Connections by outcome"},
+        {"aln_connections_total", "outcome=\"error\"", nullptr},
+        {"aln_disconnects_total", "", "AirPods disconnected"},
+        {"aln_reconnect_attempts_total", "", "Connection attempts after a failed one"},
+        {"aln_reconnects_total", "outcome=\"succeeded\"", "Retried connections by outcome"},
+        {"aln_reconnects_total", "outcome=\"failed\"", nullptr},
+        {"aln_relay_bytes_total", "direction=\"to_phone\"", "Bytes relayed between the AirPods and the phone"},
+        {"aln_relay_bytes_total", "direction=\"from_phone\"", nullptr},
+        {"aln_relay_dropped_total", "direction=\"to_phone\"", "Relayed packets that could not be delivered"},
+        {"aln_relay_dropped_total", "direction=\"to_airpods\"", nullptr},
+        {"aln_media_actions_total", "action=\"pause\"", "Media and audio actions taken"},
+        {"aln_media_actions_total", "action=\"resume\"", nullptr},
+        {"aln_media_actions_total", "action=\"duck\"", nullptr},
+        {"aln_media_actions_total", "action=\"profile_switch\"", nullptr},
+    };
+    static_assert(std::size(Counters) == int(Metrics::Counter::Count), "Every counter needs a name");
+
+    void writeHeader(QByteArray &out, const char *family, const char *help)
+    {
+        out += "# HELP ";
+        out += family;
+        out += ' ';
+        out += help;
+        out += "\n# TYPE ";
+        out += family;
+        out += " counter\n";
+    }
+
+    void writeSample(QByteArray &out, const char *family, const QByteArray &labels, quint64 value)
+    {
+        out += family;
+        if (!labels.isEmpty())
+        {
+            out += '{' + labels + '}';
+        }
+        out += ' ';
+        out += QByteArray::number(value);
+        out += '\n';
+    }
+}
+
+QByteArray Metrics::render()
+{
+    QByteArray out;
+    out.reserve(4096);
+
+    const char *families[] = {"aln_packets_received_total", "aln_packets_sent_total"};
+    for (Direction direction : {Direction::Received, Direction::Sent})
+    {
+        const char *family = families[int(direction)];
+        writeHeader(out, family, direction == Direction::Received ? "Frames received from the AirPods by opcode"
+                                                                  : "Packets written to the AirPods by opcode");
+        for (int opcode = 0; opcode <= OtherFrames; ++opcode)
+        {
+            const quint64 count = packets(direction, opcode);
+            if (count == 0)
+            {
+                continue;
+            }
+            const QByteArray label = opcode == OtherFrames
+                                         ? QByteArray("opcode=\"none\"")
+                                         : "opcode=\"0x" + QByteArray::number(opcode, 16).rightJustified(2, '0') + '"';
+            writeSample(out, family, label, count);
+        }
+    }
+
+    for (int i = 0; i < int(Counter::Count); ++i)
+    {
+        const CounterInfo &info = Counters[i];
+        if (info.help)
+        {
+            writeHeader(out, info.family, info.help);
+        }
+        writeSample(out, info.family, info.labels, value(Counter(i)));
+    }
+    return out;
+}
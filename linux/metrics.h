@@ -0,0 +1,74 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <array>
+#include <atomic>
+
+#include "airpods_packets.h"
+
+// Process-wide counters behind the metrics endpoint, in Prometheus text
+// format. Counting is a relaxed atomic add on a fixed slot, from any thread,
+// so it stays on the packet path. Gauges describing the current state are
+// added by whoever serves the text, see MetricsServer.
+class Metrics
+{
+public:
+    enum class Counter
+    {
+        PacketsUnrecognized,
+        ParseFailures,
+        FramerBytesDropped,
+        ConnectionsReady,
+        ConnectionErrors,
+        Disconnects,
+        ReconnectAttempts,
+        ReconnectsSucceeded,
+        ReconnectsFailed,
+        RelayBytesToPhone,
+        RelayBytesFromPhone,
+        RelayDroppedToPhone,
+        RelayDroppedToAirPods,
+        MediaPauses,
+        MediaResumes,
+        VolumeDucks,
+        AudioProfileSwitches,
+        Count
+    };
+
+    enum class Direction
+    {
+        Received,
+        Sent
+    };
+
+    static void add(Counter counter, quint64 value = 1)
+    {
+        s_counters[int(counter)].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    // Counted per opcode, frames without one (handshakes) under OtherFrames
+    static void countPacket(Direction direction, QByteArrayView frame)
+    {
+        using namespace AirPodsPackets;
+        const int slot = frame.size() > Frame::OPCODE_OFFSET && static_cast<quint8>(frame[0]) == Frame::TYPE_DATA
+                             ? static_cast<quint8>(frame[Frame::OPCODE_OFFSET])
+                             : OtherFrames;
+        s_packets[int(direction)][slot].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static quint64 value(Counter counter) { return s_counters[int(counter)].load(std::memory_order_relaxed); }
+    static quint64 packets(Direction direction, int opcode) { return s_packets[int(direction)][opcode].load(std::memory_order_relaxed); }
+
+    // Every counter with its HELP and TYPE lines, opcodes only once seen
+    static QByteArray render();
+
+    static constexpr int OtherFrames = 256;
+
+private:
+    static inline std::array<std::atomic<quint64>, int(Counter::Count)> s_counters{};
+    static inline std::array<std::array<std::atomic<quint64>, OtherFrames + 1>, 2> s_packets{};
+};
+
+#endif // METRICS_H
@@ -0,0 +1,185 @@
+#include "metricsserver.h"
+#include "logger.h"
+
+#include <QFile>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+    constexpr qsizetype MaxRequestSize = 4096;
+    constexpr int RequestTimeoutMs = 5000;
+}
+
+MetricsServer::MetricsServer(Renderer renderer, QObject *parent)
+    : QObject(parent), m_renderer(std::move(renderer))
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+    for (int fd : m_clients.keys())
+    {
+        dropClient(fd);
+    }
+    for (auto it = m_listeners.cbegin(); it != m_listeners.cend(); ++it)
+    {
+        delete it.value();
+        ::close(it.key());
+    }
+    if (!m_unixPath.isEmpty())
+    {
+        ::unlink(QFile::encodeName(m_unixPath).constData());
+    }
+}
+
+bool MetricsServer::listenUnix(const QString &path)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    QByteArray encoded = QFile::encodeName(path);
+    if (encoded.size() >= static_cast<qsizetype>(sizeof(address.sun_path)))
+    {
+        LOG_ERROR("Metrics socket path too long: " << path);
+        return false;
+    }
+    std::memcpy(address.sun_path, encoded.constData(), encoded.size());
+    ::unlink(encoded.constData());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && ::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    if (!startListening(fd, path))
+    {
+        return false;
+    }
+    m_unixPath = path;
+    return true;
+}
+
+bool MetricsServer::listenLoopback(quint16 port)
+{
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    if (fd >= 0 && (::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0
+                    || ::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0))
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    return startListening(fd, QString("127.0.0.1:%1").arg(port));
+}
+
+bool MetricsServer::startListening(int fd, const QString &description)
+{
+    if (fd < 0 || ::listen(fd, 8) != 0)
+    {
+        LOG_ERROR("Cannot serve metrics on " << description << ": " << std::strerror(errno));
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        return false;
+    }
+
+    auto *notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+    connect(notifier, &QSocketNotifier::activated, this, [this, fd]() { acceptClient(fd); });
+    m_listeners.insert(fd, notifier);
+    LOG_INFO("Serving metrics on " << description);
+    return true;
+}
+
+void MetricsServer::acceptClient(int listenFd)
+{
+    int fd;
+    while ((fd = ::accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        auto *notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+        connect(notifier, &QSocketNotifier::activated, this, [this, fd]() { readRequest(fd); });
+        const quint64 id = m_nextClientId++;
+        m_clients.insert(fd, Client{id, notifier, {}});
+
+        // A client that connects and never asks must not keep the socket forever
+        QTimer::singleShot(RequestTimeoutMs, this, [this, fd, id]() {
+            auto it = m_clients.constFind(fd);
+            if (it != m_clients.cend() && it->id == id)
+            {
+                dropClient(fd);
+            }
+        });
+    }
+}
+
+void MetricsServer::readRequest(int fd)
+{
+    Client &client = m_clients[fd];
+    char buffer[1024];
+    ssize_t bytesRead;
+    while ((bytesRead = ::read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        client.request.append(buffer, bytesRead);
+    }
+    if (bytesRead == 0 || (bytesRead < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        || client.request.size() > MaxRequestSize)
+    {
+        dropClient(fd);
+        return;
+    }
+    if (client.request.contains("\r\n\r\n") || client.request.contains("\n\n"))
+    {
+        respond(fd, client.request);
+        dropClient(fd);
+    }
+}
+
+void MetricsServer::respond(int fd, const QByteArray &request)
+{
+    const QList<QByteArray> requestLine = request.left(request.indexOf('\n')).trimmed().split(' ');
+    const QByteArray path = requestLine.value(1);
+    QByteArray response;
+    if (requestLine.value(0) != "GET")
+    {
+        response = "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\n\r\n";
+    }
+    else if (path != "/" && path != "/metrics")
+    {
+        response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    }
+    else
+    {
+        const QByteArray body = m_renderer();
+        response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                   + QByteArray::number(body.size()) + "\r\n\r\n" + body;
+    }
+
+    // Well below the socket buffer, a client too slow to take it in one go is not waited for
+    ssize_t written = ::send(fd, response.constData(), response.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (written != response.size())
+    {
+        LOG_WARN("Metrics response cut short, " << written << " of " << response.size() << " bytes sent");
+    }
+}
+
+void MetricsServer::dropClient(int fd)
+{
+    // Usually called from the notifier's own activation
+    Client client = m_clients.take(fd);
+    client.notifier->setEnabled(false);
+    client.notifier->deleteLater();
+    ::close(fd);
+}
@@ -0,0 +1,55 @@
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <functional>
+
+class QSocketNotifier;
+
+// Answers HTTP GET requests for the metrics text on a Unix socket or a
+// loopback TCP port, for a local Prometheus scraper or a cron job feeding
+// node_exporter's textfile collector:
+//
+//   curl --unix-socket /run/user/1000/aln-metrics.sock http://localhost/metrics
+//
+// One response per connection, built when the request arrives, so nothing
+// is rendered while nobody is asking.
+class MetricsServer : public QObject
+{
+    Q_OBJECT
+public:
+    using Renderer = std::function<QByteArray()>;
+
+    explicit MetricsServer(Renderer renderer, QObject *parent = nullptr);
+    ~MetricsServer() override;
+
+    // Replaces a stale socket file left behind by a previous run
+    bool listenUnix(const QString &path);
+    // Binds to 127.0.0.1 only
+    bool listenLoopback(quint16 port);
+
+private:
+    struct Client
+    {
+        quint64 id = 0; // fds are reused, the timeout checks this instead
+        QSocketNotifier *notifier = nullptr;
+        QByteArray request;
+    };
+
+    bool startListening(int fd, const QString &description);
+    void acceptClient(int listenFd);
+    void readRequest(int fd);
+    void respond(int fd, const QByteArray &request);
+    void dropClient(int fd);
+
+    Renderer m_renderer;
+    QHash<int, QSocketNotifier *> m_listeners; // By listening socket
+    QHash<int, Client> m_clients;              // By client socket
+    quint64 m_nextClientId = 0;
+    QString m_unixPath;
+};
+
+#endif // METRICSSERVER_H
@@ -0,0 +1,235 @@
+#include "mprisclient.h"
+#include "logger.h"
+#include "startuptimeline.h"
+
+#include <QDBusConnection>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDBusVariant>
+
+namespace
+{
+    const QString ServicePrefix = QStringLiteral("org.mpris.MediaPlayer2.");
+    const QString ObjectPath = QStringLiteral("/org/mpris/MediaPlayer2");
+    const QString PlayerInterface = QStringLiteral("org.mpris.MediaPlayer2.Player");
+    const QString PropertiesInterface = QStringLiteral("org.freedesktop.DBus.Properties");
+    const QString BusService = QStringLiteral("org.freedesktop.DBus");
+    const QString BusPath = QStringLiteral("/org/freedesktop/DBus");
+}
+
+MprisClient::MprisClient(QObject *parent) : QObject(parent)
+{
+}
+
+void MprisClient::start()
+{
+    QDBusConnection bus = QDBusConnection::sessionBus();
+    bus.connect(BusService, BusPath, BusService, "NameOwnerChanged",
+                this, SLOT(onNameOwnerChanged(QString, QString, QString)));
+    bus.connect(QString(), ObjectPath, PropertiesInterface, "PropertiesChanged",
+                this, SLOT(onPropertiesChanged(QString, QVariantMap, QStringList, QDBusMessage)));
+
+    // Players that were already running, later ones show up through NameOwnerChanged
+    QDBusMessage listNames = QDBusMessage::createMethodCall(BusService, BusPath, BusService, "ListNames");
+    auto *watcher = new QDBusPendingCallWatcher(bus.asyncCall(listNames), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this](QDBusPendingCallWatcher *call) {
+        QDBusPendingReply<QStringList> reply = *call;
+        call->deleteLater();
+        if (reply.isError())
+        {
+            LOG_ERROR("Failed to list D-Bus services: " << reply.error().message());
+            return;
+        }
+        for (const QString &name : reply.value())
+        {
+            if (name.startsWith(ServicePrefix))
+            {
+                addPlayer(name, QString());
+            }
+        }
+        StartupTimeline::mark("MPRIS players listed");
+    });
+}
+
+int MprisClient::pause()
+{
+    m_pausedByUs.clear();
+    for (auto it = m_players.cbegin(); it != m_players.cend(); ++it)
+    {
+        if (it->status == PlaybackStatus::Playing)
+        {
+            call(it.key(), "Pause");
+            m_pausedByUs.append(it.key());
+        }
+    }
+    return m_pausedByUs.size();
+}
+
+int MprisClient::resume()
+{
+    int resumed = 0;
+    for (const QString &service : std::as_const(m_pausedByUs))
+    {
+        if (m_players.contains(service))
+        {
+            call(service, "Play");
+            ++resumed;
+        }
+    }
+    m_pausedByUs.clear();
+    return resumed;
+}
+
+void MprisClient::onNameOwnerChanged(const QString &name, const QString &oldOwner, const QString &newOwner)
+{
+    if (!name.startsWith(ServicePrefix))
+    {
+        return;
+    }
+
+    if (newOwner.isEmpty())
+    {
+        removePlayer(name);
+    }
+    else if (oldOwner.isEmpty())
+    {
+        addPlayer(name, newOwner);
+    }
+    else
+    {
+        // Same name, new process
+        m_players[name].owner = newOwner;
+        requestStatus(name);
+    }
+}
+
+void MprisClient::onPropertiesChanged(const QString &interface, const QVariantMap &changed,
+                                      const QStringList &invalidated, const QDBusMessage &message)
+{
+    if (interface != PlayerInterface)
+    {
+        return;
+    }
+
+    // Signals come from the unique name, find the player that owns it
+    for (auto it = m_players.cbegin(); it != m_players.cend(); ++it)
+    {
+        if (it->owner != message.service())
+        {
+            continue;
+        }
+        auto status = changed.constFind("PlaybackStatus");
+        if (status != changed.cend())
+        {
+            setPlayerStatus(it.key(), parseStatus(status->toString()));
+        }
+        else if (invalidated.contains("PlaybackStatus"))
+        {
+            requestStatus(it.key());
+        }
+        return;
+    }
+}
+
+void MprisClient::addPlayer(const QString &service, const QString &owner)
+{
+    LOG_INFO("MPRIS player appeared: " << service);
+    m_players[service].owner = owner;
+    requestStatus(service);
+
+    if (!owner.isEmpty())
+    {
+        return;
+    }
+    QDBusMessage getOwner = QDBusMessage::createMethodCall(BusService, BusPath, BusService, "GetNameOwner");
+    getOwner << service;
+    auto *watcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(getOwner), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, service](QDBusPendingCallWatcher *call) {
+        QDBusPendingReply<QString> reply = *call;
+        call->deleteLater();
+        auto it = m_players.find(service);
+        if (!reply.isError() && it != m_players.end())
+        {
+            it->owner = reply.value();
+        }
+    });
+}
+
+void MprisClient::removePlayer(const QString &service)
+{
+    if (m_players.remove(service))
+    {
+        LOG_INFO("MPRIS player gone: " << service);
+        updateStatus();
+    }
+}
+
+void MprisClient::requestStatus(const QString &service)
+{
+    QDBusMessage get = QDBusMessage::createMethodCall(service, ObjectPath, PropertiesInterface, "Get");
+    get << PlayerInterface << QStringLiteral("PlaybackStatus");
+    auto *watcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(get), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, service](QDBusPendingCallWatcher *call) {
+        QDBusPendingReply<QDBusVariant> reply = *call;
+        call->deleteLater();
+        if (reply.isError())
+        {
+            LOG_DEBUG("No playback status from " << service << ": " << reply.error().message());
+            return;
+        }
+        setPlayerStatus(service, parseStatus(reply.value().variant().toString()));
+    });
+}
+
+void MprisClient::setPlayerStatus(const QString &service, PlaybackStatus status)
+{
+    auto it = m_players.find(service);
+    if (it == m_players.end() || it->status == status)
+    {
+        return;
+    }
+    LOG_DEBUG("MPRIS player " << service << " is now " << status);
+    it->status = status;
+    updateStatus();
+}
+
+void MprisClient::updateStatus()
+{
+    PlaybackStatus status = PlaybackStatus::Stopped;
+    for (const Player &player : std::as_const(m_players))
+    {
+        status = qMax(status, player.status);
+    }
+    if (status == m_status)
+    {
+        return;
+    }
+    m_status = status;
+    emit statusChanged(status);
+}
+
+void MprisClient::call(const QString &service, const QString &method)
+{
+    QDBusMessage message = QDBusMessage::createMethodCall(service, ObjectPath, PlayerInterface, method);
+    auto *watcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(message), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [service, method](QDBusPendingCallWatcher *call) {
+        if (call->isError())
+        {
+            LOG_ERROR(method << " on " << service << " failed: " << call->error().message());
+        }
+        call->deleteLater();
+    });
+}
+
+MprisClient::PlaybackStatus MprisClient::parseStatus(const QString &value)
+{
+    if (value == "Playing")
+    {
+        return PlaybackStatus::Playing;
+    }
+    if (value == "Paused")
+    {
+        return PlaybackStatus::Paused;
+    }
+    return PlaybackStatus::Stopped;
+}
@@ -0,0 +1,72 @@
+#ifndef MPRISCLIENT_H
+#define MPRISCLIENT_H
+
+#include <QDBusMessage>
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVariantMap>
+
+// Keeps track of every MPRIS media player on the session bus and of its
+// playback status, from NameOwnerChanged and PropertiesChanged signals.
+//
+// Status queries are answered from memory. Play and Pause are sent as
+// asynchronous calls to the players they concern, nothing waits for a reply.
+class MprisClient : public QObject
+{
+    Q_OBJECT
+public:
+    enum class PlaybackStatus
+    {
+        Stopped,
+        Paused,
+        Playing
+    };
+    Q_ENUM(PlaybackStatus)
+
+    explicit MprisClient(QObject *parent = nullptr);
+
+    // Subscribes to the bus signals and looks up the players already running
+    void start();
+
+    // Playing if any player is playing
+    PlaybackStatus status() const { return m_status; }
+    bool isPlaying() const { return m_status == PlaybackStatus::Playing; }
+    QStringList players() const { return m_players.keys(); }
+
+    // Pauses every playing player and remembers them for resume(), returns how many were asked
+    int pause();
+    // Resumes the players the last pause() stopped, returns how many were asked
+    int resume();
+
+signals:
+    void statusChanged(MprisClient::PlaybackStatus status);
+
+private slots:
+    void onNameOwnerChanged(const QString &name, const QString &oldOwner, const QString &newOwner);
+    void onPropertiesChanged(const QString &interface, const QVariantMap &changed, const QStringList &invalidated,
+                             const QDBusMessage &message);
+
+private:
+    struct Player
+    {
+        QString owner; // Unique bus name, the sender of its signals
+        PlaybackStatus status = PlaybackStatus::Stopped;
+    };
+
+    void addPlayer(const QString &service, const QString &owner);
+    void removePlayer(const QString &service);
+    void requestStatus(const QString &service);
+    void setPlayerStatus(const QString &service, PlaybackStatus status);
+    void updateStatus();
+    void call(const QString &service, const QString &method);
+
+    static PlaybackStatus parseStatus(const QString &value);
+
+    QHash<QString, Player> m_players;
+    QStringList m_pausedByUs;
+    PlaybackStatus m_status = PlaybackStatus::Stopped;
+};
+
+#endif // MPRISCLIENT_H
@@ -0,0 +1,156 @@
+#include "packetcapture.h"
+#include "logger.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QTimer>
+#include <cstring>
+
+PacketCapture::PacketCapture(QObject *parent)
+    : QObject(parent)
+    , m_startUs(QDateTime::currentMSecsSinceEpoch() * 1000)
+    , m_flushTimer(new QTimer(this))
+{
+    m_clock.start();
+    m_writerThread.setObjectName("PacketCapture");
+
+    // Bounds how much of a capture is lost if the app dies
+    m_flushTimer->setInterval(1000);
+    connect(m_flushTimer, &QTimer::timeout, this, &PacketCapture::flush);
+
+    setRingCapacity(DefaultRingCapacity);
+}
+
+PacketCapture::~PacketCapture()
+{
+    stopRecording();
+    m_writerThread.quit();
+    m_writerThread.wait();
+}
+
+bool PacketCapture::startRecording(const QString &fileName)
+{
+    stopRecording();
+
+    QFile *file = new QFile(fileName);
+    if (!file->open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        LOG_ERROR("Failed to open capture file " << fileName << ": " << file->errorString());
+        delete file;
+        return false;
+    }
+
+    if (!m_writerThread.isRunning())
+    {
+        m_writerThread.start(QThread::LowPriority);
+    }
+    file->moveToThread(&m_writerThread);
+    m_file = file;
+
+    m_buffer.reserve(FlushThreshold);
+    Btsnoop::appendFileHeader(m_buffer);
+    m_framesRecorded = 0;
+    m_flushTimer->start();
+    LOG_INFO("Recording AAP traffic to " << fileName);
+    return true;
+}
+
+void PacketCapture::stopRecording()
+{
+    if (!m_file)
+    {
+        return;
+    }
+
+    m_flushTimer->stop();
+    flush();
+
+    // Queued behind the pending writes, so everything is on disk when this returns
+    QFile *file = m_file;
+    m_file = nullptr;
+    QMetaObject::invokeMethod(file, [file]() {
+        file->close();
+        delete file;
+    }, Qt::BlockingQueuedConnection);
+    LOG_INFO("Stopped recording AAP traffic, " << m_framesRecorded << " frames written");
+}
+
+void PacketCapture::setRingCapacity(int frames)
+{
+    m_ring.assign(qMax(0, frames), RingEntry());
+    m_ringNext = 0;
+    m_ringSize = 0;
+}
+
+bool PacketCapture::dumpRing(const QString &fileName) const
+{
+    QByteArray out;
+    Btsnoop::appendFileHeader(out);
+    const size_t capacity = m_ring.size();
+    for (size_t i = 0; i < m_ringSize; ++i)
+    {
+        const RingEntry &entry = m_ring[(m_ringNext + capacity - m_ringSize + i) % capacity];
+        Btsnoop::appendRecord(out, entry.direction, entry.timestampUs, entry.data, Btsnoop::DEFAULT_CID, entry.handle);
+    }
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(out) != out.size())
+    {
+        LOG_ERROR("Failed to write capture ring to " << fileName << ": " << file.errorString());
+        return false;
+    }
+    LOG_INFO("Dumped last " << m_ringSize << " AAP frames to " << fileName);
+    return true;
+}
+
+void PacketCapture::record(Direction direction, QByteArrayView frame, quint16 handle)
+{
+    const qint64 now = timestamp();
+
+    if (!m_ring.empty())
+    {
+        RingEntry &entry = m_ring[m_ringNext];
+        entry.timestampUs = now;
+        entry.direction = direction;
+        entry.handle = handle;
+        entry.data.resize(frame.size());
+        std::memcpy(entry.data.data(), frame.data(), frame.size());
+        m_ringNext = (m_ringNext + 1) % m_ring.size();
+        m_ringSize = qMin(m_ringSize + 1, m_ring.size());
+    }
+
+    if (m_file)
+    {
+        Btsnoop::appendRecord(m_buffer, direction, now, frame, Btsnoop::DEFAULT_CID, handle);
+        ++m_framesRecorded;
+        if (m_buffer.size() >= FlushThreshold)
+        {
+            flush();
+        }
+    }
+}
+
+qint64 PacketCapture::timestamp() const
+{
+    return m_startUs + m_clock.nsecsElapsed() / 1000;
+}
+
+void PacketCapture::flush()
+{
+    if (!m_file || m_buffer.isEmpty())
+    {
+        return;
+    }
+
+    QByteArray chunk;
+    chunk.swap(m_buffer);
+    m_buffer.reserve(FlushThreshold);
+
+    QFile *file = m_file;
+    QMetaObject::invokeMethod(file, [file, chunk]() {
+        if (file->write(chunk) != chunk.size())
+        {
+            LOG_ERROR("Failed to write capture: " << file->errorString());
+        }
+    }, Qt::QueuedConnection);
+}
@@ -0,0 +1,70 @@
+#ifndef PACKETCAPTURE_H
+#define PACKETCAPTURE_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QThread>
+#include <vector>
+
+#include "btsnoop.h"
+
+class QFile;
+class QTimer;
+
+// Records AAP frames in both directions as btsnoop.
+//
+// The last frames are always kept in a small in-memory ring that can be
+// dumped when something went wrong. Recording to a file is opt-in: records
+// are batched in memory and written by a separate thread, so the socket
+// handlers never wait on the disk. Timestamps come from a monotonic clock
+// anchored to the wall clock when the capture was created.
+class PacketCapture : public QObject
+{
+    Q_OBJECT
+public:
+    using Direction = Btsnoop::Direction;
+
+    static constexpr int DefaultRingCapacity = 512;
+    static constexpr qsizetype FlushThreshold = 64 * 1024;
+
+    explicit PacketCapture(QObject *parent = nullptr);
+    ~PacketCapture() override;
+
+    bool startRecording(const QString &fileName);
+    void stopRecording();
+    bool isRecording() const { return m_file != nullptr; }
+
+    void setRingCapacity(int frames);
+    bool dumpRing(const QString &fileName) const;
+
+    // handle is the ACL handle written for the frame, one per pair
+    void record(Direction direction, QByteArrayView frame, quint16 handle = Btsnoop::DEFAULT_HANDLE);
+
+private:
+    struct RingEntry
+    {
+        qint64 timestampUs = 0;
+        Direction direction = Direction::Received;
+        quint16 handle = Btsnoop::DEFAULT_HANDLE;
+        QByteArray data; // Reused, keeps its capacity between frames
+    };
+
+    qint64 timestamp() const;
+    void flush();
+
+    QElapsedTimer m_clock;
+    qint64 m_startUs;
+    QThread m_writerThread;
+    QFile *m_file = nullptr; // Owned by and only touched from m_writerThread
+    QTimer *m_flushTimer;
+    QByteArray m_buffer;
+    quint64 m_framesRecorded = 0;
+
+    std::vector<RingEntry> m_ring;
+    size_t m_ringNext = 0;
+    size_t m_ringSize = 0;
+};
+
+#endif // PACKETCAPTURE_H
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <QByteArrayView>
+#include <array>
+
+#include "airpods_packets.h"
+
+// Routes inbound AAP frames to handlers through fixed lookup tables.
+//
+// The header is decoded once per frame:
+//   01 00 04 00 ...                  -> handshake ack handler
+//   04 00 04 00 [opcode] 00 ...      -> opcode table
+//   04 00 04 00 09 00 [id] ...       -> control command table (opcode 0x09)
+//
+// Handlers receive a non-owning view of the whole frame, so nothing is copied
+// on the way in. Anything that doesn't resolve to a handler goes to the
+// fallback handler.
+template <typename Receiver>
+class PacketDispatcher
+{
+public:
+    using Handler = void (Receiver::*)(QByteArrayView);
+
+    explicit PacketDispatcher(Receiver *receiver) : m_receiver(receiver) {}
+
+    void setHandshakeAckHandler(Handler handler) { m_handshakeAckHandler = handler; }
+    void setHandler(quint8 opcode, Handler handler) { m_handlers[opcode] = handler; }
+    void setControlHandler(quint8 identifier, Handler handler) { m_controlHandlers[identifier] = handler; }
+    void setFallbackHandler(Handler handler) { m_fallbackHandler = handler; }
+
+    // Returns false if the frame was passed to the fallback handler
+    bool dispatch(QByteArrayView data) const
+    {
+        Handler handler = lookup(data);
+        if (!handler)
+        {
+            if (m_fallbackHandler)
+            {
+                (m_receiver->*m_fallbackHandler)(data);
+            }
+            return false;
+        }
+        (m_receiver->*handler)(data);
+        return true;
+    }
+
+private:
+    Handler lookup(QByteArrayView data) const
+    {
+        using namespace AirPodsPackets;
+
+        // Bytes 1..3 are 00 04 00 for every frame the AirPods send
+        if (data.size() < Frame::PREFIX_SIZE || data[1] != 0x00 || data[2] != 0x04 || data[3] != 0x00)
+        {
+            return nullptr;
+        }
+
+        switch (static_cast<quint8>(data[0]))
+        {
+        case Frame::TYPE_HANDSHAKE_ACK:
+            return m_handshakeAckHandler;
+        case Frame::TYPE_DATA:
+            break;
+        default:
+            return nullptr;
+        }
+
+        if (data.size() < Frame::HEADER_SIZE)
+        {
+            return nullptr;
+        }
+
+        quint8 opcode = static_cast<quint8>(data[Frame::OPCODE_OFFSET]);
+        if (opcode == Opcode::CONTROL_COMMAND)
+        {
+            if (data.size() <= Frame::CONTROL_IDENTIFIER_OFFSET)
+            {
+                return nullptr;
+            }
+            return m_controlHandlers[static_cast<quint8>(data[Frame::CONTROL_IDENTIFIER_OFFSET])];
+        }
+        return m_handlers[opcode];
+    }
+
+    Receiver *m_receiver;
+    Handler m_handshakeAckHandler = nullptr;
+    Handler m_fallbackHandler = nullptr;
+    std::array<Handler, 256> m_handlers{};
+    std::array<Handler, 256> m_controlHandlers{};
+};
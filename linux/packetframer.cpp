@@ -0,0 +1,75 @@
+#include "packetframer.h"
+#include "airpods_packets.h"
+#include "metrics.h"
+
+#include <cstring>
+
+qsizetype PacketFramer::frameLength(QByteArrayView data)
+{
+    using namespace AirPodsPackets;
+
+    if (data.size() < Frame::PREFIX_SIZE)
+    {
+        return 0;
+    }
+    if (data[1] != 0x00 || data[2] != 0x04 || data[3] != 0x00)
+    {
+        return Unbounded; // Not something we know how to frame, pass the rest of the read on as is
+    }
+
+    switch (static_cast<quint8>(data[0]))
+    {
+    case Frame::TYPE_HANDSHAKE:
+        return Connection::HANDSHAKE.size();
+    case Frame::TYPE_DATA:
+        break;
+    default:
+        return Unbounded;
+    }
+
+    if (data.size() < Frame::HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    switch (static_cast<quint8>(data[Frame::OPCODE_OFFSET]))
+    {
+    case Opcode::BATTERY_STATUS:
+    {
+        if (data.size() <= Frame::HEADER_SIZE)
+        {
+            return 0;
+        }
+        quint8 count = static_cast<quint8>(data[Frame::HEADER_SIZE]);
+        if (count > Parse::MAX_BATTERY_COMPONENTS)
+        {
+            return Unbounded;
+        }
+        return Frame::HEADER_SIZE + 1 + Parse::BATTERY_COMPONENT_SIZE * count;
+    }
+    case Opcode::EAR_DETECTION:
+        return Parse::EAR_DETECTION_PACKET_SIZE;
+    case Opcode::CONTROL_COMMAND:
+        return NoiseControl::PACKET_SIZE;
+    case Opcode::CONVERSATIONAL_AWARENESS_DATA:
+        return ConversationalAwareness::DATA_PACKET_SIZE;
+    case Opcode::MAGIC_CLOUD_KEYS:
+        return MagicPairing::MAGIC_CLOUD_KEYS_PACKET_SIZE;
+    default:
+        return Unbounded;
+    }
+}
+
+bool PacketFramer::appendPending(QByteArrayView data)
+{
+    if (m_pendingSize + data.size() > BufferSize)
+    {
+        m_stats.bytesDropped += m_pendingSize + data.size();
+        Metrics::add(Metrics::Counter::FramerBytesDropped, m_pendingSize + data.size());
+        m_pendingSize = 0;
+        return false;
+    }
+    std::memcpy(m_pending.data() + m_pendingSize, data.data(), data.size());
+    m_pendingSize += data.size();
+    return true;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <QByteArrayView>
+#include <QtGlobal>
+#include <array>
+
+// Splits the byte stream read from the AAP socket into complete packets.
+//
+// A single read can carry several packets, or only part of one. Frames that
+// are fully contained in a read are handed out as views into the read buffer.
+// Only an incomplete tail is copied, into a fixed reassembly buffer, and is
+// handed out from there once the rest of it arrives. Every byte is copied at
+// most once.
+//
+// Packet lengths follow the rules in AAP Definitions.md. Packets without a
+// length rule (metadata, acks, unknown opcodes) extend to the end of the read
+// they started in.
+class PacketFramer
+{
+public:
+    struct Stats
+    {
+        quint64 frames = 0;
+        quint64 framesSplit = 0;  // Frames reassembled from more than one read
+        quint64 framesMerged = 0; // Frames that shared a read with other frames
+        quint64 bytesDropped = 0; // Frames too large for the reassembly buffer
+    };
+
+    static constexpr qsizetype Unbounded = -1;
+    static constexpr qsizetype BufferSize = 1024;
+
+    // Length of the frame at the start of data, 0 if more bytes are needed to
+    // tell, or Unbounded if the frame extends to the end of the read
+    static qsizetype frameLength(QByteArrayView data);
+
+    // Calls onFrame(QByteArrayView) for every frame completed by data. The views
+    // are only valid until onFrame returns.
+    template <typename Callback>
+    void feed(QByteArrayView data, Callback &&onFrame);
+
+    void reset() { m_pendingSize = 0; }
+    bool hasPendingData() const { return m_pendingSize > 0; }
+    const Stats &stats() const { return m_stats; }
+
+private:
+    // Copies data into the reassembly buffer. If it doesn't fit, the pending
+    // frame is dropped and false is returned.
+    bool appendPending(QByteArrayView data);
+
+    std::array<char, BufferSize> m_pending;
+    qsizetype m_pendingSize = 0;
+    Stats m_stats;
+};
+
+template <typename Callback>
+void PacketFramer::feed(QByteArrayView data, Callback &&onFrame)
+{
+    qsizetype pos = 0;
+
+    // Complete the frame left over from the previous read first
+    while (m_pendingSize > 0 && pos < data.size())
+    {
+        qsizetype length = frameLength(QByteArrayView(m_pending.data(), m_pendingSize));
+        qsizetype wanted;
+        if (length == 0)
+        {
+            wanted = 1; // Header still incomplete, take one byte at a time until the length is known
+        }
+        else if (length == Unbounded)
+        {
+            wanted = data.size() - pos;
+        }
+        else
+        {
+            wanted = qMin(length - m_pendingSize, data.size() - pos);
+        }
+
+        bool appended = appendPending(data.sliced(pos, wanted));
+        pos += wanted;
+        if (!appended || length == 0)
+        {
+            continue;
+        }
+        if (length == Unbounded || m_pendingSize == length)
+        {
+            ++m_stats.frames;
+            ++m_stats.framesSplit;
+            onFrame(QByteArrayView(m_pending.data(), m_pendingSize));
+            m_pendingSize = 0;
+        }
+    }
+
+    // Frames fully contained in this read are handed out in place
+    quint64 framesInRead = 0;
+    while (pos < data.size())
+    {
+        QByteArrayView remaining = data.sliced(pos);
+        qsizetype length = frameLength(remaining);
+        if (length == Unbounded)
+        {
+            length = remaining.size();
+        }
+        else if (length == 0 || length > remaining.size())
+        {
+            appendPending(remaining);
+            break;
+        }
+
+        ++m_stats.frames;
+        ++framesInRead;
+        onFrame(remaining.first(length));
+        pos += length;
+    }
+
+    if (framesInRead > 1)
+    {
+        m_stats.framesMerged += framesInRead;
+    }
+}
@@ -0,0 +1,117 @@
+#include "pendingsettings.h"
+#include "logger.h"
+
+#include <QTimer>
+
+PendingSettings::PendingSettings(QObject *parent) : QObject(parent)
+{
+    for (int i = 0; i < static_cast<int>(Setting::Count); ++i)
+    {
+        Setting setting = static_cast<Setting>(i);
+        QTimer *timer = new QTimer(this);
+        timer->setSingleShot(true);
+        connect(timer, &QTimer::timeout, this, [this, setting]() { onTimeout(setting); });
+        m_entries[i].timer = timer;
+    }
+}
+
+PendingSettings::Source PendingSettings::confirmationSource(Setting setting)
+{
+    // Noise control mode and conversational awareness come back as state
+    // notifications, nothing reports the adaptive noise level
+    return setting == Setting::AdaptiveNoiseLevel ? Source::Written : Source::Device;
+}
+
+void PendingSettings::begin(Setting setting, int requested, int previous)
+{
+    Entry &e = entry(setting);
+    if (e.active)
+    {
+        // Keep the last confirmed value to roll back to, remember the replaced request
+        if (e.superseded.size() == e.superseded.capacity())
+        {
+            e.superseded.removeFirst();
+        }
+        e.superseded.append(e.requested);
+    }
+    else
+    {
+        e.previous = previous;
+        e.superseded.clear();
+    }
+
+    e.active = true;
+    e.requested = requested;
+    e.elapsed.start();
+    e.timer->start(m_timeoutMs);
+}
+
+PendingSettings::Result PendingSettings::confirm(Setting setting, int value, Source source)
+{
+    Entry &e = entry(setting);
+    if (!e.active)
+    {
+        return Result::NotPending;
+    }
+
+    if (value == e.requested)
+    {
+        if (source == Source::Written && confirmationSource(setting) == Source::Device)
+        {
+            return Result::Superseded; // Still waiting for the echo
+        }
+
+        qint64 latency = e.elapsed.elapsed();
+        LatencyStats &stats = m_latency[static_cast<int>(setting)];
+        stats.minMs = stats.count == 0 ? latency : qMin(stats.minMs, latency);
+        stats.maxMs = qMax(stats.maxMs, latency);
+        stats.lastMs = latency;
+        stats.totalMs += latency;
+        ++stats.count;
+
+        LOG_DEBUG(setting << " confirmed after " << latency << " ms");
+        finish(setting);
+        emit confirmed(setting, value, latency);
+        return Result::Confirmed;
+    }
+
+    if (source == Source::Written || e.superseded.contains(value))
+    {
+        return Result::Superseded;
+    }
+
+    LOG_WARN(setting << " rejected, requested " << e.requested << " but AirPods reported " << value);
+    finish(setting);
+    return Result::Rejected;
+}
+
+void PendingSettings::clear()
+{
+    for (int i = 0; i < static_cast<int>(Setting::Count); ++i)
+    {
+        finish(static_cast<Setting>(i));
+    }
+}
+
+void PendingSettings::finish(Setting setting)
+{
+    Entry &e = entry(setting);
+    e.active = false;
+    e.superseded.clear();
+    e.timer->stop();
+}
+
+void PendingSettings::onTimeout(Setting setting)
+{
+    Entry &e = entry(setting);
+    if (!e.active)
+    {
+        return;
+    }
+
+    int requested = e.requested;
+    int previous = e.previous;
+    LOG_WARN(setting << " not confirmed within " << m_timeoutMs << " ms, rolling back");
+    finish(setting);
+    emit rolledBack(setting, previous, requested);
+}
@@ -0,0 +1,91 @@
+#ifndef PENDINGSETTINGS_H
+#define PENDINGSETTINGS_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QVarLengthArray>
+#include <array>
+
+class QTimer;
+
+// Tracks settings that were applied to the UI before the AirPods confirmed them.
+//
+// Each change is recorded with the value it replaced. It is confirmed either
+// by the AirPods echoing the new value (noise control mode, conversational
+// awareness) or, for the adaptive noise level they don't echo, by the command
+// actually being written to the socket. If neither happens before the timeout, the previous value is handed
+// back through rolledBack().
+class PendingSettings : public QObject
+{
+    Q_OBJECT
+public:
+    enum class Setting
+    {
+        NoiseControlMode,
+        ConversationalAwareness,
+        AdaptiveNoiseLevel,
+        Count
+    };
+    Q_ENUM(Setting)
+
+    enum class Source
+    {
+        Device,  // Value reported by the AirPods
+        Written  // Command written to the socket
+    };
+
+    enum class Result
+    {
+        NotPending, // Nothing was pending, apply the value
+        Confirmed,  // Matched the pending request
+        Superseded, // Echo of an older request that was replaced since, ignore it
+        Rejected    // The AirPods reported something else, apply their value
+    };
+
+    struct LatencyStats
+    {
+        quint64 count = 0;
+        qint64 lastMs = 0;
+        qint64 minMs = 0;
+        qint64 maxMs = 0;
+        qint64 totalMs = 0;
+    };
+
+    explicit PendingSettings(QObject *parent = nullptr);
+
+    void setTimeout(int msec) { m_timeoutMs = msec; }
+
+    void begin(Setting setting, int requested, int previous);
+    Result confirm(Setting setting, int value, Source source = Source::Device);
+    bool isPending(Setting setting) const { return entry(setting).active; }
+    void clear();
+
+    const LatencyStats &latencyStats(Setting setting) const { return m_latency[static_cast<int>(setting)]; }
+
+signals:
+    void confirmed(PendingSettings::Setting setting, int value, qint64 latencyMs);
+    void rolledBack(PendingSettings::Setting setting, int restoredValue, int requestedValue);
+
+private:
+    struct Entry
+    {
+        bool active = false;
+        int requested = 0;
+        int previous = 0;
+        QVarLengthArray<int, 4> superseded;
+        QElapsedTimer elapsed;
+        QTimer *timer = nullptr;
+    };
+
+    static Source confirmationSource(Setting setting);
+    Entry &entry(Setting setting) { return m_entries[static_cast<int>(setting)]; }
+    const Entry &entry(Setting setting) const { return m_entries[static_cast<int>(setting)]; }
+    void finish(Setting setting);
+    void onTimeout(Setting setting);
+
+    int m_timeoutMs = 2000;
+    std::array<Entry, static_cast<int>(Setting::Count)> m_entries;
+    std::array<LatencyStats, static_cast<int>(Setting::Count)> m_latency;
+};
+
+#endif // PENDINGSETTINGS_H
@@ -0,0 +1,200 @@
+#include "phonerelay.h"
+#include "airpods_packets.h"
+#include "airpodssession.h"
+#include "logger.h"
+#include "metrics.h"
+#include "transport.h"
+
+#include <QIODevice>
+#include <QVarLengthArray>
+
+PhoneRelay::PhoneRelay(AirPodsSession *session, QObject *parent)
+    : QObject(parent)
+{
+    setSession(session);
+}
+
+void PhoneRelay::setSession(AirPodsSession *session)
+{
+    if (session == m_session)
+    {
+        return;
+    }
+    if (m_session)
+    {
+        disconnect(m_session, &AirPodsSession::frameReceived, this, &PhoneRelay::relayFrame);
+    }
+    m_session = session;
+    connect(m_session, &AirPodsSession::frameReceived, this, &PhoneRelay::relayFrame);
+}
+
+void PhoneRelay::setTransportFactory(TransportFactory factory)
+{
+    m_factory = std::move(factory);
+}
+
+void PhoneRelay::setEnabled(bool enabled)
+{
+    m_enabled = enabled;
+    if (!enabled)
+    {
+        dropTransport();
+    }
+}
+
+bool PhoneRelay::isConnected() const
+{
+    return m_transport && m_transport->isOpen();
+}
+
+void PhoneRelay::connectToPhone()
+{
+    if (!m_enabled || !m_factory)
+    {
+        return;
+    }
+    if (m_transport)
+    {
+        // Connected or still connecting
+        return;
+    }
+
+    Transport *transport = m_factory();
+    transport->setParent(this);
+    m_transport = transport;
+    connect(transport, &Transport::connected, this, []() { LOG_INFO("Connected to phone"); });
+    connect(transport, &Transport::disconnected, this, &PhoneRelay::dropTransport);
+    connect(transport, &Transport::errorOccurred, this, [this](const QString &message) {
+        LOG_ERROR("Phone socket error: " << message);
+        dropTransport();
+    });
+    connect(transport->device(), &QIODevice::readyRead, this, &PhoneRelay::onDataReceived);
+    transport->open();
+}
+
+void PhoneRelay::dropTransport()
+{
+    if (m_transport)
+    {
+        m_transport->disconnect(this);
+        m_transport->close();
+        m_transport->deleteLater();
+        m_transport.clear();
+    }
+}
+
+bool PhoneRelay::write(QByteArrayView packet)
+{
+    if (!m_enabled)
+    {
+        return false;
+    }
+    if (!isConnected())
+    {
+        LOG_WARN("Phone socket is not open, cannot send packet");
+        connectToPhone();
+        return false;
+    }
+    if (m_transport->device()->write(packet.data(), packet.size()) != packet.size())
+    {
+        return false;
+    }
+    Metrics::add(Metrics::Counter::RelayBytesToPhone, packet.size());
+    return true;
+}
+
+void PhoneRelay::notifyAirPodsConnected()
+{
+    if (write(AirPodsPackets::Phone::NOTIFICATION))
+    {
+        LOG_DEBUG("Sent notification packet to Android: " << AsyncLogger::hex(AirPodsPackets::Phone::NOTIFICATION));
+    }
+}
+
+void PhoneRelay::notifyAirPodsDisconnected()
+{
+    if (write(AirPodsPackets::Connection::AIRPODS_DISCONNECTED))
+    {
+        LOG_DEBUG("AIRPODS_DISCONNECTED packet written: " << AsyncLogger::hex(AirPodsPackets::Connection::AIRPODS_DISCONNECTED));
+    }
+}
+
+void PhoneRelay::sendDisconnectRequest()
+{
+    if (write(AirPodsPackets::Phone::DISCONNECT_REQUEST))
+    {
+        LOG_DEBUG("Sent disconnect request to Android: " << AsyncLogger::hex(AirPodsPackets::Phone::DISCONNECT_REQUEST));
+    }
+}
+
+void PhoneRelay::relayFrame(QByteArrayView frame)
+{
+    if (!m_enabled)
+    {
+        return;
+    }
+    QVarLengthArray<char, 256> buffer;
+    buffer.append(AirPodsPackets::Phone::NOTIFICATION.data(), AirPodsPackets::Phone::NOTIFICATION.size());
+    buffer.append(frame.data(), frame.size());
+    if (!write(QByteArrayView(buffer.constData(), buffer.size())))
+    {
+        Metrics::add(Metrics::Counter::RelayDroppedToPhone);
+    }
+}
+
+void PhoneRelay::onDataReceived()
+{
+    QByteArray data = m_transport->device()->readAll();
+    Metrics::add(Metrics::Counter::RelayBytesFromPhone, data.size());
+    LOG_PACKET("Data received from phone:", data);
+    handlePacket(data);
+}
+
+void PhoneRelay::handlePacket(QByteArrayView packet)
+{
+    using namespace AirPodsPackets;
+
+    if (packet.startsWith(Phone::NOTIFICATION))
+    {
+        relayToAirPods(packet.sliced(Phone::NOTIFICATION.size()));
+    }
+    else if (packet.startsWith(Phone::CONNECTED))
+    {
+        LOG_INFO("AirPods connected to phone");
+        m_phoneConnectedToAirPods = true;
+    }
+    else if (packet.startsWith(Phone::DISCONNECTED))
+    {
+        LOG_INFO("AirPods disconnected from phone");
+        m_phoneConnectedToAirPods = false;
+    }
+    else if (packet.startsWith(Phone::STATUS_REQUEST))
+    {
+        LOG_INFO("Connection status request received");
+        QByteArrayView response = m_session->isConnected() ? QByteArrayView(Phone::CONNECTED)
+                                                           : QByteArrayView(Phone::DISCONNECTED);
+        write(response);
+        LOG_DEBUG("Sent connection status response: " << AsyncLogger::hex(response));
+    }
+    else if (packet.startsWith(Phone::DISCONNECT_REQUEST))
+    {
+        LOG_INFO("Disconnect request received");
+        if (m_session->isConnected())
+        {
+            m_phoneConnectedToAirPods = false;
+            emit disconnectRequested();
+        }
+    }
+    else
+    {
+        relayToAirPods(packet);
+    }
+}
+
+void PhoneRelay::relayToAirPods(QByteArrayView packet)
+{
+    if (!m_session->sendPacket(packet, "Relayed packet to AirPods:", CommandQueue::Priority::Relay))
+    {
+        Metrics::add(Metrics::Counter::RelayDroppedToAirPods);
+    }
+}
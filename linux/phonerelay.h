@@ -0,0 +1,61 @@
+#ifndef PHONERELAY_H
+#define PHONERELAY_H
+
+#include <QByteArrayView>
+#include <QObject>
+#include <QPointer>
+#include <functional>
+
+class AirPodsSession;
+class Transport;
+
+// Shares one pair of AirPods with the ALN app on an Android phone.
+//
+// Every frame from the AirPods is forwarded to the phone, and packets from
+// the phone are sent on to the AirPods or answered here. The relay only sees
+// a Transport, the frontend decides how to reach the phone.
+class PhoneRelay : public QObject
+{
+    Q_OBJECT
+public:
+    using TransportFactory = std::function<Transport *()>;
+
+    explicit PhoneRelay(AirPodsSession *session, QObject *parent = nullptr);
+
+    // The phone only ever sees one pair, switched when the active device changes
+    void setSession(AirPodsSession *session);
+
+    // Called for every connection attempt, the relay owns the result
+    void setTransportFactory(TransportFactory factory);
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return m_enabled; }
+
+    bool isConnected() const;
+    // The phone reported that it is connected to the AirPods itself
+    bool isPhoneConnectedToAirPods() const { return m_phoneConnectedToAirPods; }
+
+    void connectToPhone();
+    void notifyAirPodsConnected();
+    void notifyAirPodsDisconnected();
+    void sendDisconnectRequest();
+
+signals:
+    // The phone wants the AirPods for itself
+    void disconnectRequested();
+
+private:
+    void relayFrame(QByteArrayView frame);
+    void onDataReceived();
+    void handlePacket(QByteArrayView packet);
+    void relayToAirPods(QByteArrayView packet);
+    void dropTransport();
+    bool write(QByteArrayView packet);
+
+    AirPodsSession *m_session = nullptr;
+    TransportFactory m_factory;
+    QPointer<Transport> m_transport;
+    bool m_enabled = false;
+    bool m_phoneConnectedToAirPods = false;
+};
+
+#endif // PHONERELAY_H
@@ -0,0 +1,269 @@
+#include "pulseaudiobackend.h"
+#include "logger.h"
+
+#include <QTimer>
+
+namespace
+{
+    // Releases an operation right away, its callback still runs when the server answers
+    void dropOperation(pa_operation *operation)
+    {
+        if (operation)
+        {
+            pa_operation_unref(operation);
+        }
+    }
+}
+
+PulseAudioBackend::PulseAudioBackend(QObject *parent) : AudioBackend(parent)
+{
+}
+
+PulseAudioBackend::~PulseAudioBackend()
+{
+    if (!m_mainloop)
+    {
+        return;
+    }
+    pa_threaded_mainloop_lock(m_mainloop);
+    disconnectContext();
+    pa_threaded_mainloop_unlock(m_mainloop);
+    pa_threaded_mainloop_stop(m_mainloop);
+    pa_threaded_mainloop_free(m_mainloop);
+}
+
+bool PulseAudioBackend::start()
+{
+    if (m_mainloop)
+    {
+        return true;
+    }
+
+    m_mainloop = pa_threaded_mainloop_new();
+    if (!m_mainloop)
+    {
+        LOG_ERROR("Failed to create PulseAudio mainloop");
+        return false;
+    }
+
+    pa_threaded_mainloop_lock(m_mainloop);
+    connectContext();
+    pa_threaded_mainloop_unlock(m_mainloop);
+
+    if (pa_threaded_mainloop_start(m_mainloop) < 0)
+    {
+        LOG_ERROR("Failed to start PulseAudio mainloop");
+        pa_threaded_mainloop_lock(m_mainloop);
+        disconnectContext();
+        pa_threaded_mainloop_unlock(m_mainloop);
+        pa_threaded_mainloop_free(m_mainloop);
+        m_mainloop = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void PulseAudioBackend::connectContext()
+{
+    m_context = pa_context_new(pa_threaded_mainloop_get_api(m_mainloop), "AirPodsTrayApp");
+    pa_context_set_state_callback(m_context, &PulseAudioBackend::contextStateCallback, this);
+    pa_context_set_subscribe_callback(m_context, &PulseAudioBackend::subscribeCallback, this);
+
+    // NOFAIL waits for a server that isn't up yet instead of failing right away
+    if (pa_context_connect(m_context, nullptr, PA_CONTEXT_NOFAIL, nullptr) < 0)
+    {
+        LOG_ERROR("Failed to connect to PulseAudio: " << pa_strerror(pa_context_errno(m_context)));
+    }
+}
+
+void PulseAudioBackend::disconnectContext()
+{
+    if (!m_context)
+    {
+        return;
+    }
+    pa_context_set_state_callback(m_context, nullptr, nullptr);
+    pa_context_set_subscribe_callback(m_context, nullptr, nullptr);
+    pa_context_disconnect(m_context);
+    pa_context_unref(m_context);
+    m_context = nullptr;
+}
+
+void PulseAudioBackend::setSinkVolume(const QString &sinkName, int percent)
+{
+    const Sink *sink = findSink(sinkName);
+    if (!m_mainloop || !sink)
+    {
+        LOG_WARN("Cannot set volume of unknown sink " << sinkName);
+        return;
+    }
+
+    pa_cvolume volume;
+    pa_cvolume_set(&volume, sink->channels, static_cast<pa_volume_t>(qMax(0, percent) * qint64(PA_VOLUME_NORM) / 100));
+    QByteArray name = sinkName.toUtf8();
+
+    pa_threaded_mainloop_lock(m_mainloop);
+    if (m_context && pa_context_get_state(m_context) == PA_CONTEXT_READY)
+    {
+        dropOperation(pa_context_set_sink_volume_by_name(m_context, name.constData(), &volume,
+                                                         &PulseAudioBackend::volumeSetCallback, this));
+    }
+    pa_threaded_mainloop_unlock(m_mainloop);
+}
+
+void PulseAudioBackend::setCardProfile(const QString &cardName, const QString &profile)
+{
+    if (!m_mainloop)
+    {
+        return;
+    }
+    QByteArray card = cardName.toUtf8();
+    QByteArray profileName = profile.toUtf8();
+
+    pa_threaded_mainloop_lock(m_mainloop);
+    if (m_context && pa_context_get_state(m_context) == PA_CONTEXT_READY)
+    {
+        dropOperation(pa_context_set_card_profile_by_name(m_context, card.constData(), profileName.constData(),
+                                                          &PulseAudioBackend::profileSetCallback, this));
+    }
+    pa_threaded_mainloop_unlock(m_mainloop);
+}
+
+void PulseAudioBackend::contextStateCallback(pa_context *context, void *userdata)
+{
+    auto *self = static_cast<PulseAudioBackend *>(userdata);
+    switch (pa_context_get_state(context))
+    {
+    case PA_CONTEXT_READY:
+    {
+        auto mask = static_cast<pa_subscription_mask_t>(PA_SUBSCRIPTION_MASK_SINK | PA_SUBSCRIPTION_MASK_CARD
+                                                        | PA_SUBSCRIPTION_MASK_SERVER);
+        dropOperation(pa_context_subscribe(context, mask, nullptr, nullptr));
+        dropOperation(pa_context_get_sink_info_list(context, &PulseAudioBackend::sinkInfoCallback, self));
+        dropOperation(pa_context_get_card_info_list(context, &PulseAudioBackend::cardInfoCallback, self));
+        // Answered last, so the cache is complete once it marks the backend ready
+        dropOperation(pa_context_get_server_info(context, &PulseAudioBackend::serverInfoCallback, self));
+        break;
+    }
+    case PA_CONTEXT_FAILED:
+        // The server went away, start over with a new context once it may be back
+        QMetaObject::invokeMethod(self, [self]() {
+            LOG_WARN("Lost connection to PulseAudio, reconnecting");
+            self->clearCache();
+            self->setReady(false);
+            QTimer::singleShot(2000, self, [self]() {
+                pa_threaded_mainloop_lock(self->m_mainloop);
+                self->disconnectContext();
+                self->connectContext();
+                pa_threaded_mainloop_unlock(self->m_mainloop);
+            });
+        }, Qt::QueuedConnection);
+        break;
+    default:
+        break;
+    }
+}
+
+void PulseAudioBackend::subscribeCallback(pa_context *context, pa_subscription_event_type_t type, uint32_t index, void *userdata)
+{
+    auto *self = static_cast<PulseAudioBackend *>(userdata);
+    bool removed = (type & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE;
+
+    switch (type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK)
+    {
+    case PA_SUBSCRIPTION_EVENT_SINK:
+        if (removed)
+        {
+            QMetaObject::invokeMethod(self, [self, index]() { self->removeSink(index); }, Qt::QueuedConnection);
+        }
+        else
+        {
+            dropOperation(pa_context_get_sink_info_by_index(context, index, &PulseAudioBackend::sinkInfoCallback, self));
+        }
+        break;
+    case PA_SUBSCRIPTION_EVENT_CARD:
+        if (removed)
+        {
+            QMetaObject::invokeMethod(self, [self, index]() { self->removeCard(index); }, Qt::QueuedConnection);
+        }
+        else
+        {
+            dropOperation(pa_context_get_card_info_by_index(context, index, &PulseAudioBackend::cardInfoCallback, self));
+        }
+        break;
+    case PA_SUBSCRIPTION_EVENT_SERVER:
+        // The default sink changed
+        dropOperation(pa_context_get_server_info(context, &PulseAudioBackend::serverInfoCallback, self));
+        break;
+    }
+}
+
+void PulseAudioBackend::serverInfoCallback(pa_context *, const pa_server_info *info, void *userdata)
+{
+    auto *self = static_cast<PulseAudioBackend *>(userdata);
+    QString defaultSink = info && info->default_sink_name ? QString::fromUtf8(info->default_sink_name) : QString();
+    QMetaObject::invokeMethod(self, [self, defaultSink]() {
+        self->setDefaultSinkName(defaultSink);
+        self->setReady(true);
+    }, Qt::QueuedConnection);
+}
+
+void PulseAudioBackend::sinkInfoCallback(pa_context *, const pa_sink_info *info, int eol, void *userdata)
+{
+    if (eol || !info)
+    {
+        return;
+    }
+
+    auto *self = static_cast<PulseAudioBackend *>(userdata);
+    Sink sink;
+    sink.index = info->index;
+    sink.name = QString::fromUtf8(info->name);
+    sink.card = info->card;
+    sink.channels = info->volume.channels;
+    sink.volume = static_cast<int>((qint64(pa_cvolume_avg(&info->volume)) * 100 + PA_VOLUME_NORM / 2) / PA_VOLUME_NORM);
+    QMetaObject::invokeMethod(self, [self, sink]() { self->updateSink(sink); }, Qt::QueuedConnection);
+}
+
+void PulseAudioBackend::cardInfoCallback(pa_context *, const pa_card_info *info, int eol, void *userdata)
+{
+    if (eol || !info)
+    {
+        return;
+    }
+
+    auto *self = static_cast<PulseAudioBackend *>(userdata);
+    Card card;
+    card.index = info->index;
+    card.name = QString::fromUtf8(info->name);
+    if (info->active_profile2)
+    {
+        card.activeProfile = QString::fromUtf8(info->active_profile2->name);
+    }
+    QMetaObject::invokeMethod(self, [self, card]() { self->updateCard(card); }, Qt::QueuedConnection);
+}
+
+void PulseAudioBackend::volumeSetCallback(pa_context *context, int success, void *userdata)
+{
+    if (!success)
+    {
+        static_cast<PulseAudioBackend *>(userdata)->reportFailure(context, "Set sink volume");
+    }
+}
+
+void PulseAudioBackend::profileSetCallback(pa_context *context, int success, void *userdata)
+{
+    if (!success)
+    {
+        static_cast<PulseAudioBackend *>(userdata)->reportFailure(context, "Set card profile");
+    }
+}
+
+void PulseAudioBackend::reportFailure(pa_context *context, const char *request)
+{
+    QString description = QString("%1 failed: %2").arg(request, pa_strerror(pa_context_errno(context)));
+    QMetaObject::invokeMethod(this, [this, description]() {
+        LOG_ERROR(description);
+        emit requestFailed(description);
+    }, Qt::QueuedConnection);
+}
@@ -0,0 +1,45 @@
+#ifndef PULSEAUDIOBACKEND_H
+#define PULSEAUDIOBACKEND_H
+
+#include "audiobackend.h"
+
+#include <pulse/pulseaudio.h>
+
+// AudioBackend on libpulse, which also talks to PipeWire through pipewire-pulse.
+//
+// libpulse runs its own thread (pa_threaded_mainloop). Its callbacks copy what
+// they need and hand it to the Qt thread, so the cache is only touched there.
+// Reconnects by itself when the server restarts.
+class PulseAudioBackend : public AudioBackend
+{
+    Q_OBJECT
+public:
+    explicit PulseAudioBackend(QObject *parent = nullptr);
+    ~PulseAudioBackend() override;
+
+    bool start() override;
+
+    void setSinkVolume(const QString &sinkName, int percent) override;
+    void setCardProfile(const QString &cardName, const QString &profile) override;
+
+private:
+    // Called with the mainloop lock held
+    void connectContext();
+    void disconnectContext();
+
+    // libpulse callbacks, run on the mainloop thread
+    static void contextStateCallback(pa_context *context, void *userdata);
+    static void subscribeCallback(pa_context *context, pa_subscription_event_type_t type, uint32_t index, void *userdata);
+    static void serverInfoCallback(pa_context *context, const pa_server_info *info, void *userdata);
+    static void sinkInfoCallback(pa_context *context, const pa_sink_info *info, int eol, void *userdata);
+    static void cardInfoCallback(pa_context *context, const pa_card_info *info, int eol, void *userdata);
+    static void volumeSetCallback(pa_context *context, int success, void *userdata);
+    static void profileSetCallback(pa_context *context, int success, void *userdata);
+
+    void reportFailure(pa_context *context, const char *request);
+
+    pa_threaded_mainloop *m_mainloop = nullptr;
+    pa_context *m_context = nullptr;
+};
+
+#endif // PULSEAUDIOBACKEND_H
@@ -0,0 +1,143 @@
+#include "reactionlatency.h"
+#include "logger.h"
+
+#include <QMetaEnum>
+#include <chrono>
+
+ReactionLatency *ReactionLatency::instance()
+{
+    static ReactionLatency *latency = []() {
+        auto *created = new ReactionLatency();
+        // Roughly where the delay starts to be noticeable
+        created->m_objectiveUs[int(Reaction::EarDetectionPause)] = 250000;
+        created->m_objectiveUs[int(Reaction::ConversationalAwarenessDuck)] = 300000;
+        created->m_objectiveUs[int(Reaction::SettingChange)] = 1000000;
+        return created;
+    }();
+    return latency;
+}
+
+qint64 ReactionLatency::nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ReactionLatency::start(Reaction reaction, qint64 startNs)
+{
+    ReactionLatency *self = instance();
+    const int index = int(reaction);
+    const qint64 runningNs = self->m_startNs[index].load(std::memory_order_relaxed);
+    const quint32 acting = (1u << int(Stage::MediaQuery)) | (1u << int(Stage::ActionIssued));
+    const bool committed = self->m_stagesSeen[index].load(std::memory_order_relaxed) & acting;
+    if (runningNs != 0 && committed && startNs - runningNs < ConfirmationTimeoutNs)
+    {
+        return; // Let the action under way finish first
+    }
+    self->m_stagesSeen[index].store(0, std::memory_order_relaxed);
+    self->m_startNs[index].store(startNs, std::memory_order_relaxed);
+}
+
+void ReactionLatency::mark(Reaction reaction, Stage stage)
+{
+    ReactionLatency *self = instance();
+    const int index = int(reaction);
+    const qint64 startNs = self->m_startNs[index].load(std::memory_order_relaxed);
+    if (startNs == 0)
+    {
+        return;
+    }
+    const quint32 bit = 1u << int(stage);
+    if (self->m_stagesSeen[index].fetch_or(bit, std::memory_order_relaxed) & bit)
+    {
+        return;
+    }
+    self->m_histograms[index][int(stage)].record((nowNs() - startNs) / 1000);
+}
+
+void ReactionLatency::finish(Reaction reaction)
+{
+    ReactionLatency *self = instance();
+    const int index = int(reaction);
+    const qint64 startNs = self->m_startNs[index].exchange(0, std::memory_order_relaxed);
+    if (startNs == 0)
+    {
+        return;
+    }
+    const qint64 totalUs = (nowNs() - startNs) / 1000;
+    self->m_histograms[index][int(Stage::ActionConfirmed)].record(totalUs);
+
+    const qint64 objectiveUs = self->m_objectiveUs[index].load(std::memory_order_relaxed);
+    const bool within = objectiveUs <= 0 || totalUs <= objectiveUs;
+    if (!within)
+    {
+        self->m_violations[index].fetch_add(1, std::memory_order_relaxed);
+        LOG_WARN(reaction << " took " << totalUs / 1000 << " ms, objective is " << objectiveUs / 1000 << " ms");
+    }
+    emit self->reactionCompleted(reaction, totalUs, within);
+}
+
+void ReactionLatency::cancel(Reaction reaction)
+{
+    ReactionLatency *self = instance();
+    const int index = int(reaction);
+    if (self->m_stagesSeen[index].load(std::memory_order_relaxed) & (1u << int(Stage::ActionIssued)))
+    {
+        return;
+    }
+    self->m_startNs[index].store(0, std::memory_order_relaxed);
+}
+
+void ReactionLatency::setObjective(Reaction reaction, qint64 us)
+{
+    instance()->m_objectiveUs[int(reaction)].store(us, std::memory_order_relaxed);
+}
+
+qint64 ReactionLatency::objective(Reaction reaction)
+{
+    return instance()->m_objectiveUs[int(reaction)].load(std::memory_order_relaxed);
+}
+
+const LatencyHistogram &ReactionLatency::histogram(Reaction reaction, Stage stage)
+{
+    return instance()->m_histograms[int(reaction)][int(stage)];
+}
+
+QString ReactionLatency::report()
+{
+    auto ms = [](qint64 us) { return QString::number(us / 1000.0, 'f', 1); };
+    const QMetaEnum reactions = QMetaEnum::fromType<Reaction>();
+    const QMetaEnum stages = QMetaEnum::fromType<Stage>();
+    ReactionLatency *self = instance();
+
+    QString text;
+    for (int r = 0; r < ReactionCount; ++r)
+    {
+        const LatencyHistogram &total = self->m_histograms[r][int(Stage::ActionConfirmed)];
+        const qint64 objectiveUs = self->m_objectiveUs[r].load(std::memory_order_relaxed);
+        text += QString("%1: %2 completed").arg(reactions.valueToKey(r)).arg(total.count());
+        if (objectiveUs > 0)
+        {
+            text += QString(", objective %1 ms, %2 slower")
+                        .arg(ms(objectiveUs))
+                        .arg(self->m_violations[r].load(std::memory_order_relaxed));
+        }
+        text += "\n";
+        for (int s = 0; s < StageCount; ++s)
+        {
+            const LatencyHistogram &histogram = self->m_histograms[r][s];
+            if (histogram.count() == 0)
+            {
+                continue;
+            }
+            text += QString("  %1 %2 samples, p50 %3 / p90 %4 / p99 %5 / max %6 ms\n")
+                        .arg(QString(stages.valueToKey(s)) + ":", -17)
+                        .arg(histogram.count(), 6)
+                        .arg(ms(histogram.percentile(0.50)))
+                        .arg(ms(histogram.percentile(0.90)))
+                        .arg(ms(histogram.percentile(0.99)))
+                        .arg(ms(histogram.max()));
+        }
+    }
+    return text;
+}
@@ -0,0 +1,89 @@
+#ifndef REACTIONLATENCY_H
+#define REACTIONLATENCY_H
+
+#include <QObject>
+#include <QString>
+#include <array>
+#include <atomic>
+
+#include "latencyhistogram.h"
+
+// How long the app takes to react to what the AirPods report, stage by
+// stage, from the socket read that carried the packet:
+//
+//   Decode           packet parsed, about to be announced
+//   Dispatch         reached the code that reacts to it
+//   MediaQuery       decided to act, after checking the output and the players
+//   ActionIssued     request sent to MPRIS, the sound server or the AirPods
+//   ActionConfirmed  the other side reports it done, ends the reaction
+//
+// Setting changes start when the user asks for them rather than at a read.
+// One reaction of each kind is tracked at a time. A new start replaces the
+// previous one, unless that one already got to MediaQuery and is acting.
+// Each stage is recorded once per reaction. Recording costs a clock read
+// and a few relaxed atomics, and the histograms can be read from any thread.
+class ReactionLatency : public QObject
+{
+    Q_OBJECT
+public:
+    enum class Reaction
+    {
+        EarDetectionPause,
+        ConversationalAwarenessDuck,
+        SettingChange,
+        Count
+    };
+    Q_ENUM(Reaction)
+
+    enum class Stage
+    {
+        Decode,
+        Dispatch,
+        MediaQuery,
+        ActionIssued,
+        ActionConfirmed,
+        Count
+    };
+    Q_ENUM(Stage)
+
+    static ReactionLatency *instance();
+
+    // Monotonic, the same clock as the timestamps taken at socket reads
+    static qint64 nowNs();
+
+    static void start(Reaction reaction, qint64 startNs);
+    // Ignored unless the reaction is running
+    static void mark(Reaction reaction, Stage stage);
+    // Records ActionConfirmed and ends the reaction
+    static void finish(Reaction reaction);
+    // Nothing to do after all, ignored once the action was issued
+    static void cancel(Reaction reaction);
+
+    // Completed reactions slower than this are logged and counted, 0 turns the check off
+    static void setObjective(Reaction reaction, qint64 us);
+    static qint64 objective(Reaction reaction);
+
+    static const LatencyHistogram &histogram(Reaction reaction, Stage stage);
+    // Percentiles of every stage that has samples, one reaction per block
+    static QString report();
+
+signals:
+    // Emitted on the thread that finished the reaction
+    void reactionCompleted(ReactionLatency::Reaction reaction, qint64 totalUs, bool withinObjective);
+
+private:
+    ReactionLatency() = default;
+
+    static constexpr int ReactionCount = int(Reaction::Count);
+    static constexpr int StageCount = int(Stage::Count);
+    // An action still unconfirmed after this no longer blocks new starts
+    static constexpr qint64 ConfirmationTimeoutNs = 10'000'000'000;
+
+    std::array<std::atomic<qint64>, ReactionCount> m_startNs{}; // 0 when not running
+    std::array<std::atomic<quint32>, ReactionCount> m_stagesSeen{}; // Bit per Stage
+    std::array<std::atomic<qint64>, ReactionCount> m_objectiveUs{};
+    std::array<std::atomic<quint64>, ReactionCount> m_violations{};
+    std::array<std::array<LatencyHistogram, StageCount>, ReactionCount> m_histograms;
+};
+
+#endif // REACTIONLATENCY_H
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <QtGlobal>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+// Single writer, any number of readers on any thread, no locks and no
+// allocation on either side.
+//
+// The writer makes the sequence odd, stores the value and makes it even
+// again. A reader copies the value and retries if the sequence was odd or
+// moved in the meantime. The value is kept in atomic words so the copy
+// a reader may throw away is still not a data race.
+template <typename T>
+class SeqLock
+{
+    static_assert(std::is_trivially_copyable_v<T>, "SeqLock values are copied word by word");
+
+public:
+    SeqLock() { store(T()); }
+
+    // Writer thread only
+    void publish(const T &value)
+    {
+        const quint64 sequence = m_sequence.load(std::memory_order_relaxed);
+        m_sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        store(value);
+        m_sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    T read() const
+    {
+        std::array<quint64, Words> words;
+        for (int spins = 0;; ++spins)
+        {
+            const quint64 before = m_sequence.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                // Writer in progress, it only copies a few words
+                if (spins > 100)
+                {
+                    std::this_thread::yield();
+                }
+                continue;
+            }
+            for (size_t i = 0; i < Words; ++i)
+            {
+                words[i] = m_words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_sequence.load(std::memory_order_relaxed) == before)
+            {
+                break;
+            }
+        }
+        T value;
+        std::memcpy(&value, words.data(), sizeof(T));
+        return value;
+    }
+
+    // Number of values published so far
+    quint64 version() const { return m_sequence.load(std::memory_order_acquire) / 2; }
+
+private:
+    static constexpr size_t Words = (sizeof(T) + sizeof(quint64) - 1) / sizeof(quint64);
+
+    void store(const T &value)
+    {
+        std::array<quint64, Words> words{};
+        std::memcpy(words.data(), &value, sizeof(T));
+        for (size_t i = 0; i < Words; ++i)
+        {
+            m_words[i].store(words[i], std::memory_order_relaxed);
+        }
+    }
+
+    // Readers spin on the sequence, keep it off the writer's other cache lines
+    alignas(64) std::atomic<quint64> m_sequence{0};
+    std::array<std::atomic<quint64>, Words> m_words;
+};
@@ -0,0 +1,187 @@
+#include "seqpackettransport.h"
+#include "logger.h"
+
+#include <QSocketNotifier>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+SeqPacketDevice::SeqPacketDevice(QObject *parent) : QIODevice(parent)
+{
+}
+
+SeqPacketDevice::~SeqPacketDevice()
+{
+    closeSocket();
+}
+
+bool SeqPacketDevice::adopt(int fd)
+{
+    closeSocket();
+    m_fd = fd;
+    m_notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &QIODevice::readyRead);
+    m_writeNotifier = new QSocketNotifier(fd, QSocketNotifier::Write, this);
+    m_writeNotifier->setEnabled(false);
+    connect(m_writeNotifier, &QSocketNotifier::activated, this, &SeqPacketDevice::flushOutbox);
+
+    // Unbuffered, so that every read() is one recv() and keeps the message boundaries
+    return QIODevice::open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+}
+
+void SeqPacketDevice::close()
+{
+    QIODevice::close();
+    closeSocket();
+}
+
+qint64 SeqPacketDevice::readData(char *data, qint64 maxSize)
+{
+    ssize_t received = ::recv(m_fd, data, maxSize, MSG_DONTWAIT);
+    if (received > 0)
+    {
+        return received;
+    }
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return 0;
+    }
+
+    // The peer went away, stop watching the socket before the notifier spins on it
+    if (m_notifier)
+    {
+        m_notifier->setEnabled(false);
+    }
+    QMetaObject::invokeMethod(this, &SeqPacketDevice::peerClosed, Qt::QueuedConnection);
+    return -1;
+}
+
+qint64 SeqPacketDevice::writeData(const char *data, qint64 size)
+{
+    // Behind queued messages, or the order would change
+    if (m_outbox.isEmpty())
+    {
+        ssize_t sent = ::send(m_fd, data, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent >= 0)
+        {
+            emit bytesWritten(sent);
+            return sent;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            setErrorString(QString::fromLocal8Bit(std::strerror(errno)));
+            return -1;
+        }
+    }
+
+    m_outbox.enqueue(QByteArray(data, size));
+    m_outboxBytes += size;
+    m_writeNotifier->setEnabled(true);
+    return size;
+}
+
+void SeqPacketDevice::flushOutbox()
+{
+    while (!m_outbox.isEmpty())
+    {
+        const QByteArray &message = m_outbox.head();
+        ssize_t sent = ::send(m_fd, message.constData(), message.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                return; // Still full, the notifier stays enabled
+            }
+            // The read side notices the peer is gone and closes the device
+            LOG_WARN("Dropping " << m_outbox.size() << " unsent messages: " << std::strerror(errno));
+            m_outbox.clear();
+            m_outboxBytes = 0;
+            break;
+        }
+        m_outboxBytes -= message.size();
+        m_outbox.dequeue();
+        emit bytesWritten(sent);
+    }
+    m_writeNotifier->setEnabled(false);
+}
+
+void SeqPacketDevice::closeSocket()
+{
+    delete m_notifier;
+    m_notifier = nullptr;
+    delete m_writeNotifier;
+    m_writeNotifier = nullptr;
+    m_outbox.clear();
+    m_outboxBytes = 0;
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+SeqPacketTransport::SeqPacketTransport(const QString &socketPath, QObject *parent)
+    : Transport(parent), m_socketPath(socketPath), m_device(new SeqPacketDevice(this))
+{
+    connect(m_device, &SeqPacketDevice::peerClosed, this, [this]() {
+        m_device->close();
+        emit disconnected();
+    });
+}
+
+SeqPacketTransport::SeqPacketTransport(int fd, QObject *parent)
+    : SeqPacketTransport(QString("socketpair:%1").arg(fd), parent)
+{
+    m_pendingFd = fd;
+}
+
+bool SeqPacketTransport::createSocketPair(int fds[2])
+{
+    return ::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == 0;
+}
+
+void SeqPacketTransport::open()
+{
+    int fd = m_pendingFd;
+    m_pendingFd = -1;
+
+    if (fd < 0)
+    {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        QByteArray path = m_socketPath.toLocal8Bit();
+        if (path.size() >= static_cast<qsizetype>(sizeof(address.sun_path)))
+        {
+            QMetaObject::invokeMethod(this, [this]() { emit errorOccurred("Socket path too long"); }, Qt::QueuedConnection);
+            return;
+        }
+        std::memcpy(address.sun_path, path.constData(), path.size());
+
+        fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+        {
+            QString message = QString::fromLocal8Bit(std::strerror(errno));
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            LOG_ERROR("Cannot connect to " << m_socketPath << ": " << message);
+            QMetaObject::invokeMethod(this, [this, message]() { emit errorOccurred(message); }, Qt::QueuedConnection);
+            return;
+        }
+    }
+
+    m_device->adopt(fd);
+    QMetaObject::invokeMethod(this, &Transport::connected, Qt::QueuedConnection);
+}
+
+void SeqPacketTransport::close()
+{
+    if (m_device->isOpen())
+    {
+        m_device->close();
+        emit disconnected();
+    }
+}
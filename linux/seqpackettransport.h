@@ -0,0 +1,77 @@
+#ifndef SEQPACKETTRANSPORT_H
+#define SEQPACKETTRANSPORT_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QQueue>
+
+#include "transport.h"
+
+class QSocketNotifier;
+
+// QIODevice over a connected AF_UNIX SOCK_SEQPACKET socket. Like L2CAP, the
+// socket keeps message boundaries: each write is one message and each read
+// returns at most one.
+//
+// Writes never block. Messages the socket can't take yet are queued, count
+// towards bytesToWrite() and go out when it is writable again, like
+// QBluetoothSocket does.
+class SeqPacketDevice : public QIODevice
+{
+    Q_OBJECT
+public:
+    explicit SeqPacketDevice(QObject *parent = nullptr);
+    ~SeqPacketDevice() override;
+
+    // Takes ownership of fd
+    bool adopt(int fd);
+    int socketDescriptor() const { return m_fd; }
+
+    bool isSequential() const override { return true; }
+    qint64 bytesToWrite() const override { return m_outboxBytes; }
+    void close() override;
+
+signals:
+    void peerClosed();
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 size) override;
+
+private:
+    void closeSocket();
+    void flushOutbox();
+
+    int m_fd = -1;
+    QSocketNotifier *m_notifier = nullptr;
+    QSocketNotifier *m_writeNotifier = nullptr;
+    QQueue<QByteArray> m_outbox;
+    qint64 m_outboxBytes = 0;
+};
+
+// AAP over a local socket, used with the emulator in tools/
+class SeqPacketTransport : public Transport
+{
+    Q_OBJECT
+public:
+    // Connects to the emulator listening on socketPath
+    explicit SeqPacketTransport(const QString &socketPath, QObject *parent = nullptr);
+    // Uses one end of a connected socket pair, see createSocketPair()
+    explicit SeqPacketTransport(int fd, QObject *parent = nullptr);
+
+    static bool createSocketPair(int fds[2]);
+
+    void open() override;
+    void close() override;
+    bool isOpen() const override { return m_device->isOpen(); }
+
+    QIODevice *device() const override { return m_device; }
+    QString peerAddress() const override { return m_socketPath; }
+
+private:
+    QString m_socketPath;
+    int m_pendingFd = -1;
+    SeqPacketDevice *m_device;
+};
+
+#endif // SEQPACKETTRANSPORT_H
@@ -0,0 +1,145 @@
+#include "sessionregistry.h"
+#include "airpodssession.h"
+#include "connectionstatemachine.h"
+#include "logger.h"
+
+SessionRegistry::SessionRegistry(DeviceCache *cache, QObject *parent)
+    : QObject(parent)
+    , m_cache(cache)
+{
+}
+
+void SessionRegistry::start()
+{
+    if (!m_active)
+    {
+        m_active = createSession();
+    }
+}
+
+AirPodsSession *SessionRegistry::createSession()
+{
+    AirPodsSession *session = new AirPodsSession(this);
+    session->setDeviceCache(m_cache);
+    emit sessionCreated(session);
+    return session;
+}
+
+AirPodsSession *SessionRegistry::session(const QString &address) const
+{
+    auto it = m_entries.constFind(address);
+    return it != m_entries.cend() ? it->session : nullptr;
+}
+
+AirPodsSession *SessionRegistry::acquire(const QString &address)
+{
+    start();
+    if (AirPodsSession *existing = session(address))
+    {
+        return existing;
+    }
+
+    Entry entry;
+    if (m_activeAddress.isEmpty())
+    {
+        // The idle session becomes the first pair, the UI is already bound to it
+        entry.session = m_active;
+        m_activeAddress = address;
+    }
+    else
+    {
+        entry.session = createSession();
+    }
+    entry.connection = new ConnectionStateMachine(entry.session, address, this);
+    m_entries.insert(address, entry);
+    m_order.append(address);
+    LOG_INFO("Session for " << address << " added, " << m_order.size() << " in total");
+    emit sessionAdded(address, entry.session);
+    return entry.session;
+}
+
+void SessionRegistry::release(const QString &address)
+{
+    auto it = m_entries.find(address);
+    if (it == m_entries.end())
+    {
+        return;
+    }
+    AirPodsSession *session = it->session;
+    delete it->connection;
+    m_entries.erase(it);
+    m_order.removeOne(address);
+    LOG_INFO("Session for " << address << " removed, " << m_order.size() << " left");
+
+    if (session == m_active)
+    {
+        if (m_order.isEmpty())
+        {
+            // Back to idle, keep the object so the UI stays bound to it
+            session->reset();
+            m_activeAddress.clear();
+            emit sessionRemoved(address);
+            return;
+        }
+        const QString next = m_order.constFirst();
+        makeActive(next, m_entries.value(next).session);
+    }
+    emit sessionRemoved(address);
+    session->deleteLater();
+}
+
+bool SessionRegistry::setActive(const QString &address)
+{
+    AirPodsSession *target = session(address);
+    if (!target)
+    {
+        return false;
+    }
+    if (target != m_active)
+    {
+        makeActive(address, target);
+    }
+    return true;
+}
+
+void SessionRegistry::makeActive(const QString &address, AirPodsSession *session)
+{
+    m_active = session;
+    m_activeAddress = address;
+    LOG_INFO("Active device is now " << address);
+    emit activeChanged(session);
+}
+
+QString SessionRegistry::addressOf(const AirPodsSession *session) const
+{
+    for (auto it = m_entries.cbegin(); it != m_entries.cend(); ++it)
+    {
+        if (it->session == session)
+        {
+            return it.key();
+        }
+    }
+    return QString();
+}
+
+QList<SessionRegistry::Device> SessionRegistry::devices() const
+{
+    QList<Device> devices;
+    devices.reserve(m_order.size());
+    for (const QString &address : m_order)
+    {
+        const AirPodsSession *session = m_entries.value(address).session;
+        Device device;
+        device.address = address;
+        device.name = session->deviceName().isEmpty() ? address : session->deviceName();
+        device.connected = session->isConnected();
+        device.active = session == m_active;
+        devices.append(device);
+    }
+    return devices;
+}
+
+ConnectionStateMachine *SessionRegistry::connection(const QString &address) const
+{
+    return m_entries.value(address).connection;
+}
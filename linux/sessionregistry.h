@@ -0,0 +1,85 @@
+#ifndef SESSIONREGISTRY_H
+#define SESSIONREGISTRY_H
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+
+class AirPodsSession;
+class ConnectionStateMachine;
+class DeviceCache;
+
+// One AirPodsSession per connected pair, keyed by address.
+//
+// Every session has its own transport, state, command queue and connection
+// state machine, so pairs never disturb each other. One of them is active: the
+// one the tray icon, window and media control follow. While nothing is
+// connected an idle session stands in as the active one, so there is
+// always a session to show.
+class SessionRegistry : public QObject
+{
+    Q_OBJECT
+public:
+    struct Device
+    {
+        QString address;
+        QString name;
+        bool connected = false;
+        bool active = false;
+    };
+
+    explicit SessionRegistry(DeviceCache *cache, QObject *parent = nullptr);
+
+    // Makes the idle session, separate from the constructor so sessionCreated can be connected first
+    void start();
+
+    // Never null once started
+    AirPodsSession *active() const { return m_active; }
+    QString activeAddress() const { return m_activeAddress; }
+    bool setActive(const QString &address);
+
+    // Null if the address has no session
+    AirPodsSession *session(const QString &address) const;
+    // The session for the address, made on first use. The idle session is reused for the first pair.
+    AirPodsSession *acquire(const QString &address);
+    // Drops the session, it must be disconnected already
+    void release(const QString &address);
+
+    // In the order the pairs were added
+    const QStringList &addresses() const { return m_order; }
+    int count() const { return m_order.size(); }
+    QString addressOf(const AirPodsSession *session) const;
+    QList<Device> devices() const;
+
+    // Null if the address has no session
+    ConnectionStateMachine *connection(const QString &address) const;
+
+signals:
+    // A new session object, also emitted for the idle session it starts with
+    void sessionCreated(AirPodsSession *session);
+    void sessionAdded(const QString &address, AirPodsSession *session);
+    void sessionRemoved(const QString &address);
+    void activeChanged(AirPodsSession *session);
+
+private:
+    struct Entry
+    {
+        AirPodsSession *session = nullptr;
+        ConnectionStateMachine *connection = nullptr;
+    };
+
+    AirPodsSession *createSession();
+    void makeActive(const QString &address, AirPodsSession *session);
+
+    DeviceCache *m_cache;
+    QHash<QString, Entry> m_entries;
+    QStringList m_order;
+    AirPodsSession *m_active = nullptr;
+    QString m_activeAddress; // Empty while the idle session is active
+};
+
+Q_DECLARE_METATYPE(SessionRegistry::Device)
+
+#endif // SESSIONREGISTRY_H
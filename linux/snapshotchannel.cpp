@@ -0,0 +1,41 @@
+#include "snapshotchannel.h"
+#include "logger.h"
+
+using namespace AirpodsTrayApp;
+
+SnapshotChannel::SnapshotChannel(QObject *parent)
+    : QObject(parent)
+{
+}
+
+void SnapshotChannel::publish(const DeviceSnapshot &snapshot)
+{
+    m_latest.publish(snapshot);
+    if (!m_queue.push(snapshot))
+    {
+        // The consumer reads the latest snapshot once it is back
+        m_overflowed.store(true, std::memory_order_relaxed);
+        m_overflows.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (!m_wakeupPending.exchange(true, std::memory_order_acq_rel))
+    {
+        QMetaObject::invokeMethod(this, &SnapshotChannel::drain, Qt::QueuedConnection);
+    }
+}
+
+void SnapshotChannel::drain()
+{
+    // Cleared first, a snapshot published while draining posts a new wakeup
+    m_wakeupPending.store(false, std::memory_order_release);
+
+    DeviceSnapshot snapshot;
+    while (m_queue.pop(snapshot))
+    {
+        emit received(snapshot);
+    }
+    if (m_overflowed.exchange(false, std::memory_order_acq_rel))
+    {
+        LOG_DEBUG("Snapshot queue overflowed, skipping to the latest state");
+        emit received(m_latest.read());
+    }
+}
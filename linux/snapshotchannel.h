@@ -0,0 +1,46 @@
+#ifndef SNAPSHOTCHANNEL_H
+#define SNAPSHOTCHANNEL_H
+
+#include <QObject>
+#include <atomic>
+
+#include "deviceevents.h"
+#include "seqlock.h"
+#include "spscqueue.h"
+
+// Carries device snapshots from the I/O thread to the thread this object
+// lives on, usually the GUI thread.
+//
+// publish() never blocks and allocates only the wakeup event: the snapshot
+// goes into a bounded lock-free queue, and only the first snapshot after the
+// consumer caught up posts an event to wake it. If the consumer stalls long enough
+// for the queue to fill up, it later gets the latest snapshot instead of
+// every step in between.
+class SnapshotChannel : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SnapshotChannel(QObject *parent = nullptr);
+
+    // Producer thread only
+    void publish(const AirpodsTrayApp::DeviceSnapshot &snapshot);
+
+    // Any thread
+    AirpodsTrayApp::DeviceSnapshot latest() const { return m_latest.read(); }
+    quint64 overflows() const { return m_overflows.load(std::memory_order_relaxed); }
+
+signals:
+    // On this object's thread, in publishing order
+    void received(const AirpodsTrayApp::DeviceSnapshot &snapshot);
+
+private:
+    void drain();
+
+    SpscQueue<AirpodsTrayApp::DeviceSnapshot, 64> m_queue;
+    SeqLock<AirpodsTrayApp::DeviceSnapshot> m_latest;
+    std::atomic<bool> m_wakeupPending{false};
+    std::atomic<bool> m_overflowed{false};
+    std::atomic<quint64> m_overflows{0};
+};
+
+#endif // SNAPSHOTCHANNEL_H
@@ -0,0 +1,129 @@
+#include "startuptimeline.h"
+#include "logger.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <vector>
+
+namespace
+{
+    struct Step
+    {
+        const char *name;
+        qint64 startUs;
+        qint64 durationUs; // -1 for an instant
+    };
+
+    QElapsedTimer s_clock;
+    std::vector<Step> s_steps;
+    QString s_traceFile;
+    bool s_finished = false;
+    QMutex s_mutex; // Steps are marked on the GUI and the I/O thread
+
+    qint64 nowUs()
+    {
+        return s_clock.isValid() ? s_clock.nsecsElapsed() / 1000 : 0;
+    }
+}
+
+void StartupTimeline::begin()
+{
+    s_clock.start();
+    s_steps.reserve(32);
+}
+
+void StartupTimeline::setTraceFile(const QString &path)
+{
+    s_traceFile = path;
+}
+
+qint64 StartupTimeline::elapsedMs()
+{
+    return nowUs() / 1000;
+}
+
+void StartupTimeline::mark(const char *step)
+{
+    record(step, nowUs(), -1);
+}
+
+void StartupTimeline::record(const char *step, qint64 startUs, qint64 durationUs)
+{
+    QMutexLocker locker(&s_mutex);
+    if (s_finished)
+    {
+        return;
+    }
+    s_steps.push_back({step, startUs, durationUs});
+
+    qint64 endMs = (startUs + qMax<qint64>(durationUs, 0)) / 1000;
+    if (durationUs < 0)
+    {
+        LOG_INFO(qPrintable(QString("Startup: %1 after %2 ms").arg(step).arg(endMs)));
+    }
+    else
+    {
+        LOG_INFO(qPrintable(QString("Startup: %1 after %2 ms (took %3 ms)").arg(step).arg(endMs).arg(durationUs / 1000)));
+    }
+}
+
+void StartupTimeline::finish()
+{
+    QMutexLocker locker(&s_mutex);
+    if (s_finished)
+    {
+        return;
+    }
+    s_finished = true;
+    if (s_traceFile.isEmpty())
+    {
+        return;
+    }
+
+    QJsonArray events;
+    for (const Step &step : s_steps)
+    {
+        QJsonObject event{
+            {"name", QString::fromUtf8(step.name)},
+            {"cat", "startup"},
+            {"ts", step.startUs},
+            {"pid", 1},
+            {"tid", 1},
+        };
+        if (step.durationUs < 0)
+        {
+            event["ph"] = "i";
+            event["s"] = "p";
+        }
+        else
+        {
+            event["ph"] = "X";
+            event["dur"] = step.durationUs;
+        }
+        events.append(event);
+    }
+
+    QFile file(s_traceFile);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        LOG_ERROR("Cannot write startup trace to " << s_traceFile << ": " << file.errorString());
+        return;
+    }
+    file.write(QJsonDocument(QJsonObject{{"traceEvents", events}}).toJson(QJsonDocument::Compact));
+    LOG_INFO("Startup trace written to " << s_traceFile);
+}
+
+StartupTimeline::Scope::Scope(const char *step)
+    : m_step(step)
+    , m_startUs(nowUs())
+{
+}
+
+StartupTimeline::Scope::~Scope()
+{
+    StartupTimeline::record(m_step, m_startUs, nowUs() - m_startUs);
+}
@@ -0,0 +1,40 @@
+#ifndef STARTUPTIMELINE_H
+#define STARTUPTIMELINE_H
+
+#include <QString>
+
+// Timestamps of the startup steps, relative to entering main().
+//
+// Every step is logged as "Startup: <step> after <ms> ms". With a trace file
+// set, finish() also writes the steps in Chrome trace event format, to be
+// opened in about:tracing or Perfetto. Main thread only.
+class StartupTimeline
+{
+public:
+    // First thing in main()
+    static void begin();
+    static void setTraceFile(const QString &path);
+
+    static void mark(const char *step);
+    // Startup is over, writes the trace file once, later steps are ignored
+    static void finish();
+
+    static qint64 elapsedMs();
+
+    // Records how long a step took, from construction to destruction
+    class Scope
+    {
+    public:
+        explicit Scope(const char *step);
+        ~Scope();
+
+    private:
+        const char *m_step;
+        qint64 m_startUs;
+    };
+
+private:
+    static void record(const char *step, qint64 startUs, qint64 durationUs);
+};
+
+#endif // STARTUPTIMELINE_H
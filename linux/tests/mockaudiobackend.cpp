@@ -0,0 +1,61 @@
+#include "mockaudiobackend.h"
+
+#include <QTimer>
+
+bool MockAudioBackend::start()
+{
+    QTimer::singleShot(m_latencyMs, this, [this]() { setReady(true); });
+    return true;
+}
+
+void MockAudioBackend::setSinkVolume(const QString &sinkName, int percent)
+{
+    ++m_stats.volumeRequests;
+    QTimer::singleShot(m_latencyMs, this, [this, sinkName, percent]() {
+        const Sink *current = findSink(sinkName);
+        if (!current || m_failRequests)
+        {
+            emit requestFailed(QString("Set sink volume failed: no sink %1").arg(sinkName));
+            return;
+        }
+        Sink sink = *current;
+        sink.volume = qMax(0, percent);
+        updateSink(sink);
+    });
+}
+
+void MockAudioBackend::setCardProfile(const QString &cardName, const QString &profile)
+{
+    ++m_stats.profileRequests;
+    QTimer::singleShot(m_latencyMs, this, [this, cardName, profile]() {
+        const Card *current = findCard(cardName);
+        if (!current || m_failRequests)
+        {
+            emit requestFailed(QString("Set card profile failed: no card %1").arg(cardName));
+            return;
+        }
+        Card card = *current;
+        card.activeProfile = profile;
+        updateCard(card);
+    });
+}
+
+void MockAudioBackend::addCard(const QString &name, const QString &activeProfile)
+{
+    Card card;
+    card.index = m_nextIndex++;
+    card.name = name;
+    card.activeProfile = activeProfile;
+    updateCard(card);
+}
+
+void MockAudioBackend::addSink(const QString &name, const QString &cardName, int volume)
+{
+    Sink sink;
+    sink.index = m_nextIndex++;
+    sink.name = name;
+    const Card *card = findCard(cardName);
+    sink.card = card ? card->index : InvalidIndex;
+    sink.volume = volume;
+    updateSink(sink);
+}
@@ -0,0 +1,44 @@
+#ifndef MOCKAUDIOBACKEND_H
+#define MOCKAUDIOBACKEND_H
+
+#include "../audiobackend.h"
+
+// In-memory sound server. Requests are answered from the event loop after
+// latencyMs, like a real server would, and counted.
+//
+// Test only, stands in for PulseAudioBackend where no sound server may be
+// touched.
+class MockAudioBackend : public AudioBackend
+{
+    Q_OBJECT
+public:
+    struct Stats
+    {
+        int volumeRequests = 0;
+        int profileRequests = 0;
+    };
+
+    using AudioBackend::AudioBackend;
+
+    bool start() override;
+
+    void setSinkVolume(const QString &sinkName, int percent) override;
+    void setCardProfile(const QString &cardName, const QString &profile) override;
+
+    // Server side changes, applied right away
+    void addCard(const QString &name, const QString &activeProfile);
+    void addSink(const QString &name, const QString &cardName, int volume);
+    void setDefaultSink(const QString &name) { setDefaultSinkName(name); }
+
+    void setLatency(int msec) { m_latencyMs = msec; }
+    void setFailRequests(bool fail) { m_failRequests = fail; }
+    const Stats &stats() const { return m_stats; }
+
+private:
+    int m_latencyMs = 0;
+    bool m_failRequests = false;
+    quint32 m_nextIndex = 0;
+    Stats m_stats;
+};
+
+#endif // MOCKAUDIOBACKEND_H
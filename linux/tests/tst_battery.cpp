@@ -0,0 +1,290 @@
+// Battery status parsing: which NOTIFY signals fire for 1, 2 and 3 component
+// packets, and that a packet repeating the current state costs nothing.
+
+#include <QLoggingCategory>
+#include <QSignalSpy>
+#include <QTest>
+#include <atomic>
+#include <cstdlib>
+#include <initializer_list>
+
+#include "../battery.hpp"
+
+Q_LOGGING_CATEGORY(airpodsApp, "airpodsApp")
+
+// Counts heap allocations of the whole process, Qt containers included, by
+// interposing glibc's allocator
+namespace
+{
+    std::atomic<quint64> s_allocations{0};
+}
+
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *pointer, size_t size);
+
+    void *malloc(size_t size)
+    {
+        s_allocations.fetch_add(1, std::memory_order_relaxed);
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size)
+    {
+        s_allocations.fetch_add(1, std::memory_order_relaxed);
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *pointer, size_t size)
+    {
+        s_allocations.fetch_add(1, std::memory_order_relaxed);
+        return __libc_realloc(pointer, size);
+    }
+}
+
+namespace
+{
+    using Component = Battery::Component;
+    using Status = Battery::BatteryStatus;
+
+    struct Part
+    {
+        Component component;
+        quint8 level;
+        Status status;
+    };
+
+    QByteArray batteryPacket(std::initializer_list<Part> parts)
+    {
+        QByteArray packet = QByteArrayView(AirPodsPackets::Parse::BATTERY_STATUS).toByteArray();
+        packet.append(char(parts.size()));
+        for (const Part &part : parts)
+        {
+            packet.append(char(part.component));
+            packet.append(char(0x01));
+            packet.append(char(part.level));
+            packet.append(char(part.status));
+            packet.append(char(0x01));
+        }
+        return packet;
+    }
+
+    // One spy per NOTIFY signal, in Q_PROPERTY order, plus the aggregate one
+    struct Spies
+    {
+        explicit Spies(Battery *battery)
+            : leftLevel(battery, &Battery::leftPodLevelChanged)
+            , leftCharging(battery, &Battery::leftPodChargingChanged)
+            , leftAvailable(battery, &Battery::leftPodAvailableChanged)
+            , rightLevel(battery, &Battery::rightPodLevelChanged)
+            , rightCharging(battery, &Battery::rightPodChargingChanged)
+            , rightAvailable(battery, &Battery::rightPodAvailableChanged)
+            , caseLevel(battery, &Battery::caseLevelChanged)
+            , caseCharging(battery, &Battery::caseChargingChanged)
+            , caseAvailable(battery, &Battery::caseAvailableChanged)
+            , singleLevel(battery, &Battery::singleLevelChanged)
+            , singleCharging(battery, &Battery::singleChargingChanged)
+            , singleAvailable(battery, &Battery::singleAvailableChanged)
+            , any(battery, &Battery::batteryStatusChanged)
+        {
+        }
+
+        QList<int> counts() const
+        {
+            return {int(leftLevel.count()), int(leftCharging.count()), int(leftAvailable.count()),
+                    int(rightLevel.count()), int(rightCharging.count()), int(rightAvailable.count()),
+                    int(caseLevel.count()), int(caseCharging.count()), int(caseAvailable.count()),
+                    int(singleLevel.count()), int(singleCharging.count()), int(singleAvailable.count()),
+                    int(any.count())};
+        }
+
+        QSignalSpy leftLevel, leftCharging, leftAvailable;
+        QSignalSpy rightLevel, rightCharging, rightAvailable;
+        QSignalSpy caseLevel, caseCharging, caseAvailable;
+        QSignalSpy singleLevel, singleCharging, singleAvailable;
+        QSignalSpy any;
+    };
+}
+
+class BatteryTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void threeComponents();
+    void onlyChangedFieldsNotify();
+    void twoComponentsKeepTheCase();
+    void singleComponent();
+    void unknownSingleComponent();
+    void unchangedPacketDoesNotAllocate();
+    void changingPacketDoesNotAllocate();
+    void rejectsMalformedPackets();
+};
+
+void BatteryTest::threeComponents()
+{
+    Battery battery;
+    Spies spies(&battery);
+    QVERIFY(battery.parsePacket(batteryPacket({{Component::Left, 80, Status::Discharging},
+                                               {Component::Right, 70, Status::Discharging},
+                                               {Component::Case, 50, Status::Charging}})));
+
+    // From unknown: every level and availability changes, only the case starts charging
+    QCOMPARE(spies.counts(), (QList<int>{1, 0, 1, 1, 0, 1, 1, 1, 1, 0, 0, 0, 1}));
+    QCOMPARE(battery.getLeftPodLevel(), quint8(80));
+    QCOMPARE(battery.getRightPodLevel(), quint8(70));
+    QCOMPARE(battery.getCaseLevel(), quint8(50));
+    QVERIFY(battery.isCaseCharging());
+    QCOMPARE(battery.getPrimaryPod(), Component::Left);
+}
+
+void BatteryTest::onlyChangedFieldsNotify()
+{
+    Battery battery;
+    QVERIFY(battery.parsePacket(batteryPacket({{Component::Right, 70, Status::Discharging},
+                                               {Component::Left, 80, Status::Discharging},
+                                               {Component::Case, 50, Status::Charging}})));
+    QCOMPARE(battery.getPrimaryPod(), Component::Right);
+
+    Spies spies(&battery);
+    QSignalSpy primary(&battery, &Battery::primaryChanged);
+
+    // The same state again notifies nothing
+    QVERIFY(battery.parsePacket(batteryPacket({{Component::Right, 70, Status::Discharging},
+                                               {Component::Left, 80, Status::Discharging},
+                                               {Component::Case, 50, Status::Charging}})));
+    QCOMPARE(spies.counts(), (QList<int>{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}));
+    QCOMPARE(battery.lastChanges(), quint16(0));
+
+    // Left drops a percent and starts charging, the pods swap roles
+    QVERIFY(battery.parsePacket(batteryPacket({{Component::Left, 79, Status::Charging},
+                                               {Component::Right, 70, Status::Discharging},
+                                               {Component::Case, 50, Status::Charging}})));
+    QCOMPARE(spies.counts(), (QList<int>{1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1}));
+    QCOMPARE(battery.lastChanges(), quint16(Battery::LeftLevelChanged | Battery::LeftChargingChanged));
+    QCOMPARE(primary.count(), 1);
+    QCOMPARE(battery.getPrimaryPod(), Component::Left);
+    QCOMPARE(battery.getSecondaryPod(), Component::Right);
+}
+
+void BatteryTest::twoComponentsKeepTheCase()
+{
+    Battery battery;
+    QVERIFY(battery.parsePacket(batteryPacket({{Component::Left, 80, Status::Discharging},
+                                               {Component::Right, 70, Status::Discharging},
+                                               {Component::Case, 50, Status::Charging}})));
+
+    // Case out of range: the packet only has the pods, the case keeps its last state
+    Spies spies(&battery);
+    QVERIFY(battery.parsePacket(batteryPacket({{Component::Left, 80, Status::Discharging},
+                                               {Component::Right, 69, Status::Discharging}})));
+    QCOMPARE(spies.counts(), (QList<int>{0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 1}));
+    QCOMPARE(battery.getCaseLevel(), quint8(50));
+    QVERIFY(battery.isCaseAvailable());
+}
+
+void BatteryTest::singleComponent()
+{
+    // AirPods Max: one component, no pod or case property changes
+    Battery battery;
+    Spies spies(&battery);
+    QVERIFY(battery.parsePacket(batteryPacket({{Component::Single, 60, Status::Discharging}})));
+    QCOMPARE(spies.counts(), (QList<int>{0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 1}));
+    QCOMPARE(battery.lastChanges(), quint16(Battery::SingleLevelChanged | Battery::SingleAvailableChanged));
+    QCOMPARE(battery.getSingleLevel(), quint8(60));
+    QVERIFY(battery.isSingleAvailable());
+    QVERIFY(!battery.isLeftPodAvailable());
+
+    QVERIFY(battery.parsePacket(batteryPacket({{Component::Single, 60, Status::Discharging}})));
+    QCOMPARE(spies.any.count(), 1);
+
+    QVERIFY(battery.parsePacket(batteryPacket({{Component::Single, 60, Status::Charging}})));
+    QCOMPARE(spies.counts(), (QList<int>{0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 2}));
+    QVERIFY(battery.isSingleCharging());
+}
+
+void BatteryTest::unknownSingleComponent()
+{
+    // Undocumented component types are only taken as the single battery when alone
+    Battery battery;
+    QVERIFY(battery.parsePacket(batteryPacket({{Component(0x10), 55, Status::Discharging}})));
+    QCOMPARE(battery.getSingleLevel(), quint8(55));
+
+    Battery pods;
+    QVERIFY(pods.parsePacket(batteryPacket({{Component::Left, 80, Status::Discharging},
+                                            {Component(0x10), 55, Status::Discharging}})));
+    QVERIFY(!pods.isSingleAvailable());
+    QCOMPARE(pods.getLeftPodLevel(), quint8(80));
+}
+
+void BatteryTest::unchangedPacketDoesNotAllocate()
+{
+    const QByteArray packets[] = {
+        batteryPacket({{Component::Single, 60, Status::Discharging}}),
+        batteryPacket({{Component::Left, 80, Status::Discharging}, {Component::Right, 70, Status::Charging}}),
+        batteryPacket({{Component::Left, 80, Status::Discharging},
+                       {Component::Right, 70, Status::Charging},
+                       {Component::Case, 50, Status::Charging}}),
+    };
+    for (const QByteArray &packet : packets)
+    {
+        // Connected like QML would be, without spies recording anything
+        Battery battery;
+        int notified = 0;
+        connect(&battery, &Battery::batteryStatusChanged, this, [&notified]() { ++notified; });
+        QVERIFY(battery.parsePacket(packet));
+        QCOMPARE(notified, 1);
+
+        const quint64 before = s_allocations.load(std::memory_order_relaxed);
+        for (int i = 0; i < 1000; ++i)
+        {
+            battery.parsePacket(packet);
+        }
+        QCOMPARE(s_allocations.load(std::memory_order_relaxed) - before, quint64(0));
+        QCOMPARE(notified, 1);
+    }
+}
+
+void BatteryTest::changingPacketDoesNotAllocate()
+{
+    // Levels and charging states that change with every packet, like a pair in the case
+    const QByteArray packets[] = {
+        batteryPacket({{Component::Left, 80, Status::Discharging},
+                       {Component::Right, 70, Status::Charging},
+                       {Component::Case, 50, Status::Charging}}),
+        batteryPacket({{Component::Left, 81, Status::Charging},
+                       {Component::Right, 69, Status::Discharging},
+                       {Component::Case, 49, Status::Discharging}}),
+    };
+    Battery battery;
+    int notified = 0;
+    int levelNotified = 0;
+    connect(&battery, &Battery::batteryStatusChanged, this, [&notified]() { ++notified; });
+    connect(&battery, &Battery::leftPodLevelChanged, this, [&levelNotified]() { ++levelNotified; });
+    QVERIFY(battery.parsePacket(packets[0]));
+
+    const quint64 before = s_allocations.load(std::memory_order_relaxed);
+    for (int i = 1; i <= 1000; ++i)
+    {
+        battery.parsePacket(packets[i % 2]);
+    }
+    QCOMPARE(s_allocations.load(std::memory_order_relaxed) - before, quint64(0));
+    QCOMPARE(notified, 1001);
+    QCOMPARE(levelNotified, 1001);
+}
+
+void BatteryTest::rejectsMalformedPackets()
+{
+    Battery battery;
+    Spies spies(&battery);
+    QByteArray packet = batteryPacket({{Component::Left, 80, Status::Discharging}});
+    QVERIFY(!battery.parsePacket(packet.left(packet.size() - 1)));
+    packet[AirPodsPackets::Parse::BATTERY_STATUS.size()] = 4; // More components than there are
+    QVERIFY(!battery.parsePacket(packet));
+    QCOMPARE(spies.any.count(), 0);
+}
+
+QTEST_GUILESS_MAIN(BatteryTest)
+#include "tst_battery.moc"
@@ -0,0 +1,211 @@
+// The protocol keeps going while either side of it stalls: a session on its
+// own I/O thread, like the app runs it, handles ear detection changes on
+// time while the thread standing in for the GUI hangs, and writes to a peer
+// that stopped reading never block.
+
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+#include <QScopeGuard>
+#include <QTest>
+#include <QThread>
+#include <atomic>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../airpodssession.h"
+#include "../seqpackettransport.h"
+#include "../snapshotchannel.h"
+#include "../tools/airpodsemulator.h"
+
+Q_LOGGING_CATEGORY(airpodsApp, "airpodsApp")
+
+namespace
+{
+    constexpr int EarIntervalMs = 10;
+    constexpr int StallMs = 1000;
+    // Measured against the stall rather than the interval, so a loaded machine
+    // still passes: a handler waiting on the stalled thread would handle
+    // nothing and sit idle for all of it.
+    constexpr int ExpectedDuringStall = StallMs / EarIntervalMs;
+    constexpr int MinHandledDuringStall = ExpectedDuringStall / 10;
+    constexpr int MaxGapMs = StallMs / 2;
+    // Writes that waited for the peer would never finish, this only has to be finite
+    constexpr int WriteDeadlineMs = 5000;
+}
+
+class IoStallTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void consumerStallKeepsHandlingEarDetection();
+    void stalledPeerDoesNotBlockWrites();
+
+private:
+    QThread *m_emulatorThread = nullptr;
+    QThread *m_ioThread = nullptr;
+};
+
+void IoStallTest::init()
+{
+    m_emulatorThread = new QThread(this);
+    m_emulatorThread->setObjectName("emulator");
+    m_emulatorThread->start();
+    m_ioThread = new QThread(this);
+    m_ioThread->setObjectName("aap-io");
+    m_ioThread->start();
+}
+
+void IoStallTest::cleanup()
+{
+    for (QThread *thread : {m_ioThread, m_emulatorThread})
+    {
+        thread->quit();
+        thread->wait();
+        delete thread;
+    }
+    m_ioThread = nullptr;
+    m_emulatorThread = nullptr;
+}
+
+void IoStallTest::consumerStallKeepsHandlingEarDetection()
+{
+    int fds[2];
+    QVERIFY(SeqPacketTransport::createSocketPair(fds));
+
+    // The socket notifiers have to be created on the threads that use them
+    AirPodsEmulator::Config config;
+    config.earDetectionIntervalMs = EarIntervalMs;
+    AirPodsEmulator *emulator = new AirPodsEmulator(config);
+    emulator->moveToThread(m_emulatorThread);
+    QMetaObject::invokeMethod(emulator, [emulator, fd = fds[1]]() {
+        SeqPacketDevice *device = new SeqPacketDevice(emulator);
+        device->adopt(fd);
+        emulator->attach(device);
+    }, Qt::BlockingQueuedConnection);
+
+    AirPodsSession *session = new AirPodsSession();
+    session->moveToThread(m_ioThread);
+    SnapshotChannel channel;
+
+    // Filled on the I/O thread, read here once the count is published
+    QElapsedTimer clock;
+    clock.start();
+    std::vector<qint64> handledAtMs(StallMs / EarIntervalMs * 4 + 1024);
+    std::atomic<size_t> handledCount{0};
+    std::atomic<bool> ready{false};
+    connect(session, &AirPodsSession::ready, session, [&ready]() { ready = true; });
+    connect(session, &AirPodsSession::earDetectionChanged, session, [&]() {
+        size_t index = handledCount.load(std::memory_order_relaxed);
+        if (index < handledAtMs.size())
+        {
+            handledAtMs[index] = clock.elapsed();
+            handledCount.store(index + 1, std::memory_order_release);
+        }
+    });
+    connect(session, &AirPodsSession::snapshotPublished, session,
+            [&channel](const AirpodsTrayApp::DeviceSnapshot &snapshot) { channel.publish(snapshot); });
+    AirpodsTrayApp::DeviceSnapshot seen;
+    connect(&channel, &SnapshotChannel::received, &channel,
+            [&seen](const AirpodsTrayApp::DeviceSnapshot &snapshot) { seen = snapshot; });
+
+    // Before the state the handlers above point to goes away, even when a check fails
+    auto teardown = qScopeGuard([session, emulator]() {
+        QMetaObject::invokeMethod(session, [session]() { delete session; }, Qt::BlockingQueuedConnection);
+        QMetaObject::invokeMethod(emulator, [emulator]() { delete emulator; }, Qt::BlockingQueuedConnection);
+    });
+
+    QMetaObject::invokeMethod(session, [session, fd = fds[0]]() {
+        SeqPacketTransport *transport = new SeqPacketTransport(fd);
+        session->setTransport(transport);
+        transport->open();
+    }, Qt::BlockingQueuedConnection);
+
+    QTRY_VERIFY_WITH_TIMEOUT(ready.load(), 5000);
+    // Let the ear detection notifications get going
+    QTRY_VERIFY(handledCount.load(std::memory_order_acquire) >= 5);
+
+    // This thread hangs like a GUI stuck in a slow paint
+    const size_t before = handledCount.load(std::memory_order_acquire);
+    const qint64 stallStart = clock.elapsed();
+    QThread::msleep(StallMs);
+    const qint64 stallEnd = clock.elapsed();
+    const size_t after = handledCount.load(std::memory_order_acquire);
+    const quint64 versionAtEnd = session->snapshot().version;
+
+    qint64 last = stallStart;
+    qint64 worstGapMs = 0;
+    size_t handled = 0;
+    for (size_t k = before; k < after && handledAtMs[k] <= stallEnd; ++k)
+    {
+        worstGapMs = qMax(worstGapMs, handledAtMs[k] - last);
+        last = handledAtMs[k];
+        ++handled;
+    }
+    worstGapMs = qMax(worstGapMs, stallEnd - last);
+    const QString progress = QString("%1 of %2 ear detection changes handled during the stall, longest gap %3 ms")
+                                 .arg(handled)
+                                 .arg(ExpectedDuringStall)
+                                 .arg(worstGapMs);
+    QVERIFY2(handled >= size_t(MinHandledDuringStall), qPrintable(progress));
+    QVERIFY2(worstGapMs <= MaxGapMs, qPrintable(progress));
+
+    // Back from the stall, the queued wakeup delivers what was missed
+    QTRY_VERIFY(seen.version >= versionAtEnd);
+}
+
+void IoStallTest::stalledPeerDoesNotBlockWrites()
+{
+    int fds[2];
+    QVERIFY(SeqPacketTransport::createSocketPair(fds));
+    SeqPacketDevice device;
+    QVERIFY(device.adopt(fds[0]));
+    qint64 written = 0;
+    connect(&device, &QIODevice::bytesWritten, this, [&written](qint64 bytes) { written += bytes; });
+
+    // Far more than the socket buffer holds, the peer reads nothing meanwhile
+    constexpr int Messages = 4096;
+    QByteArray message(1024, 'x');
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < Messages; ++i)
+    {
+        std::memcpy(message.data(), &i, sizeof(i));
+        QCOMPARE(device.write(message), qint64(message.size()));
+    }
+    QVERIFY2(timer.elapsed() <= WriteDeadlineMs, qPrintable(QString("Writes took %1 ms").arg(timer.elapsed())));
+    QVERIFY(device.bytesToWrite() > 0);
+    QCOMPARE(written + device.bytesToWrite(), qint64(Messages) * message.size());
+
+    // Once the peer reads again, everything arrives in order
+    char buffer[2048];
+    int received = 0;
+    timer.restart();
+    while (received < Messages && timer.elapsed() < WriteDeadlineMs)
+    {
+        ssize_t size = ::recv(fds[1], buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (size < 0)
+        {
+            QCoreApplication::processEvents();
+            continue;
+        }
+        QCOMPARE(size, ssize_t(message.size()));
+        int sequence;
+        std::memcpy(&sequence, buffer, sizeof(sequence));
+        QCOMPARE(sequence, received);
+        ++received;
+    }
+    QCOMPARE(received, Messages);
+    QCOMPARE(device.bytesToWrite(), qint64(0));
+    QCOMPARE(written, qint64(Messages) * message.size());
+
+    device.close();
+    ::close(fds[1]);
+}
+
+QTEST_GUILESS_MAIN(IoStallTest)
+#include "tst_iostall.moc"
@@ -0,0 +1,160 @@
+// AudioBackend cache through MockAudioBackend: server side changes update the
+// cache and notify once, requests only show up after the event loop ran.
+
+#include <QLoggingCategory>
+#include <QSignalSpy>
+#include <QTest>
+
+#include "mockaudiobackend.h"
+
+Q_LOGGING_CATEGORY(airpodsApp, "airpodsApp")
+
+class MockAudioBackendTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void becomesReadyAsynchronously();
+    void cacheFollowsServerChanges();
+    void defaultSink();
+    void sinkVolumeIsAsynchronous();
+    void cardProfileIsAsynchronous();
+    void failedRequestsLeaveTheCache();
+};
+
+void MockAudioBackendTest::becomesReadyAsynchronously()
+{
+    MockAudioBackend backend;
+    QSignalSpy ready(&backend, &AudioBackend::readyChanged);
+    QVERIFY(backend.start());
+    QVERIFY(!backend.isReady());
+    QVERIFY(ready.wait());
+    QVERIFY(backend.isReady());
+    QCOMPARE(ready.count(), 1);
+}
+
+void MockAudioBackendTest::cacheFollowsServerChanges()
+{
+    MockAudioBackend backend;
+    QSignalSpy cards(&backend, &AudioBackend::cardChanged);
+    QSignalSpy sinks(&backend, &AudioBackend::sinkChanged);
+
+    backend.addCard("bluez_card.AA", "a2dp-sink");
+    QCOMPARE(cards.count(), 1);
+    QCOMPARE(cards.takeFirst().at(0).toString(), QString("bluez_card.AA"));
+    const AudioBackend::Card *card = backend.findCard("bluez_card.AA");
+    QVERIFY(card);
+    QCOMPARE(card->activeProfile, QString("a2dp-sink"));
+
+    backend.addSink("bluez_sink.AA", "bluez_card.AA", 40);
+    QCOMPARE(sinks.count(), 1);
+    QCOMPARE(sinks.takeFirst().at(0).toString(), QString("bluez_sink.AA"));
+    const AudioBackend::Sink *sink = backend.findSink("bluez_sink.AA");
+    QVERIFY(sink);
+    QCOMPARE(sink->card, card->index);
+    QCOMPARE(sink->volume, 40);
+
+    // A sink without a known card still gets cached
+    backend.addSink("alsa_output.pci", "missing", 70);
+    QCOMPARE(sinks.count(), 1);
+    QCOMPARE(backend.findSink("alsa_output.pci")->card, AudioBackend::InvalidIndex);
+
+    QVERIFY(!backend.findSink("missing"));
+    QVERIFY(!backend.findCard("missing"));
+}
+
+void MockAudioBackendTest::defaultSink()
+{
+    MockAudioBackend backend;
+    backend.addSink("bluez_sink.AA", QString(), 40);
+    QVERIFY(!backend.defaultSink());
+
+    QSignalSpy changed(&backend, &AudioBackend::defaultSinkChanged);
+    backend.setDefaultSink("bluez_sink.AA");
+    QCOMPARE(changed.count(), 1);
+    QCOMPARE(backend.defaultSinkName(), QString("bluez_sink.AA"));
+    QVERIFY(backend.defaultSink());
+    QCOMPARE(backend.defaultSink()->volume, 40);
+
+    // Setting it again notifies nothing
+    backend.setDefaultSink("bluez_sink.AA");
+    QCOMPARE(changed.count(), 1);
+
+    // Unknown until the server reports the sink
+    backend.setDefaultSink("bluez_sink.BB");
+    QCOMPARE(changed.count(), 2);
+    QVERIFY(!backend.defaultSink());
+}
+
+void MockAudioBackendTest::sinkVolumeIsAsynchronous()
+{
+    MockAudioBackend backend;
+    backend.setLatency(10);
+    backend.addSink("bluez_sink.AA", QString(), 40);
+    QSignalSpy sinks(&backend, &AudioBackend::sinkChanged);
+
+    backend.setSinkVolume("bluez_sink.AA", 25);
+    QCOMPARE(backend.stats().volumeRequests, 1);
+    QCOMPARE(backend.findSink("bluez_sink.AA")->volume, 40);
+    QCOMPARE(sinks.count(), 0);
+
+    QVERIFY(sinks.wait());
+    QCOMPARE(sinks.count(), 1);
+    QCOMPARE(sinks.at(0).at(0).toString(), QString("bluez_sink.AA"));
+    QCOMPARE(backend.findSink("bluez_sink.AA")->volume, 25);
+
+    // The volume it already has: the request counts, the cache doesn't notify
+    backend.setSinkVolume("bluez_sink.AA", 25);
+    QCOMPARE(backend.stats().volumeRequests, 2);
+    QVERIFY(!sinks.wait(100));
+    QCOMPARE(sinks.count(), 1);
+}
+
+void MockAudioBackendTest::cardProfileIsAsynchronous()
+{
+    MockAudioBackend backend;
+    backend.setLatency(10);
+    backend.addCard("bluez_card.AA", "a2dp-sink");
+    QSignalSpy cards(&backend, &AudioBackend::cardChanged);
+
+    backend.setCardProfile("bluez_card.AA", "headset-head-unit");
+    QCOMPARE(backend.stats().profileRequests, 1);
+    QCOMPARE(backend.findCard("bluez_card.AA")->activeProfile, QString("a2dp-sink"));
+    QCOMPARE(cards.count(), 0);
+
+    QVERIFY(cards.wait());
+    QCOMPARE(cards.count(), 1);
+    QCOMPARE(backend.findCard("bluez_card.AA")->activeProfile, QString("headset-head-unit"));
+}
+
+void MockAudioBackendTest::failedRequestsLeaveTheCache()
+{
+    MockAudioBackend backend;
+    backend.addCard("bluez_card.AA", "a2dp-sink");
+    backend.addSink("bluez_sink.AA", "bluez_card.AA", 40);
+    QSignalSpy failed(&backend, &AudioBackend::requestFailed);
+    QSignalSpy sinks(&backend, &AudioBackend::sinkChanged);
+    QSignalSpy cards(&backend, &AudioBackend::cardChanged);
+
+    // Unknown names fail like the server would
+    backend.setSinkVolume("missing", 10);
+    QVERIFY(failed.wait());
+    backend.setCardProfile("missing", "off");
+    QVERIFY(failed.wait());
+
+    // And so does everything once the server rejects requests
+    backend.setFailRequests(true);
+    backend.setSinkVolume("bluez_sink.AA", 10);
+    QVERIFY(failed.wait());
+    backend.setCardProfile("bluez_card.AA", "off");
+    QVERIFY(failed.wait());
+
+    QCOMPARE(failed.count(), 4);
+    QCOMPARE(sinks.count(), 0);
+    QCOMPARE(cards.count(), 0);
+    QCOMPARE(backend.findSink("bluez_sink.AA")->volume, 40);
+    QCOMPARE(backend.findCard("bluez_card.AA")->activeProfile, QString("a2dp-sink"));
+}
+
+QTEST_GUILESS_MAIN(MockAudioBackendTest)
+#include "tst_mockaudiobackend.moc"
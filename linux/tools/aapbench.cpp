@@ -0,0 +1,349 @@
+// Connects AirPodsSession to an in-process emulator over a socket pair and
+// measures how long the handshake takes and how fast notifications are parsed.
+//
+//   aapbench [--connections N] [--flood N] [--readers N] [--sessions N]
+//            [--delay MS] [--drop P] [--split] [--busy MS] [--serial] [--debug]
+//
+// The emulator runs on its own thread, so both ends of the protocol are real
+// and the numbers include the socket and event loop round trips. --serial
+// sends the handshake one packet at a time instead of pipelined, to compare
+// the two, and --busy makes the emulator ignore a pipelined handshake. During the
+// flood --readers threads keep copying AirPodsSession::snapshot(), which
+// shows what a reader pays while the parser publishes at full rate. --sessions
+// keeps N pairs connected at once through SessionRegistry and reports the
+// memory and CPU time each one costs. The emulators run in the same process,
+// so those numbers are an upper bound.
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QLoggingCategory>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../airpodssession.h"
+#include "../logger.h"
+#include "../seqpackettransport.h"
+#include "../sessionregistry.h"
+#include "airpodsemulator.h"
+
+Q_LOGGING_CATEGORY(airpodsApp, "airpodsApp")
+
+namespace
+{
+    // Runs the event loop until signal fires or timeoutMs passes
+    template <typename Sender, typename Signal>
+    bool waitFor(Sender *sender, Signal signal, int timeoutMs)
+    {
+        QEventLoop loop;
+        bool fired = false;
+        QObject::connect(sender, signal, &loop, [&]() { fired = true; loop.quit(); });
+        QTimer::singleShot(timeoutMs, &loop, &QEventLoop::quit);
+        loop.exec();
+        return fired;
+    }
+
+    QString summarize(std::vector<qint64> values)
+    {
+        values.erase(std::remove(values.begin(), values.end(), -1), values.end());
+        if (values.empty()) {
+            return "n/a";
+        }
+        std::sort(values.begin(), values.end());
+        return QString("min %1 / median %2 / max %3 ms")
+            .arg(values.front())
+            .arg(values[values.size() / 2])
+            .arg(values.back());
+    }
+
+    // Resident set size in KiB
+    qint64 residentKiB()
+    {
+        FILE *statm = std::fopen("/proc/self/statm", "r");
+        if (!statm) {
+            return -1;
+        }
+        long size = 0, resident = 0;
+        int fields = std::fscanf(statm, "%ld %ld", &size, &resident);
+        std::fclose(statm);
+        return fields == 2 ? qint64(resident) * sysconf(_SC_PAGESIZE) / 1024 : -1;
+    }
+
+    // User and system time of this process, both threads included
+    double cpuMs()
+    {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0
+            + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+    }
+
+    struct ReaderStats
+    {
+        quint64 reads = 0;
+        quint64 versionsSeen = 0;
+        quint64 torn = 0; // Copies that can't come from a single publish
+        double nsPerRead = 0;
+    };
+
+    // Copies the snapshot until stop is set
+    void readSnapshots(const AirPodsSession *session, const std::atomic<bool> *stop, ReaderStats *stats)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        quint64 lastVersion = 0;
+        while (!stop->load(std::memory_order_relaxed)) {
+            const AirpodsTrayApp::DeviceSnapshot snapshot = session->snapshot();
+            ++stats->reads;
+            if (snapshot.version != lastVersion) {
+                ++stats->versionsSeen;
+                // The emulator floods with the left level cycling through 1..100
+                if (snapshot.version < lastVersion || snapshot.battery.left > 100) {
+                    ++stats->torn;
+                }
+                lastVersion = snapshot.version;
+            }
+        }
+        stats->nsPerRead = double(timer.nsecsElapsed()) / qMax<quint64>(1, stats->reads);
+    }
+
+    AirPodsEmulator *startEmulator(const AirPodsEmulator::Config &config, QThread *thread, int fd)
+    {
+        // The socket notifier has to be created on the thread that uses it
+        AirPodsEmulator *emulator = new AirPodsEmulator(config);
+        emulator->moveToThread(thread);
+        QMetaObject::invokeMethod(emulator, [emulator, fd]() {
+            SeqPacketDevice *device = new SeqPacketDevice(emulator);
+            device->adopt(fd);
+            emulator->attach(device);
+        }, Qt::BlockingQueuedConnection);
+        return emulator;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    AirPodsEmulator::Config config;
+    int connections = 20;
+    int floodCount = 100000;
+    int sessionCount = 0;
+    int readerCount = 2;
+    bool serialHandshake = false;
+    bool debugMode = false;
+    const QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        if (args[i] == "--connections" && i + 1 < args.size()) {
+            connections = qMax(1, args[++i].toInt());
+        } else if (args[i] == "--flood" && i + 1 < args.size()) {
+            floodCount = qMax(0, args[++i].toInt());
+        } else if (args[i] == "--readers" && i + 1 < args.size()) {
+            readerCount = qMax(0, args[++i].toInt());
+        } else if (args[i] == "--sessions" && i + 1 < args.size()) {
+            sessionCount = qMax(0, args[++i].toInt());
+        } else if (args[i] == "--delay" && i + 1 < args.size()) {
+            config.responseDelayMs = args[++i].toInt();
+        } else if (args[i] == "--drop" && i + 1 < args.size()) {
+            config.dropProbability = args[++i].toDouble();
+        } else if (args[i] == "--split") {
+            config.splitFrames = true;
+        } else if (args[i] == "--busy" && i + 1 < args.size()) {
+            config.handshakeBusyMs = args[++i].toInt();
+        } else if (args[i] == "--serial") {
+            serialHandshake = true;
+        } else if (args[i] == "--debug") {
+            debugMode = true;
+        } else {
+            err << "Usage: aapbench [--connections N] [--flood N] [--readers N] [--sessions N] [--delay MS] [--drop P] [--split] [--busy MS] [--serial] [--debug]\n";
+            return 2;
+        }
+    }
+    QLoggingCategory::setFilterRules(debugMode ? "airpodsApp.debug=true" : "airpodsApp.debug=false");
+
+    QThread emulatorThread;
+    emulatorThread.setObjectName("emulator");
+    emulatorThread.start();
+
+    AirPodsSession session;
+    std::vector<qint64> handshakeAck, featuresAck, ready;
+    int pipelined = 0;
+    int resends = 0;
+    int failures = 0;
+    double floodSeconds = 0;
+    quint64 floodFrames = 0;
+    double idleReadNs = 0;
+    std::vector<ReaderStats> readerStats(readerCount);
+
+    for (int i = 0; i < connections; ++i) {
+        int fds[2];
+        if (!SeqPacketTransport::createSocketPair(fds)) {
+            err << "Cannot create socket pair\n";
+            return 1;
+        }
+
+        AirPodsEmulator *emulator = startEmulator(config, &emulatorThread, fds[1]);
+
+        SeqPacketTransport *transport = new SeqPacketTransport(fds[0]);
+        session.handshake()->setPipelined(!serialHandshake);
+        session.setTransport(transport);
+        transport->open();
+
+        if (!waitFor(&session, &AirPodsSession::ready, 5000 + config.responseDelayMs * 4 + config.handshakeBusyMs)) {
+            ++failures;
+        } else {
+            const AirPodsSession::HandshakeTimings &timings = session.handshakeTimings();
+            handshakeAck.push_back(timings.handshakeAckMs);
+            featuresAck.push_back(timings.featuresAckMs);
+            ready.push_back(timings.readyMs);
+            pipelined += timings.pipelined;
+            resends += timings.resends;
+
+            // Throughput on the last connection only, the others measure setup
+            if (i == connections - 1 && floodCount > 0) {
+                // Reader cost without a writer, for comparison
+                const int idleReads = 1000000;
+                QElapsedTimer idleTimer;
+                idleTimer.start();
+                quint64 checksum = 0;
+                for (int read = 0; read < idleReads; ++read) {
+                    checksum += session.snapshot().version;
+                }
+                idleReadNs = double(idleTimer.nsecsElapsed()) / idleReads;
+                Q_UNUSED(checksum);
+
+                std::atomic<bool> stopReaders{false};
+                std::vector<std::thread> readers;
+                for (ReaderStats &stats : readerStats) {
+                    readers.emplace_back(readSnapshots, &session, &stopReaders, &stats);
+                }
+
+                quint64 received = 0;
+                QEventLoop loop;
+                QMetaObject::Connection counter = QObject::connect(&session, &AirPodsSession::frameReceived, &loop, [&]() {
+                    if (++received == quint64(floodCount)) {
+                        loop.quit();
+                    }
+                });
+                QElapsedTimer timer;
+                timer.start();
+                QMetaObject::invokeMethod(emulator, [emulator, floodCount]() { emulator->flood(floodCount); });
+                QTimer::singleShot(60000, &loop, &QEventLoop::quit);
+                loop.exec();
+                floodSeconds = qMax<qint64>(1, timer.nsecsElapsed()) / 1e9;
+                floodFrames = received;
+                QObject::disconnect(counter);
+
+                stopReaders = true;
+                for (std::thread &reader : readers) {
+                    reader.join();
+                }
+            }
+        }
+
+        session.setTransport(nullptr);
+        session.reset();
+        QMetaObject::invokeMethod(emulator, &QObject::deleteLater);
+    }
+
+    // Pairs kept connected side by side, as the registry holds them in the app
+    int sessionsReady = 0;
+    qint64 rssBefore = 0, rssAfter = 0;
+    double setupCpuMs = 0, idleCpuMs = 0;
+    const int idleMs = 2000;
+    if (sessionCount > 0) {
+        SessionRegistry registry(nullptr);
+        registry.start();
+        std::vector<AirPodsEmulator *> emulators;
+        rssBefore = residentKiB();
+        double cpuBefore = cpuMs();
+
+        QEventLoop loop;
+        for (int i = 0; i < sessionCount; ++i) {
+            int fds[2];
+            if (!SeqPacketTransport::createSocketPair(fds)) {
+                err << "Cannot create socket pair\n";
+                break;
+            }
+            emulators.push_back(startEmulator(config, &emulatorThread, fds[1]));
+            AirPodsSession *session = registry.acquire(QString("session-%1").arg(i));
+            QObject::connect(session, &AirPodsSession::ready, &loop, [&]() {
+                if (++sessionsReady == sessionCount) {
+                    loop.quit();
+                }
+            });
+            SeqPacketTransport *transport = new SeqPacketTransport(fds[0]);
+            session->setTransport(transport);
+            transport->open();
+        }
+        QTimer::singleShot(10000 + config.responseDelayMs * 4, &loop, &QEventLoop::quit);
+        if (sessionsReady < sessionCount) {
+            loop.exec();
+        }
+        setupCpuMs = cpuMs() - cpuBefore;
+        rssAfter = residentKiB();
+
+        // Connected and quiet, what the sessions cost just by existing
+        double idleBefore = cpuMs();
+        QTimer::singleShot(idleMs, &loop, &QEventLoop::quit);
+        loop.exec();
+        idleCpuMs = cpuMs() - idleBefore;
+
+        for (const QString &address : QStringList(registry.addresses())) {
+            registry.session(address)->setTransport(nullptr);
+            registry.release(address);
+        }
+        for (AirPodsEmulator *emulator : emulators) {
+            QMetaObject::invokeMethod(emulator, &QObject::deleteLater);
+        }
+    }
+
+    emulatorThread.quit();
+    emulatorThread.wait();
+
+    out << "Connections:         " << connections << " (" << failures << " never became ready)\n";
+    out << "  handshake ack:     " << summarize(handshakeAck) << "\n";
+    out << "  features ack:      " << summarize(featuresAck) << "\n";
+    out << "  ready:             " << summarize(ready) << "\n";
+    out << "  handshakes:        " << pipelined << " pipelined, " << int(handshakeAck.size()) - pipelined << " serial, "
+        << resends << " resends\n";
+    if (floodCount > 0) {
+        const PacketFramer::Stats &framerStats = session.framerStats();
+        out << "Notifications:       " << floodFrames << " of " << floodCount << " in "
+            << QString::number(floodSeconds * 1000, 'f', 1) << " ms\n";
+        out << "  throughput:        " << QString::number(floodFrames / floodSeconds, 'f', 0) << " frames/s, "
+            << QString::number(floodSeconds * 1e9 / qMax<quint64>(1, floodFrames), 'f', 1) << " ns/frame\n";
+        out << "  split / merged:    " << framerStats.framesSplit << " / " << framerStats.framesMerged << "\n";
+        out << "Snapshot reads:      " << QString::number(idleReadNs, 'f', 1) << " ns without a writer\n";
+        for (size_t reader = 0; reader < readerStats.size(); ++reader) {
+            const ReaderStats &stats = readerStats[reader];
+            out << "  reader " << reader << ":          " << QString::number(stats.nsPerRead, 'f', 1) << " ns/read during the flood, "
+                << stats.reads << " reads, " << stats.versionsSeen << " versions seen, " << stats.torn << " torn\n";
+            if (stats.torn) {
+                ++failures;
+            }
+        }
+    }
+    if (sessionCount > 0) {
+        out << "Sessions:            " << sessionsReady << " of " << sessionCount << " ready at once\n";
+        out << "  memory:            " << (rssAfter - rssBefore) << " KiB resident, "
+            << (rssAfter - rssBefore) / qMax(1, sessionsReady) << " KiB per session\n";
+        out << "  setup CPU:         " << QString::number(setupCpuMs / qMax(1, sessionsReady), 'f', 2) << " ms per session\n";
+        out << "  idle CPU:          " << QString::number(idleCpuMs * 1000 / idleMs / qMax(1, sessionsReady), 'f', 3)
+            << " ms/s per session\n";
+        if (sessionsReady < sessionCount) {
+            ++failures;
+        }
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,109 @@
+// Emulates a pair of AirPods on a local socket, so the app can be run and
+// profiled without Bluetooth hardware.
+//
+//   aapemulator [--battery MS] [--ear MS] [--noise MS] [--delay MS]
+//               [--drop P] [--split] [--busy MS] [--debug] /tmp/aap.sock
+//   applinux --emulator /tmp/aap.sock
+//
+// --battery, --ear and --noise send periodic notifications every MS
+// milliseconds. --delay holds back every reply, --drop loses notifications
+// with probability P and --split writes frames in two parts. --busy takes MS
+// milliseconds over the handshake and ignores whatever arrives meanwhile.
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QLoggingCategory>
+#include <QSocketNotifier>
+#include <QTextStream>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../logger.h"
+#include "../seqpackettransport.h"
+#include "airpodsemulator.h"
+
+Q_LOGGING_CATEGORY(airpodsApp, "airpodsApp")
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTextStream err(stderr);
+
+    AirPodsEmulator::Config config;
+    bool debugMode = false;
+    QString socketPath;
+    const QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        if (args[i] == "--battery" && i + 1 < args.size()) {
+            config.batteryIntervalMs = args[++i].toInt();
+        } else if (args[i] == "--ear" && i + 1 < args.size()) {
+            config.earDetectionIntervalMs = args[++i].toInt();
+        } else if (args[i] == "--noise" && i + 1 < args.size()) {
+            config.noiseControlIntervalMs = args[++i].toInt();
+        } else if (args[i] == "--delay" && i + 1 < args.size()) {
+            config.responseDelayMs = args[++i].toInt();
+        } else if (args[i] == "--drop" && i + 1 < args.size()) {
+            config.dropProbability = args[++i].toDouble();
+        } else if (args[i] == "--split") {
+            config.splitFrames = true;
+        } else if (args[i] == "--busy" && i + 1 < args.size()) {
+            config.handshakeBusyMs = args[++i].toInt();
+        } else if (args[i] == "--debug") {
+            debugMode = true;
+        } else {
+            socketPath = args[i];
+        }
+    }
+    QLoggingCategory::setFilterRules(debugMode ? "airpodsApp.debug=true" : "airpodsApp.debug=false");
+
+    if (socketPath.isEmpty()) {
+        err << "Usage: aapemulator [--battery MS] [--ear MS] [--noise MS] [--delay MS] [--drop P] [--split] [--busy MS] [--debug] socket\n";
+        return 2;
+    }
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    QByteArray path = QFile::encodeName(socketPath);
+    if (path.size() >= static_cast<qsizetype>(sizeof(address.sun_path))) {
+        err << "Socket path too long: " << socketPath << "\n";
+        return 1;
+    }
+    std::memcpy(address.sun_path, path.constData(), path.size());
+    ::unlink(path.constData());
+
+    int listenFd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listenFd < 0 || ::bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+        || ::listen(listenFd, 4) != 0) {
+        err << "Cannot listen on " << socketPath << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    LOG_INFO("Emulating AirPods on " << socketPath);
+
+    // One emulated pair per connection, gone when the app disconnects
+    QSocketNotifier notifier(listenFd, QSocketNotifier::Read);
+    QObject::connect(&notifier, &QSocketNotifier::activated, &app, [&]() {
+        int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        LOG_INFO("App connected");
+        AirPodsEmulator *emulator = new AirPodsEmulator(config, &app);
+        SeqPacketDevice *device = new SeqPacketDevice(emulator);
+        device->adopt(fd);
+        emulator->attach(device);
+        QObject::connect(device, &SeqPacketDevice::peerClosed, emulator, [emulator]() {
+            const AirPodsEmulator::Stats &stats = emulator->stats();
+            LOG_INFO("App disconnected, frames received: " << stats.framesReceived << ", sent: " << stats.framesSent
+                     << ", dropped: " << stats.framesDropped);
+            emulator->deleteLater();
+        });
+    });
+
+    int result = app.exec();
+    ::close(listenFd);
+    ::unlink(path.constData());
+    return result;
+}
@@ -0,0 +1,180 @@
+// Replays a btsnoop capture of AAP traffic through AirPodsSession, the same
+// framer, dispatcher and handlers the app runs on live traffic, and reports
+// how fast it went and what state the session ended up in.
+//
+//   aapreplay [--realtime] [--repeat N] [--cid N] [--debug] capture.btsnoop
+//
+// Captures come from `applinux --capture file` or from SIGUSR2. Each ACL
+// handle is one pair and gets its own session. Only frames received from
+// the AirPods are fed to the sessions; sent frames are counted.
+// Unrecognized and malformed frames are read back from Metrics, where the
+// session counts them in the app too.
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QLoggingCategory>
+#include <QTextStream>
+#include <QThread>
+#include <map>
+#include <memory>
+
+#include "../airpodssession.h"
+#include "../btsnoop.h"
+#include "../logger.h"
+#include "../metrics.h"
+
+Q_LOGGING_CATEGORY(airpodsApp, "airpodsApp")
+
+using namespace AirpodsTrayApp;
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    bool realtime = false;
+    bool debugMode = false;
+    int repeat = 1;
+    int cid = -1;
+    QString fileName;
+    const QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        if (args[i] == "--realtime") {
+            realtime = true;
+        } else if (args[i] == "--debug") {
+            debugMode = true;
+        } else if (args[i] == "--repeat" && i + 1 < args.size()) {
+            repeat = qMax(1, args[++i].toInt());
+        } else if (args[i] == "--cid" && i + 1 < args.size()) {
+            cid = args[++i].toInt(nullptr, 0);
+        } else {
+            fileName = args[i];
+        }
+    }
+    QLoggingCategory::setFilterRules(debugMode ? "airpodsApp.debug=true" : "airpodsApp.debug=false");
+
+    if (fileName.isEmpty()) {
+        err << "Usage: aapreplay [--realtime] [--repeat N] [--cid N] [--debug] capture.btsnoop\n";
+        return 2;
+    }
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        err << "Cannot open " << fileName << ": " << file.errorString() << "\n";
+        return 1;
+    }
+    const uchar *mapped = file.map(0, file.size());
+    if (!mapped) {
+        err << "Cannot map " << fileName << ": " << file.errorString() << "\n";
+        return 1;
+    }
+    QByteArrayView capture(reinterpret_cast<const char *>(mapped), file.size());
+
+    if (!Btsnoop::Reader(capture).isValid()) {
+        err << fileName << " is not a btsnoop capture\n";
+        return 1;
+    }
+
+    // No transport: frames go straight to handleData(), replies are never written
+    std::map<quint16, std::unique_ptr<AirPodsSession>> sessions;
+    quint64 bytesReceived = 0;
+    auto sessionFor = [&sessions, &bytesReceived](quint16 handle) {
+        std::unique_ptr<AirPodsSession> &session = sessions[handle];
+        if (!session) {
+            session = std::make_unique<AirPodsSession>();
+            QObject::connect(session.get(), &AirPodsSession::frameReceived, [&bytesReceived](QByteArrayView frame) {
+                bytesReceived += frame.size();
+            });
+        }
+        return session.get();
+    };
+    quint64 framesSent = 0;
+    quint64 recordsSkipped = 0;
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int pass = 0; pass < repeat; ++pass) {
+        Btsnoop::Reader reader(capture);
+        Btsnoop::Record record;
+        qint64 firstTimestamp = -1;
+        QElapsedTimer passTimer;
+        passTimer.start();
+
+        while (reader.next(record)) {
+            if (cid >= 0 && record.cid != cid) {
+                continue;
+            }
+
+            if (realtime) {
+                // Keep the gaps between packets as they were captured
+                if (firstTimestamp < 0) {
+                    firstTimestamp = record.timestampUs;
+                }
+                qint64 aheadUs = (record.timestampUs - firstTimestamp) - passTimer.nsecsElapsed() / 1000;
+                if (aheadUs > 0) {
+                    QThread::usleep(aheadUs);
+                }
+            }
+
+            if (record.direction == Btsnoop::Direction::Sent) {
+                ++framesSent;
+                continue;
+            }
+            sessionFor(record.handle)->handleData(record.payload);
+        }
+        recordsSkipped += reader.skipped();
+    }
+
+    const qint64 elapsedNs = qMax<qint64>(1, timer.nsecsElapsed());
+    PacketFramer::Stats framerStats;
+    for (const auto &entry : sessions) {
+        const PacketFramer::Stats &stats = entry.second->framerStats();
+        framerStats.frames += stats.frames;
+        framerStats.framesSplit += stats.framesSplit;
+        framerStats.framesMerged += stats.framesMerged;
+    }
+    const quint64 frames = framerStats.frames;
+    const double seconds = elapsedNs / 1e9;
+
+    out << "Replayed " << fileName << (repeat > 1 ? QString(" %1 times").arg(repeat) : QString()) << "\n";
+    out << "  frames received:   " << frames << " (" << bytesReceived << " bytes)\n";
+    out << "  frames sent:       " << framesSent << "\n";
+    out << "  pairs:             " << sessions.size() << " (one session per ACL handle)\n";
+    out << "  unrecognized:      " << Metrics::value(Metrics::Counter::PacketsUnrecognized) << "\n";
+    out << "  parse failures:    " << Metrics::value(Metrics::Counter::ParseFailures) << "\n";
+    out << "  split / merged:    " << framerStats.framesSplit << " / " << framerStats.framesMerged << "\n";
+    out << "  records skipped:   " << recordsSkipped << "\n";
+    out << "  elapsed:           " << QString::number(seconds * 1000, 'f', 3) << " ms\n";
+    out << "  throughput:        " << QString::number(frames / seconds, 'f', 0) << " frames/s, "
+        << QString::number(bytesReceived / seconds / (1024 * 1024), 'f', 2) << " MiB/s, "
+        << QString::number(double(elapsedNs) / qMax<quint64>(1, frames), 'f', 1) << " ns/frame\n";
+
+    out << "  per opcode:";
+    for (int opcode = 0; opcode < 256; ++opcode) {
+        if (quint64 count = Metrics::packets(Metrics::Direction::Received, opcode)) {
+            out << QString(" 0x%1=%2").arg(opcode, 2, 16, QChar('0')).arg(count);
+        }
+    }
+    if (quint64 count = Metrics::packets(Metrics::Direction::Received, Metrics::OtherFrames)) {
+        out << " other=" << count;
+    }
+    out << "\n";
+
+    // What the app would show after this capture, per pair
+    for (const auto &entry : sessions) {
+        const AirPodsSession &session = *entry.second;
+        const DeviceSnapshot snapshot = session.snapshot();
+        const BatteryLevels &levels = session.batteryLevels();
+        out << QString("Final state of ACL handle 0x%1:\n").arg(entry.first, 3, 16, QChar('0'));
+        out << "  device:            " << (session.deviceName().isEmpty() ? QString("unknown") : session.deviceName())
+            << ", model " << int(session.model()) << "\n";
+        out << "  battery:           left " << int(levels.left) << "%, right " << int(levels.right) << "%, case "
+            << int(levels.caseLevel) << "%, single " << int(levels.single) << "%\n";
+        out << "  in ear:            left " << session.isLeftPodInEar() << ", right " << session.isRightPodInEar() << "\n";
+        out << "  noise control:     " << int(session.noiseControlMode()) << "\n";
+        out << "  snapshot version:  " << snapshot.version << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,293 @@
+#include "airpodsemulator.h"
+#include "../airpods_packets.h"
+#include "../logger.h"
+
+#include <QIODevice>
+#include <QRandomGenerator>
+#include <QTimer>
+
+using namespace AirpodsTrayApp::Enums;
+
+AirPodsEmulator::AirPodsEmulator(const Config &config, QObject *parent)
+    : QObject(parent)
+    , m_config(config)
+    , m_dispatcher(this)
+    , m_batteryTimer(new QTimer(this))
+    , m_earDetectionTimer(new QTimer(this))
+    , m_noiseControlTimer(new QTimer(this))
+{
+    using namespace AirPodsPackets;
+    m_dispatcher.setHandler(Opcode::SET_SPECIFIC_FEATURES, &AirPodsEmulator::onSetSpecificFeatures);
+    m_dispatcher.setHandler(Opcode::REQUEST_NOTIFICATIONS, &AirPodsEmulator::onRequestNotifications);
+    m_dispatcher.setHandler(Opcode::MAGIC_CLOUD_KEYS_REQUEST, &AirPodsEmulator::onMagicCloudKeysRequest);
+    m_dispatcher.setControlHandler(ControlCommand::NOISE_CONTROL_MODE, &AirPodsEmulator::onNoiseControlMode);
+    m_dispatcher.setControlHandler(ControlCommand::CONVERSATIONAL_AWARENESS, &AirPodsEmulator::onConversationalAwareness);
+    m_dispatcher.setControlHandler(ControlCommand::ADAPTIVE_NOISE_LEVEL, &AirPodsEmulator::onAdaptiveNoiseLevel);
+    m_dispatcher.setFallbackHandler(&AirPodsEmulator::onUnknownFrame);
+
+    m_batteryTimer->setInterval(config.batteryIntervalMs);
+    connect(m_batteryTimer, &QTimer::timeout, this, [this]() {
+        // Drain a percent per tick, pods faster than the case
+        m_leftLevel = m_leftLevel > 1 ? m_leftLevel - 1 : 100;
+        m_rightLevel = m_rightLevel > 1 ? m_rightLevel - 1 : 100;
+        if (m_leftLevel % 5 == 0)
+        {
+            m_caseLevel = m_caseLevel > 1 ? m_caseLevel - 1 : 100;
+        }
+        sendBattery();
+    });
+
+    m_earDetectionTimer->setInterval(config.earDetectionIntervalMs);
+    connect(m_earDetectionTimer, &QTimer::timeout, this, [this]() {
+        m_leftInEar = !m_leftInEar;
+        sendEarDetection();
+    });
+
+    m_noiseControlTimer->setInterval(config.noiseControlIntervalMs);
+    connect(m_noiseControlTimer, &QTimer::timeout, this, [this]() {
+        // Same as pressing the stem
+        int next = (static_cast<int>(m_noiseControlMode) + 1) % (static_cast<int>(NoiseControlMode::MaxValue) + 1);
+        m_noiseControlMode = static_cast<NoiseControlMode>(next);
+        sendNoiseControlMode();
+    });
+}
+
+void AirPodsEmulator::attach(QIODevice *device)
+{
+    if (m_device)
+    {
+        disconnect(m_device, nullptr, this, nullptr);
+    }
+    m_device = device;
+    m_framer.reset();
+    m_notifying = false;
+    m_handshakeBusy = false;
+    if (device)
+    {
+        connect(device, &QIODevice::readyRead, this, &AirPodsEmulator::readDevice);
+    }
+}
+
+void AirPodsEmulator::readDevice()
+{
+    char buffer[4096];
+    qint64 bytesRead;
+    while (m_device && (bytesRead = m_device->read(buffer, sizeof(buffer))) > 0)
+    {
+        m_framer.feed(QByteArrayView(buffer, bytesRead), [this](QByteArrayView frame) {
+            ++m_stats.framesReceived;
+            if (m_handshakeBusy)
+            {
+                LOG_DEBUG("Emulator busy with the handshake, ignored: " << AsyncLogger::hex(frame));
+                return;
+            }
+            LOG_DEBUG("Emulator received: " << AsyncLogger::hex(frame));
+            m_dispatcher.dispatch(frame);
+        });
+    }
+}
+
+void AirPodsEmulator::onUnknownFrame(QByteArrayView data)
+{
+    using namespace AirPodsPackets;
+    if (data.startsWith(Connection::HANDSHAKE))
+    {
+        if (m_config.handshakeBusyMs <= 0)
+        {
+            reply(Parse::HANDSHAKE_ACK);
+            return;
+        }
+        m_handshakeBusy = true;
+        QPointer<QIODevice> device = m_device;
+        QTimer::singleShot(m_config.handshakeBusyMs, this, [this, device]() {
+            if (device == m_device)
+            {
+                m_handshakeBusy = false;
+                reply(Parse::HANDSHAKE_ACK);
+            }
+        });
+        return;
+    }
+    LOG_DEBUG("Emulator ignored: " << AsyncLogger::hex(data));
+}
+
+void AirPodsEmulator::onSetSpecificFeatures(QByteArrayView)
+{
+    reply(AirPodsPackets::Parse::FEATURES_ACK);
+}
+
+void AirPodsEmulator::onRequestNotifications(QByteArrayView)
+{
+    // Sent again when the app retries, like the real AirPods do
+    m_notifying = true;
+    sendMetadata();
+    sendBattery();
+    sendEarDetection();
+    sendNoiseControlMode();
+    sendConversationalAwareness();
+
+    for (QTimer *timer : {m_batteryTimer, m_earDetectionTimer, m_noiseControlTimer})
+    {
+        if (timer->interval() > 0 && !timer->isActive())
+        {
+            timer->start();
+        }
+    }
+    emit notificationsRequested();
+}
+
+void AirPodsEmulator::onMagicCloudKeysRequest(QByteArrayView)
+{
+    using namespace AirPodsPackets;
+    char buffer[MagicPairing::MAGIC_CLOUD_KEYS_PACKET_SIZE];
+    PacketBuilder builder(buffer, sizeof(buffer));
+    builder.append(MagicPairing::MAGIC_CLOUD_KEYS_HEADER);
+    for (quint8 tag : {quint8(0x01), quint8(0x04)})
+    {
+        builder.append(tag).append(quint8(0x00)).append(quint8(16)).append(quint8(0x00));
+        for (int i = 0; i < 16; ++i)
+        {
+            builder.append(static_cast<quint8>(tag << 4 | i));
+        }
+    }
+    reply(builder.view());
+}
+
+void AirPodsEmulator::onNoiseControlMode(QByteArrayView data)
+{
+    using namespace AirPodsPackets;
+    if (data.size() != NoiseControl::PACKET_SIZE)
+    {
+        return;
+    }
+    quint8 rawMode = data[NoiseControl::MODE_OFFSET] - 1;
+    if (rawMode > static_cast<quint8>(NoiseControlMode::MaxValue))
+    {
+        return;
+    }
+    m_noiseControlMode = static_cast<NoiseControlMode>(rawMode);
+    reply(NoiseControl::getPacketForMode(m_noiseControlMode));
+}
+
+void AirPodsEmulator::onConversationalAwareness(QByteArrayView data)
+{
+    if (auto enabled = AirPodsPackets::ConversationalAwareness::parseCAState(data))
+    {
+        m_conversationalAwareness = *enabled;
+        // Reported back like the real AirPods do
+        reply(m_conversationalAwareness ? AirPodsPackets::ConversationalAwareness::ENABLED
+                                        : AirPodsPackets::ConversationalAwareness::DISABLED);
+    }
+}
+
+void AirPodsEmulator::onAdaptiveNoiseLevel(QByteArrayView data)
+{
+    if (data.size() > AirPodsPackets::Frame::CONTROL_VALUE_OFFSET)
+    {
+        m_adaptiveNoiseLevel = static_cast<quint8>(data[AirPodsPackets::Frame::CONTROL_VALUE_OFFSET]);
+    }
+}
+
+void AirPodsEmulator::flood(int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        m_leftLevel = 1 + i % 100;
+        sendBattery();
+    }
+}
+
+void AirPodsEmulator::reply(QByteArrayView frame)
+{
+    if (m_config.responseDelayMs <= 0)
+    {
+        write(frame);
+        return;
+    }
+    QTimer::singleShot(m_config.responseDelayMs, this, [this, frame = frame.toByteArray()]() { write(frame); });
+}
+
+void AirPodsEmulator::notify(QByteArrayView frame)
+{
+    if (!m_notifying)
+    {
+        return;
+    }
+    if (m_config.dropProbability > 0 && QRandomGenerator::global()->generateDouble() < m_config.dropProbability)
+    {
+        ++m_stats.framesDropped;
+        return;
+    }
+    reply(frame);
+}
+
+void AirPodsEmulator::write(QByteArrayView frame)
+{
+    if (!m_device || !m_device->isOpen())
+    {
+        return;
+    }
+
+    ++m_stats.framesSent;
+    LOG_DEBUG("Emulator sent: " << AsyncLogger::hex(frame));
+
+    // Only frames the app can find the end of may be split, others end with the read
+    qsizetype length = PacketFramer::frameLength(frame);
+    if (m_config.splitFrames && length == frame.size() && length > AirPodsPackets::Frame::PREFIX_SIZE)
+    {
+        qsizetype half = length / 2;
+        m_device->write(frame.data(), half);
+        m_device->write(frame.data() + half, length - half);
+        return;
+    }
+    m_device->write(frame.data(), frame.size());
+}
+
+void AirPodsEmulator::sendMetadata()
+{
+    QByteArray packet(AirPodsPackets::Parse::METADATA.data(), AirPodsPackets::Parse::METADATA.size());
+    packet.append(6, '\0');
+    for (const QByteArray &field : {m_config.name, m_config.modelNumber, QByteArray("Apple Inc."), QByteArray("1.0.0"),
+                                    QByteArray("6A326"), QByteArray("6A326"), QByteArray("1.0.0"),
+                                    QByteArray("com.apple.accessory.updater.app.71"), QByteArray("EMULATOR0001"),
+                                    QByteArray("EMULATOR0002"), QByteArray("8454624"), QByteArray("0123456789abcdef")})
+    {
+        packet.append(field).append('\0');
+    }
+    packet.append('\x01');
+    notify(packet);
+}
+
+void AirPodsEmulator::sendBattery()
+{
+    using namespace AirPodsPackets;
+    char buffer[Frame::HEADER_SIZE + 1 + Parse::BATTERY_COMPONENT_SIZE * Parse::MAX_BATTERY_COMPONENTS];
+    PacketBuilder builder(buffer, sizeof(buffer));
+    builder.append(Parse::BATTERY_STATUS).append(quint8(Parse::MAX_BATTERY_COMPONENTS));
+
+    // Component type, spacer, level, status (0x02 discharging, 0x01 charging), end
+    builder.append(quint8(0x04)).append(quint8(0x01)).append(m_leftLevel).append(quint8(0x02)).append(quint8(0x01));
+    builder.append(quint8(0x02)).append(quint8(0x01)).append(m_rightLevel).append(quint8(0x02)).append(quint8(0x01));
+    builder.append(quint8(0x08)).append(quint8(0x01)).append(m_caseLevel).append(quint8(0x01)).append(quint8(0x01));
+    notify(builder.view());
+}
+
+void AirPodsEmulator::sendEarDetection()
+{
+    using namespace AirPodsPackets;
+    char buffer[Parse::EAR_DETECTION_PACKET_SIZE];
+    PacketBuilder builder(buffer, sizeof(buffer));
+    builder.append(Parse::EAR_DETECTION).append(quint8(m_leftInEar ? 0x00 : 0x01)).append(quint8(0x00));
+    notify(builder.view());
+}
+
+void AirPodsEmulator::sendNoiseControlMode()
+{
+    notify(AirPodsPackets::NoiseControl::getPacketForMode(m_noiseControlMode));
+}
+
+void AirPodsEmulator::sendConversationalAwareness()
+{
+    notify(m_conversationalAwareness ? AirPodsPackets::ConversationalAwareness::ENABLED
+                                     : AirPodsPackets::ConversationalAwareness::DISABLED);
+}
@@ -0,0 +1,107 @@
+#ifndef AIRPODSEMULATOR_H
+#define AIRPODSEMULATOR_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QObject>
+#include <QPointer>
+
+#include "../enums.h"
+#include "../packetdispatcher.h"
+#include "../packetframer.h"
+
+class QIODevice;
+class QTimer;
+
+// Plays the AirPods side of AAP on a QIODevice, so the app and the benchmark
+// can run the whole protocol without Bluetooth.
+//
+// Answers the handshake, sends metadata and the current state once
+// notifications are requested, echoes noise control changes and can push
+// periodic battery, ear detection and noise control notifications. Faults
+// (slow responses, lost notifications, frames split across writes) are
+// injected as configured.
+class AirPodsEmulator : public QObject
+{
+    Q_OBJECT
+public:
+    struct Config
+    {
+        QByteArray name = "Emulated AirPods";
+        QByteArray modelNumber = "A2084"; // AirPods Pro
+
+        // Periodic notifications, 0 disables them
+        int batteryIntervalMs = 0;
+        int earDetectionIntervalMs = 0;
+        int noiseControlIntervalMs = 0;
+
+        int responseDelayMs = 0;      // Before every reply to the app
+        double dropProbability = 0.0; // Per notification, replies are never dropped
+        bool splitFrames = false;     // Write frames with a known length in two parts
+        // Time to process the handshake, frames arriving meanwhile are ignored like some firmware does
+        int handshakeBusyMs = 0;
+    };
+
+    struct Stats
+    {
+        quint64 framesReceived = 0;
+        quint64 framesSent = 0;
+        quint64 framesDropped = 0;
+    };
+
+    explicit AirPodsEmulator(const Config &config, QObject *parent = nullptr);
+
+    // Not owned, has to outlive the emulator or be one of its children
+    void attach(QIODevice *device);
+
+    const Stats &stats() const { return m_stats; }
+
+public slots:
+    // Sends count battery notifications back to back, for throughput measurements
+    void flood(int count);
+
+signals:
+    void notificationsRequested();
+
+private:
+    void readDevice();
+    void onUnknownFrame(QByteArrayView data);
+    void onSetSpecificFeatures(QByteArrayView data);
+    void onRequestNotifications(QByteArrayView data);
+    void onMagicCloudKeysRequest(QByteArrayView data);
+    void onNoiseControlMode(QByteArrayView data);
+    void onConversationalAwareness(QByteArrayView data);
+    void onAdaptiveNoiseLevel(QByteArrayView data);
+
+    void reply(QByteArrayView frame);
+    void notify(QByteArrayView frame);
+    void write(QByteArrayView frame);
+
+    void sendMetadata();
+    void sendBattery();
+    void sendEarDetection();
+    void sendNoiseControlMode();
+    void sendConversationalAwareness();
+
+    Config m_config;
+    QPointer<QIODevice> m_device;
+    PacketFramer m_framer;
+    PacketDispatcher<AirPodsEmulator> m_dispatcher;
+    Stats m_stats;
+    bool m_notifying = false;
+    bool m_handshakeBusy = false;
+
+    quint8 m_leftLevel = 100;
+    quint8 m_rightLevel = 90;
+    quint8 m_caseLevel = 80;
+    bool m_leftInEar = true;
+    AirpodsTrayApp::Enums::NoiseControlMode m_noiseControlMode = AirpodsTrayApp::Enums::NoiseControlMode::Off;
+    bool m_conversationalAwareness = false;
+    quint8 m_adaptiveNoiseLevel = 50;
+
+    QTimer *m_batteryTimer;
+    QTimer *m_earDetectionTimer;
+    QTimer *m_noiseControlTimer;
+};
+
+#endif // AIRPODSEMULATOR_H
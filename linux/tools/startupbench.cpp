@@ -0,0 +1,170 @@
+// Starts applinux against aapemulator again and again and measures how long
+// it takes until the tray icon is shown and until the emulated AirPods are
+// ready.
+//
+//   startupbench [--runs N] [--app PATH] [--emulator PATH] [--timeout MS]
+//
+// Times are taken from the startup timeline lines applinux logs and from the
+// wall clock here, which also covers exec and library loading. The first run
+// is reported on its own as it is the only one that may hit a cold page cache.
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QProcess>
+#include <QRegularExpression>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QTimer>
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+    struct Run
+    {
+        qint64 trayWallMs = -1; // Since QProcess::start
+        qint64 trayAppMs = -1;  // Since main() of applinux
+        qint64 readyWallMs = -1;
+        qint64 readyAppMs = -1;
+    };
+
+    QString summarize(std::vector<qint64> values)
+    {
+        values.erase(std::remove(values.begin(), values.end(), -1), values.end());
+        if (values.empty()) {
+            return "n/a";
+        }
+        std::sort(values.begin(), values.end());
+        return QString("min %1 / median %2 / max %3 ms")
+            .arg(values.front())
+            .arg(values[values.size() / 2])
+            .arg(values.back());
+    }
+
+    Run measure(const QString &app, const QString &socketPath, int timeoutMs)
+    {
+        static const QRegularExpression stepLine("Startup: (.+?) after (\\d+) ms");
+
+        Run run;
+        QProcess process;
+        process.setProcessChannelMode(QProcess::MergedChannels);
+        QEventLoop loop;
+        QElapsedTimer clock;
+        QByteArray pending;
+
+        QObject::connect(&process, &QProcess::readyRead, &loop, [&]() {
+            pending += process.readAll();
+            qsizetype newline;
+            while ((newline = pending.indexOf('\n')) >= 0) {
+                QString line = QString::fromLocal8Bit(pending.left(newline));
+                pending.remove(0, newline + 1);
+                QRegularExpressionMatch match = stepLine.match(line);
+                if (!match.hasMatch()) {
+                    continue;
+                }
+                if (match.captured(1) == "tray icon shown") {
+                    run.trayWallMs = clock.elapsed();
+                    run.trayAppMs = match.captured(2).toLongLong();
+                } else if (match.captured(1) == "device ready") {
+                    run.readyWallMs = clock.elapsed();
+                    run.readyAppMs = match.captured(2).toLongLong();
+                    loop.quit();
+                }
+            }
+        });
+        QObject::connect(&process, &QProcess::finished, &loop, &QEventLoop::quit);
+        QTimer::singleShot(timeoutMs, &loop, &QEventLoop::quit);
+
+        clock.start();
+        process.start(app, {"--emulator", socketPath});
+        loop.exec();
+
+        process.terminate();
+        if (!process.waitForFinished(3000)) {
+            process.kill();
+            process.waitForFinished();
+        }
+        return run;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    const QString binDir = QCoreApplication::applicationDirPath();
+    // airpodsd has no tray icon, only the device ready times are meaningful for it
+    QString appPath = QFile::exists(binDir + "/applinux") ? binDir + "/applinux" : binDir + "/airpodsd";
+    QString emulatorPath = binDir + "/aapemulator";
+    int runs = 10;
+    int timeoutMs = 15000;
+    const QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        if (args[i] == "--runs" && i + 1 < args.size()) {
+            runs = qMax(1, args[++i].toInt());
+        } else if (args[i] == "--app" && i + 1 < args.size()) {
+            appPath = args[++i];
+        } else if (args[i] == "--emulator" && i + 1 < args.size()) {
+            emulatorPath = args[++i];
+        } else if (args[i] == "--timeout" && i + 1 < args.size()) {
+            timeoutMs = qMax(1000, args[++i].toInt());
+        } else {
+            err << "Usage: startupbench [--runs N] [--app PATH] [--emulator PATH] [--timeout MS]\n";
+            return 2;
+        }
+    }
+
+    QTemporaryDir dir;
+    const QString socketPath = dir.filePath("aap.sock");
+    QProcess emulator;
+    emulator.start(emulatorPath, {socketPath});
+    QElapsedTimer waited;
+    waited.start();
+    while (!QFile::exists(socketPath) && waited.elapsed() < 5000) {
+        if (emulator.waitForFinished(20)) {
+            err << "aapemulator exited: " << emulator.readAllStandardError() << "\n";
+            return 1;
+        }
+    }
+    if (!QFile::exists(socketPath)) {
+        err << "aapemulator did not create " << socketPath << "\n";
+        return 1;
+    }
+
+    std::vector<Run> results;
+    int failures = 0;
+    for (int i = 0; i < runs; ++i) {
+        Run run = measure(appPath, socketPath, timeoutMs);
+        if (run.readyWallMs < 0) {
+            ++failures;
+        }
+        results.push_back(run);
+    }
+
+    emulator.terminate();
+    emulator.waitForFinished(3000);
+
+    auto column = [&](qint64 Run::*field, bool skipFirst) {
+        std::vector<qint64> values;
+        for (size_t i = skipFirst ? 1 : 0; i < results.size(); ++i) {
+            values.push_back(results[i].*field);
+        }
+        return summarize(values);
+    };
+
+    const Run &first = results.front();
+    out << "Runs:                " << runs << " (" << failures << " never became ready)\n";
+    out << "First run:           tray " << first.trayWallMs << " ms, ready " << first.readyWallMs << " ms\n";
+    out << "Tray icon shown\n";
+    out << "  since exec:        " << column(&Run::trayWallMs, runs > 1) << "\n";
+    out << "  since main():      " << column(&Run::trayAppMs, runs > 1) << "\n";
+    out << "Device ready\n";
+    out << "  since exec:        " << column(&Run::readyWallMs, runs > 1) << "\n";
+    out << "  since main():      " << column(&Run::readyAppMs, runs > 1) << "\n";
+    return failures ? 1 : 0;
+}
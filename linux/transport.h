@@ -0,0 +1,36 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <QObject>
+#include <QString>
+
+class QIODevice;
+
+// Byte pipe to one pair of AirPods.
+//
+// AirPodsSession only talks to a Transport, so the protocol runs the same
+// over the Bluetooth L2CAP channel and over a local socket connected to the
+// emulator. Every read from device() returns what arrived in one packet of
+// the underlying channel.
+class Transport : public QObject
+{
+    Q_OBJECT
+public:
+    using QObject::QObject;
+
+    // Emits connected() or errorOccurred() later, never from inside open()
+    virtual void open() = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() const = 0;
+
+    // Valid for the lifetime of the transport
+    virtual QIODevice *device() const = 0;
+    virtual QString peerAddress() const = 0;
+
+signals:
+    void connected();
+    void disconnected();
+    void errorOccurred(const QString &message);
+};
+
+#endif // TRANSPORT_H
@@ -32,10 +32,10 @@ void TrayIconManager::showNotification(const QString &title, const QString &mess
     trayIcon->showMessage(title, message, QSystemTrayIcon::Information, 3000);
 }
 
-void TrayIconManager::TrayIconManager::updateBatteryStatus(const QString &status)
+void TrayIconManager::updateBatteryStatus(const AirpodsTrayApp::BatteryLevels &levels)
 {
-    trayIcon->setToolTip("Battery Status: " + status);
-    updateIconFromBattery(status);
+    trayIcon->setToolTip("Battery Status: " + levels.toString());
+    updateIconFromBattery(levels);
 }
 
 void TrayIconManager::updateNoiseControlState(NoiseControlMode mode)
@@ -52,8 +52,35 @@ void TrayIconManager::updateConversationalAwareness(bool enabled)
     caToggleAction->setChecked(enabled);
 }
 
+void TrayIconManager::updateDevices(const QList<SessionRegistry::Device> &devices)
+{
+    // Rebuilt every time, there are only ever a few pairs
+    for (QAction *action : devicesGroup->actions())
+    {
+        devicesGroup->removeAction(action);
+        delete action;
+    }
+    for (const SessionRegistry::Device &device : devices)
+    {
+        QAction *action = new QAction(device.connected ? device.name : device.name + " (disconnected)", devicesMenu);
+        action->setCheckable(true);
+        action->setChecked(device.active);
+        devicesGroup->addAction(action);
+        devicesMenu->addAction(action);
+        connect(action, &QAction::triggered, this, [this, address = device.address]()
+                { emit deviceSelected(address); });
+    }
+    // Nothing to choose between with a single pair
+    devicesMenu->menuAction()->setVisible(devices.size() > 1);
+}
+
 void TrayIconManager::setupMenuActions()
 {
+    // Device selection, only shown with more than one pair connected
+    devicesMenu = trayMenu->addMenu("Devices");
+    devicesGroup = new QActionGroup(devicesMenu);
+    devicesMenu->menuAction()->setVisible(false);
+
     // Conversational Awareness Toggle
     caToggleAction = new QAction("Toggle Conversational Awareness", trayMenu);
     caToggleAction->setCheckable(true);
@@ -86,24 +113,17 @@ void TrayIconManager::setupMenuActions()
     connect(quitAction, &QAction::triggered, qApp, &QApplication::quit);
 }
 
-void TrayIconManager::updateIconFromBattery(const QString &status)
+void TrayIconManager::updateIconFromBattery(const AirpodsTrayApp::BatteryLevels &levels)
 {
-    int leftLevel = 0;
-    int rightLevel = 0;
+    int leftLevel = levels.left;
+    int rightLevel = levels.right;
 
-    if (!status.isEmpty())
-    {
-        // Parse the battery status string
-        QStringList parts = status.split(", ");
-        if (parts.size() >= 2)
-        {
-            leftLevel = parts[0].split(": ")[1].replace("%", "").toInt();
-            rightLevel = parts[1].split(": ")[1].replace("%", "").toInt();
-        }
-    }
-    
     int minLevel = (leftLevel == 0) ? rightLevel : (rightLevel == 0) ? leftLevel
                                                                      : qMin(leftLevel, rightLevel);
+    if (minLevel == 0)
+    {
+        minLevel = levels.single; // One battery, AirPods Max
+    }
 
     QPixmap pixmap(32, 32);
     pixmap.fill(Qt::transparent);
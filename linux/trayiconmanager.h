@@ -1,7 +1,9 @@
 #include <QObject>
 #include <QSystemTrayIcon>
 
+#include "deviceevents.h"
 #include "enums.h"
+#include "sessionregistry.h"
 
 class QMenu;
 class QAction;
@@ -14,12 +16,14 @@ class TrayIconManager : public QObject
 public:
     explicit TrayIconManager(QObject *parent = nullptr);
 
-    void updateBatteryStatus(const QString &status);
+    void updateBatteryStatus(const AirpodsTrayApp::BatteryLevels &levels);
 
     void updateNoiseControlState(AirpodsTrayApp::Enums::NoiseControlMode);
 
     void updateConversationalAwareness(bool enabled);
 
+    void updateDevices(const QList<SessionRegistry::Device> &devices);
+
     void showNotification(const QString &title, const QString &message);
 
 private slots:
@@ -30,13 +34,16 @@ private:
     QMenu *trayMenu;
     QAction *caToggleAction;
     QActionGroup *noiseControlGroup;
+    QMenu *devicesMenu;
+    QActionGroup *devicesGroup;
 
     void setupMenuActions();
 
-    void updateIconFromBattery(const QString &status);
+    void updateIconFromBattery(const AirpodsTrayApp::BatteryLevels &levels);
 
 signals:
     void trayClicked();
     void noiseControlChanged(AirpodsTrayApp::Enums::NoiseControlMode);
     void conversationalAwarenessToggled(bool enabled);
+    void deviceSelected(const QString &address);
 };
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include "unixsignalnotifier.h"
+#include "logger.h"
+
+#include <QMutex>
+#include <QSocketNotifier>
+#include <atomic>
+#include <csignal>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+    constexpr int MaxNotifiersPerSignal = 4;
+
+    // A socket pair per notifier, written by the handler and read by the
+    // notifier. Pairs are never closed: once a notifier is gone its pair is
+    // kept for the next one, so the handler never writes to a closed or
+    // reused descriptor.
+    struct Slot
+    {
+        std::atomic<int> writeFd{-1};
+        int readFd = -1;
+        bool inUse = false;
+    };
+
+    Slot s_slots[NSIG][MaxNotifiersPerSignal];
+    int s_users[NSIG] = {};
+    QBasicMutex s_mutex; // Guards everything but the handler's reads of writeFd
+}
+
+UnixSignalNotifier::UnixSignalNotifier(int signalNumber, QObject *parent)
+    : QObject(parent), m_signalNumber(signalNumber)
+{
+    if (signalNumber <= 0 || signalNumber >= NSIG)
+    {
+        LOG_ERROR("Cannot watch signal " << signalNumber);
+        return;
+    }
+
+    QMutexLocker locker(&s_mutex);
+    for (int i = 0; i < MaxNotifiersPerSignal && m_slot < 0; ++i)
+    {
+        if (!s_slots[signalNumber][i].inUse)
+        {
+            m_slot = i;
+        }
+    }
+    if (m_slot < 0)
+    {
+        LOG_ERROR("Too many notifiers for signal " << signalNumber);
+        return;
+    }
+
+    Slot &slot = s_slots[signalNumber][m_slot];
+    if (slot.readFd < 0)
+    {
+        int sockets[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sockets) != 0)
+        {
+            LOG_ERROR("Cannot watch signal " << signalNumber);
+            m_slot = -1;
+            return;
+        }
+        slot.readFd = sockets[1];
+        slot.writeFd.store(sockets[0], std::memory_order_release);
+    }
+    slot.inUse = true;
+
+    // Deliveries from before the previous owner went away are not ours
+    char buffer[16];
+    while (::read(slot.readFd, buffer, sizeof(buffer)) > 0)
+    {
+    }
+
+    m_notifier = new QSocketNotifier(slot.readFd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &UnixSignalNotifier::readSignal);
+
+    if (s_users[signalNumber]++ == 0)
+    {
+        struct sigaction action = {};
+        action.sa_handler = &UnixSignalNotifier::handleSignal;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        ::sigaction(signalNumber, &action, nullptr);
+    }
+}
+
+UnixSignalNotifier::~UnixSignalNotifier()
+{
+    if (!m_notifier)
+    {
+        return;
+    }
+
+    QMutexLocker locker(&s_mutex);
+    // Before the slot is free for another notifier, possibly on another thread
+    delete m_notifier;
+    s_slots[m_signalNumber][m_slot].inUse = false;
+    if (--s_users[m_signalNumber] == 0)
+    {
+        ::signal(m_signalNumber, SIG_DFL);
+    }
+}
+
+void UnixSignalNotifier::handleSignal(int signalNumber)
+{
+    // Every notifier for the signal gets it. Pairs of notifiers that are gone
+    // fill up and then fail with EAGAIN, which is fine.
+    char byte = 1;
+    for (Slot &slot : s_slots[signalNumber])
+    {
+        int fd = slot.writeFd.load(std::memory_order_acquire);
+        if (fd >= 0)
+        {
+            [[maybe_unused]] ssize_t written = ::write(fd, &byte, sizeof(byte));
+        }
+    }
+}
+
+void UnixSignalNotifier::readSignal()
+{
+    // Several deliveries of the same signal collapse into one activation
+    char buffer[16];
+    while (::read(s_slots[m_signalNumber][m_slot].readFd, buffer, sizeof(buffer)) > 0)
+    {
+    }
+    emit activated();
+}
@@ -0,0 +1,35 @@
+#ifndef UNIXSIGNALNOTIFIER_H
+#define UNIXSIGNALNOTIFIER_H
+
+#include <QObject>
+
+class QSocketNotifier;
+
+// Delivers a Unix signal as a Qt signal on the thread that created the
+// notifier. The handler itself only writes a byte to a socket pair, which is
+// all that is safe to do there.
+//
+// Several notifiers may watch the same signal, up to four, and all of them
+// are activated. The default disposition comes back with the last one.
+class UnixSignalNotifier : public QObject
+{
+    Q_OBJECT
+public:
+    explicit UnixSignalNotifier(int signalNumber, QObject *parent = nullptr);
+    ~UnixSignalNotifier() override;
+
+    int signalNumber() const { return m_signalNumber; }
+
+signals:
+    void activated();
+
+private:
+    static void handleSignal(int signalNumber);
+    void readSignal();
+
+    int m_signalNumber;
+    int m_slot = -1; // Of the socket pair, see unixsignalnotifier.cpp
+    QSocketNotifier *m_notifier = nullptr;
+};
+
+#endif // UNIXSIGNALNOTIFIER_H
@@ -0,0 +1,170 @@
+#include "volumeducker.h"
+#include "audiobackend.h"
+#include "logger.h"
+#include "metrics.h"
+#include "reactionlatency.h"
+
+#include <QTimer>
+
+namespace
+{
+    // Gain change per second, duck quickly so speech isn't talked over, come back gently
+    constexpr double DuckRate = 4.0;
+    constexpr double ReleaseRate = 1.0;
+
+    constexpr quint8 SpeakingLevel = 2; // 1 and 2 mean speaking
+    constexpr quint8 NormalLevel = 8;   // 8 and 9 mean normal volume
+}
+
+VolumeDucker::VolumeDucker(AudioBackend *audio, QObject *parent)
+    : QObject(parent)
+    , m_audio(audio)
+    , m_rampTimer(new QTimer(this))
+    , m_releaseTimer(new QTimer(this))
+{
+    m_rampTimer->setInterval(50);
+    m_rampTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_rampTimer, &QTimer::timeout, this, &VolumeDucker::step);
+
+    m_releaseTimer->setSingleShot(true);
+    m_releaseTimer->setInterval(15000);
+    connect(m_releaseTimer, &QTimer::timeout, this, [this]() {
+        LOG_WARN("No conversational awareness update for " << m_releaseTimer->interval() << " ms, restoring volume");
+        restore();
+    });
+
+    // A duck has taken effect once the server reports the first lowered volume
+    connect(m_audio, &AudioBackend::sinkChanged, this, [this](const QString &name) {
+        const AudioBackend::Sink *sink = isDucked() && name == m_sinkName ? m_audio->findSink(name) : nullptr;
+        if (sink && sink->volume == m_lastVolume)
+        {
+            ReactionLatency::finish(ReactionLatency::Reaction::ConversationalAwarenessDuck);
+        }
+    });
+}
+
+void VolumeDucker::setDuckedGain(double gain)
+{
+    m_duckedGain = qBound(0.0, gain, 1.0);
+}
+
+void VolumeDucker::setUpdateInterval(int msec)
+{
+    m_rampTimer->setInterval(qMax(1, msec));
+}
+
+void VolumeDucker::setReleaseTimeout(int msec)
+{
+    m_releaseTimer->setInterval(msec);
+}
+
+double VolumeDucker::gainForLevel(quint8 level, double duckedGain)
+{
+    if (level <= SpeakingLevel)
+    {
+        return duckedGain;
+    }
+    if (level >= NormalLevel)
+    {
+        return 1.0;
+    }
+    // Intermediate levels step the volume back up while the wearer stops speaking
+    double progress = double(level - SpeakingLevel) / (NormalLevel - SpeakingLevel);
+    return duckedGain + (1.0 - duckedGain) * progress;
+}
+
+void VolumeDucker::handleSpeechLevel(const QString &sinkName, quint8 level)
+{
+    double target = gainForLevel(level, m_duckedGain);
+    if (!isDucked())
+    {
+        if (target >= 1.0)
+        {
+            return;
+        }
+        const AudioBackend::Sink *sink = m_audio->findSink(sinkName);
+        if (!sink)
+        {
+            LOG_ERROR("Cannot duck unknown sink " << sinkName);
+            return;
+        }
+        m_sinkName = sinkName;
+        m_baseVolume = sink->volume;
+        m_lastVolume = sink->volume;
+        m_gain = 1.0;
+        Metrics::add(Metrics::Counter::VolumeDucks);
+        LOG_INFO("Ducking " << sinkName << " from " << m_baseVolume << "%");
+    }
+
+    // Packets only move the target, the ramp picks it up on its next tick
+    m_targetGain = target;
+    m_releaseTimer->start();
+    if (!m_rampTimer->isActive() && m_gain != m_targetGain)
+    {
+        m_sinceStep.start();
+        m_rampTimer->start();
+    }
+}
+
+void VolumeDucker::restore()
+{
+    if (!isDucked())
+    {
+        return;
+    }
+    m_targetGain = 1.0;
+    if (!m_rampTimer->isActive())
+    {
+        m_sinceStep.start();
+        m_rampTimer->start();
+    }
+}
+
+void VolumeDucker::restoreNow()
+{
+    if (!isDucked())
+    {
+        return;
+    }
+    m_gain = m_targetGain = 1.0;
+    finish();
+}
+
+void VolumeDucker::step()
+{
+    // Late ticks catch up, but a stalled event loop must not turn into a jump
+    double elapsed = qMin<qint64>(m_sinceStep.restart(), 2 * m_rampTimer->interval()) / 1000.0;
+    double rate = m_targetGain < m_gain ? DuckRate : ReleaseRate;
+    double delta = qMin(rate * elapsed, qAbs(m_targetGain - m_gain));
+    m_gain += m_targetGain < m_gain ? -delta : delta;
+
+    if (m_gain == m_targetGain)
+    {
+        m_rampTimer->stop();
+        if (m_targetGain >= 1.0)
+        {
+            finish();
+            return;
+        }
+    }
+
+    int volume = qRound(m_baseVolume * m_gain);
+    if (volume != m_lastVolume)
+    {
+        m_audio->setSinkVolume(m_sinkName, volume);
+        m_lastVolume = volume;
+        ReactionLatency::mark(ReactionLatency::Reaction::ConversationalAwarenessDuck, ReactionLatency::Stage::ActionIssued);
+    }
+}
+
+void VolumeDucker::finish()
+{
+    m_rampTimer->stop();
+    m_releaseTimer->stop();
+    if (m_lastVolume != m_baseVolume)
+    {
+        m_audio->setSinkVolume(m_sinkName, m_baseVolume);
+    }
+    LOG_INFO("Volume of " << m_sinkName << " restored to " << m_baseVolume << "%");
+    m_sinkName.clear();
+}
@@ -0,0 +1,58 @@
+#ifndef VOLUMEDUCKER_H
+#define VOLUMEDUCKER_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QString>
+
+class AudioBackend;
+class QTimer;
+
+// Lowers the volume of a sink while the wearer is speaking, following the
+// speech level in conversational awareness packets.
+//
+// Levels only set a target gain; a timer ramps towards it and sends at most
+// one volume request per tick, only when the rounded volume changes. Once the
+// target is reached the timer stops, so steady speech costs nothing. The
+// volume from before ducking is restored exactly, also when no packet has
+// arrived for releaseTimeout.
+class VolumeDucker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit VolumeDucker(AudioBackend *audio, QObject *parent = nullptr);
+
+    // Fraction of the original volume while the wearer speaks
+    void setDuckedGain(double gain);
+    void setUpdateInterval(int msec);
+    void setReleaseTimeout(int msec);
+
+    // Level byte of a conversational awareness packet: 1-2 speaking, 8-9 normal
+    void handleSpeechLevel(const QString &sinkName, quint8 level);
+    // Ramps back to the original volume
+    void restore();
+    // Sets the original volume right away, e.g. when the AirPods disconnect
+    void restoreNow();
+
+    bool isDucked() const { return !m_sinkName.isEmpty(); }
+
+    static double gainForLevel(quint8 level, double duckedGain);
+
+private:
+    void step();
+    void finish();
+
+    AudioBackend *m_audio;
+    QTimer *m_rampTimer;
+    QTimer *m_releaseTimer;
+    QElapsedTimer m_sinceStep;
+
+    QString m_sinkName; // Empty while not ducked
+    int m_baseVolume = 0;
+    int m_lastVolume = 0;
+    double m_gain = 1.0;
+    double m_targetGain = 1.0;
+    double m_duckedGain = 0.2;
+};
+
+#endif // VOLUMEDUCKER_H